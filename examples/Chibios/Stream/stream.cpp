@@ -4,7 +4,8 @@
 #include "hal.h"
 #include "chprintf.h"
 #include <RF24.h>
-#include <rf24_serial.h>
+#include <rf24-chibios-serial.h>
+#include <rf24-chibios-bridge.h>
 
 using namespace chibios_rt;
 using namespace rf24::serial;
@@ -31,16 +32,29 @@ static const SerialConfig consoleConfig = {
         230400, 0, 0, 0
 };
 
+Rf24ChibiosSpi radioSpi(&SPID2);
+
+static void rf24SpiEnd(SPIDriver *spip) {
+    (void)spip;
+    chSysLockFromISR();
+    radioSpi.endI();
+    chSysUnlockFromISR();
+}
+
 static const SPIConfig rf24SpiConfig = {
-        NULL,
+        rf24SpiEnd,
         GPIOB,
         GPIOB_RF24_CS,
         SPI_CR1_BR_1,
 };
 
-Rf24ChibiosIo radioIo(&SPID2, &rf24SpiConfig, GPIOB, GPIOB_RF24_CE);
-RF24 radio(radioIo);
-RF24Serial remote(radio);
+Rf24ChibiosIo radioIo(&SPID2, &rf24SpiConfig, PAL_LINE(GPIOB, GPIOB_RF24_CE), &radioSpi, PAL_LINE(GPIOC, GPIOC_RF24_IRQ));
+RF24<Rf24ChibiosIo, BaseRF24Serial::ADDRESS_WIDTH> radio(radioIo);
+// More packets than the default, so that the transmit queue fills while
+// the pool still has free packets. The bridge then only learns that the
+// queue has room from the TX_EVENT sent when a full one drains: typing
+// faster than the radio sends keeps that path covered.
+RF24Serial<12> remote(radioIo);
 
 void remoteIrq(EXTDriver *extp, expchannel_t channel) {
     (void)extp;
@@ -132,28 +146,6 @@ void setup() {
 }
 
 
-class RelayThread: public BaseStaticThread<1024> {
-private:
-    BaseSequentialStream *in, *out;
-protected:
-    virtual void main(void) {
-        uint8_t buffer[256];
-        while(true) {
-            size_t read = chSequentialStreamRead(in, buffer, sizeof(buffer));
-            if(read > 0) {
-                chSequentialStreamWrite(out, buffer, read);
-            } else {
-                println("empty read");
-            }
-        }
-    }
-
-public:
-    RelayThread(BaseSequentialStream *_in, BaseSequentialStream *_out) :
-            BaseStaticThread<1024>(), in(_in), out(_out) {
-    }
-};
-
 void blink() {
     while (true) {
         palClearPad(GPIOA, GPIOA_LED_GREEN);
@@ -163,23 +155,9 @@ void blink() {
     }
 }
 
-class SendThread : public BaseStaticThread<1024> {
-protected:
-    virtual void main(void) {
-        int counter = 0;
-        while(true) {
-            remote.print("ABCDEFGHIJKLMNOPQRSTUVWXYZ%5d\n", counter);
-            print("sent "); print(counter++); println("");
-        }
-    }
-
-public:
-    SendThread() : BaseStaticThread<1024>() { }
-};
-
-// RelayThread send(console, remote.stream());
-SendThread send;
-RelayThread recv(remote.stream(), console);
+// Everything typed on the console goes over the radio, and everything
+// from the radio comes out on the console.
+RF24SerialBridge<> bridge(remote, (BaseAsynchronousChannel *)&SD2);
 
 int main(void) {
     halInit();
@@ -194,10 +172,8 @@ int main(void) {
     // Set up SPI pins
     setup_rf24_spi_pins();
     setup();
-    radio.printDetails();
     extStart(&EXTD1, &extcfg);
     remote.start();
-    send.start(NORMALPRIO);
-    recv.start(NORMALPRIO);
+    bridge.start(NORMALPRIO);
     blink();
 }
@@ -0,0 +1,204 @@
+
+/**
+ * @file rf24-accounting-io.h
+ * An IO that counts what goes over the bus, against whatever the caller
+ * is doing at the time.
+ */
+#ifndef _RF24_ACCOUNTING_IO_H_
+#define _RF24_ACCOUNTING_IO_H_
+
+#include <stdint.h>
+#include <string.h>
+#include "rf24-config.h"
+
+namespace rf24 {
+
+/**
+ * Transactions, bytes and time on the bus, in total and for each named
+ * marker.
+ *
+ * A SpiMarker names what's going on, usually one call into RF24, for as
+ * long as it's in scope. Transactions while markers are nested count
+ * towards the innermost one only, so that the totals of the markers add
+ * up to the total. Transactions with no marker only count towards the
+ * total.
+ */
+class SpiAccount {
+public:
+    static const uint8_t MARKERS = 32;
+
+    struct Totals {
+        const char *name;
+        uint32_t calls;         //!< times a marker with this name was made
+        uint32_t transactions;
+        uint32_t bytes;         //!< including the command bytes
+        uint32_t micros;        //!< with CSN low, or as near as micros() tells
+        uint32_t mostTransactions;  //!< in the costliest one marker
+        uint32_t mostBytes;
+    };
+
+    SpiAccount() {
+        reset();
+    }
+
+    /**
+     * Forget everything counted so far. Markers in scope keep counting,
+     * under their names, from now on.
+     */
+    void reset() {
+        memset(&all, 0, sizeof(all));
+        for(uint8_t i = 0; i < count; i++) {
+            const char *name = markers[i].name;
+            memset(&markers[i], 0, sizeof(markers[i]));
+            markers[i].name = name;
+        }
+    }
+
+    inline const Totals &total() const {
+        return all;
+    }
+
+    /**
+     * @return the totals for @p name, or NULL if no marker has had it
+     */
+    const Totals *find(const char *name) const {
+        for(uint8_t i = 0; i < count; i++) {
+            if(strcmp(markers[i].name, name) == 0) {
+                return &markers[i];
+            }
+        }
+        return NULL;
+    }
+
+    inline uint8_t size() const {
+        return count;
+    }
+
+    inline const Totals &operator[](uint8_t index) const {
+        return markers[index];
+    }
+
+    /**
+     * Count a transaction of @p bytes, including the command byte.
+     */
+    void add(uint8_t bytes, uint32_t micros) {
+        Totals *totals[] = { &all, current };
+        for(Totals *t : totals) {
+            if(t != NULL) {
+                t->transactions++;
+                t->bytes += bytes;
+                t->micros += micros;
+            }
+        }
+    }
+
+private:
+    friend class SpiMarker;
+
+    Totals all;
+    Totals markers[MARKERS];
+    uint8_t count = 0;
+    Totals *current = NULL;
+
+    // Once the table is full, new names go uncounted, except in the total
+    Totals *enter(const char *name) {
+        Totals *totals = const_cast<Totals *>(find(name));
+        if(totals == NULL && count < MARKERS) {
+            totals = &markers[count++];
+            memset(totals, 0, sizeof(*totals));
+            totals->name = name;
+        }
+        if(totals != NULL) {
+            totals->calls++;
+        }
+        current = totals;
+        return totals;
+    }
+
+    inline void leave(Totals *outer) {
+        current = outer;
+    }
+
+    SpiAccount(const SpiAccount &) = delete;
+    SpiAccount &operator=(const SpiAccount &) = delete;
+};
+
+/**
+ * Charge the transactions made while this is in scope to @p name.
+ * @code
+ * {
+ *     rf24::SpiMarker marker(account, "stopListening");
+ *     radio.stopListening();
+ * }
+ * @endcode
+ * The name has to outlive the account, as a string literal does.
+ */
+class SpiMarker {
+public:
+    SpiMarker(SpiAccount &account, const char *name)
+        : account(account), outer(account.current), transactions(0), bytes(0) {
+        totals = account.enter(name);
+        if(totals != NULL) {
+            transactions = totals->transactions;
+            bytes = totals->bytes;
+        }
+    }
+
+    ~SpiMarker() {
+        if(totals != NULL) {
+            // Less than at the start if the account was reset meanwhile
+            uint32_t spent = totals->transactions - rf24_min(transactions, totals->transactions);
+            totals->mostTransactions = rf24_max(totals->mostTransactions, spent);
+            spent = totals->bytes - rf24_min(bytes, totals->bytes);
+            totals->mostBytes = rf24_max(totals->mostBytes, spent);
+        }
+        account.leave(outer);
+    }
+
+private:
+    SpiAccount &account;
+    SpiAccount::Totals * const outer;
+    SpiAccount::Totals *totals;
+    uint32_t transactions;
+    uint32_t bytes;
+
+    SpiMarker(const SpiMarker &) = delete;
+    SpiMarker &operator=(const SpiMarker &) = delete;
+};
+
+/**
+ * An RF24 IO that passes everything on to another, @p IO, and counts
+ * each transaction in an SpiAccount. The account is shared, rather than
+ * part of the IO, because RF24 keeps its own copy of the IO.
+ */
+template<typename IO>
+class AccountingIo {
+public:
+    AccountingIo(const IO &io, SpiAccount *account) : io(io), account(account) {
+    }
+
+    AccountingIo(const AccountingIo &io) = default;
+
+    inline void begin() {
+        io.begin();
+    }
+
+    inline uint8_t transaction(uint8_t cmd, const uint8_t *tx, uint8_t *rx, uint8_t len) {
+        uint32_t start = micros();
+        uint8_t status = io.transaction(cmd, tx, rx, len);
+        account->add(len + 1, micros() - start);
+        return status;
+    }
+
+    inline void ce(bool level) {
+        io.ce(level);
+    }
+
+private:
+    IO io;
+    SpiAccount *account;
+};
+
+}
+
+#endif // _RF24_ACCOUNTING_IO_H_
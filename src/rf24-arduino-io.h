@@ -54,6 +54,14 @@ public:
 	*/	
 	void transfern(const uint8_t* buf, uint32_t len);
 
+    /**
+     * Send a command and its data between one select and unselect.
+     * @param tx the data to send, or NULL to send 0xff
+     * @param rx where to keep the data that comes back, or NULL
+     * @return the status byte
+     */
+    uint8_t transaction(uint8_t cmd, const uint8_t *tx, uint8_t *rx, uint8_t len);
+
     /**
      * Set the level of the CE pin
      * @param level
@@ -71,7 +79,7 @@ RF24ArduinoSpi::RF24ArduinoSpi(int csn, int ce) : csnpin(csn), cepin(ce) {
 
 void RF24ArduinoSpi::beginTransaction() {
     SPI.beginTransaction(SPISettings(RF24_SPI_SPEED, MSBFIRST, SPI_MODE0));
-    digitalWrite(csnpin, HIGH);
+    digitalWrite(csnpin, LOW);
 }
 
 void RF24ArduinoSpi::endTransaction() {
@@ -95,6 +103,19 @@ void RF24ArduinoSpi::transfern(const uint8_t* buf, uint32_t len) {
     }
 }
 
+uint8_t RF24ArduinoSpi::transaction(uint8_t cmd, const uint8_t *tx, uint8_t *rx, uint8_t len) {
+    beginTransaction();
+    uint8_t status = transfer(cmd);
+    for(uint8_t i = 0; i != len; ++i) {
+        uint8_t b = transfer(tx != NULL ? tx[i] : 0xff);
+        if(rx != NULL) {
+            rx[i] = b;
+        }
+    }
+    endTransaction();
+    return status;
+}
+
 void RF24ArduinoSpi::ce(bool level) {
     digitalWrite(cepin, level ? HIGH : LOW);
     delayMicroseconds(5);
@@ -0,0 +1,144 @@
+
+#ifdef CHIBIOS
+
+#include "ch.hpp"
+#include "hal.h"
+#include "rf24-chibios-bridge.h"
+
+namespace rf24 {
+namespace serial {
+
+static const eventmask_t CHANNEL_EVENT = 0x1;
+static const eventmask_t RADIO_EVENT = 0x2;
+
+BaseRF24SerialBridge::BaseRF24SerialBridge(BaseRF24Serial &serial, BaseAsynchronousChannel *channel, sysinterval_t gap,
+        stkalign_t *wa, size_t waSize) :
+    serial(serial), channel(channel), gap(gap), wa(wa), waSize(waSize), thread(NULL),
+    uplink_packet(NULL), uplink_ready(false), uplink_last(0), downlink_packet(NULL), downlink_pos(0) {
+}
+
+void BaseRF24SerialBridge::threadStart(void *instance) {
+    chRegSetThreadName("rf24bridge");
+    ((BaseRF24SerialBridge *)instance)->main();
+}
+
+void BaseRF24SerialBridge::start(tprio_t priority) {
+    if(thread == NULL) {
+        thread = chThdCreateStatic(wa, waSize, priority, threadStart, this);
+    }
+}
+
+void BaseRF24SerialBridge::stop() {
+    if(thread != NULL) {
+        chThdTerminate(thread);
+        chEvtSignal(thread, CHANNEL_EVENT);
+        chThdWait(thread);
+        thread = NULL;
+    }
+}
+
+/**
+ * Move what the channel has into the uplink packet, and the packet to the
+ * radio when it's full, or the channel has gone quiet.
+ * @return whether anything moved
+ */
+bool BaseRF24SerialBridge::uplink() {
+    if(uplink_packet == NULL) {
+        uplink_packet = serial.acquire(TIME_IMMEDIATE);
+        if(uplink_packet == NULL) {
+            return false;
+        }
+    }
+
+    if(uplink_ready) {
+        msg_t msg = serial.commit(uplink_packet, TIME_IMMEDIATE);
+        if(msg == MSG_TIMEOUT) {
+            return false;
+        }
+        uplink_packet = NULL;
+        uplink_ready = false;
+        return msg == MSG_OK;
+    }
+
+    size_t read = chnReadTimeout(channel, &uplink_packet->data[uplink_packet->length],
+            PACKET_SIZE - uplink_packet->length, TIME_IMMEDIATE);
+    uplink_packet->length += read;
+    if(read > 0) {
+        uplink_last = chVTGetSystemTimeX();
+    }
+    uplink_ready = (uplink_packet->length == PACKET_SIZE);
+    return read > 0;
+}
+
+/**
+ * Write as much of the downlink packet as the channel will take.
+ * @return whether anything moved
+ */
+bool BaseRF24SerialBridge::downlink() {
+    if(downlink_packet == NULL) {
+        downlink_packet = serial.receive(TIME_IMMEDIATE);
+        if(downlink_packet == NULL) {
+            return false;
+        }
+        downlink_pos = 0;
+    }
+
+    size_t written = chnWriteTimeout(channel, &downlink_packet->data[downlink_pos],
+            downlink_packet->length - downlink_pos, TIME_IMMEDIATE);
+    downlink_pos += written;
+    if(downlink_pos == downlink_packet->length) {
+        serial.release(downlink_packet);
+        downlink_packet = NULL;
+    }
+    return written > 0;
+}
+
+void BaseRF24SerialBridge::main() {
+    EventListener channelListener;
+    EventListener radioListener;
+    chEvtRegisterMaskWithFlags(chnGetEventSource(channel), &channelListener.ev_listener, CHANNEL_EVENT,
+            CHN_INPUT_AVAILABLE | CHN_OUTPUT_EMPTY);
+    serial.events()->registerMaskWithFlags(&radioListener, RADIO_EVENT, RX_EVENT | TX_EVENT);
+
+    while(!chThdShouldTerminateX()) {
+        bool moved = uplink();
+        moved = downlink() || moved;
+
+        // A part filled packet only waits so long for the rest, from when
+        // the channel went quiet, however busy the downlink is.
+        sysinterval_t timeout = TIME_INFINITE;
+        if(uplink_packet != NULL && uplink_packet->length > 0 && !uplink_ready) {
+            sysinterval_t quiet = chVTTimeElapsedSinceX(uplink_last);
+            if(quiet >= gap) {
+                uplink_ready = true;
+                continue;
+            }
+            timeout = gap - quiet;
+        }
+        if(moved) {
+            continue;
+        }
+
+        // Nothing to do until the channel or the radio has news
+        chEvtWaitAnyTimeout(CHANNEL_EVENT | RADIO_EVENT, timeout);
+        channelListener.getAndClearFlags();
+        radioListener.getAndClearFlags();
+    }
+
+    serial.events()->unregister(&radioListener);
+    chEvtUnregister(chnGetEventSource(channel), &channelListener.ev_listener);
+    if(uplink_packet != NULL) {
+        serial.release(uplink_packet);
+        uplink_packet = NULL;
+        uplink_ready = false;
+    }
+    if(downlink_packet != NULL) {
+        serial.release(downlink_packet);
+        downlink_packet = NULL;
+    }
+}
+
+}
+}
+
+#endif
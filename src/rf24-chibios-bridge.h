@@ -0,0 +1,96 @@
+
+/**
+ * @file rf24-chibios-bridge.h
+ * Joins a ChibiOS channel, such as a serial driver, to an RF24Serial
+ */
+#ifndef _RF24_CHIBIOS_BRIDGE_H_
+#define _RF24_CHIBIOS_BRIDGE_H_
+
+#include <ch.hpp>
+#include <hal.h>
+#include "rf24-chibios-serial.h"
+
+namespace rf24 {
+namespace serial {
+
+using namespace chibios_rt;
+
+/** How long the channel must be quiet before a part filled packet is sent, by default */
+static const sysinterval_t BRIDGE_GAP = TIME_MS2I(2);
+
+/**
+ * Copies everything the channel receives to the radio, and everything the
+ * radio receives to the channel, with one thread for both directions.
+ *
+ * Data goes straight between the channel's queues and the RF24Serial's
+ * packets. What arrives on the channel in one burst goes in one packet,
+ * as far as it fits, and each packet from the radio is written to the
+ * channel in one go. The thread only waits for events, so neither
+ * direction holds up the other. The RF24Serial mustn't be used for
+ * anything else while it's bridged.
+ */
+class BaseRF24SerialBridge {
+private:
+    BaseRF24Serial &serial;
+    BaseAsynchronousChannel * const channel;
+    const sysinterval_t gap;
+    stkalign_t * const wa;
+    const size_t waSize;
+    thread_t *thread;
+
+    // Channel to radio: the packet being filled, whether it's ready to go,
+    // and when the channel last gave it anything
+    packet_t uplink_packet;
+    bool uplink_ready;
+    systime_t uplink_last;
+    // Radio to channel: the packet being written, and how much of it has been
+    packet_t downlink_packet;
+    size_t downlink_pos;
+
+    bool uplink();
+    bool downlink();
+    static void threadStart(void *instance);
+
+protected:
+    BaseRF24SerialBridge(BaseRF24Serial &serial, BaseAsynchronousChannel *channel, sysinterval_t gap,
+            stkalign_t *wa, size_t waSize);
+
+public:
+    /**
+     * Start bridging. The RF24Serial must have been started.
+     */
+    void start(tprio_t priority = NORMALPRIO);
+
+    /**
+     * Stop bridging, and wait for the thread to finish.
+     */
+    void stop();
+
+    void main();
+};
+
+/**
+ * @tparam STACK_SIZE the size of the bridge thread's working area
+ */
+template<size_t STACK_SIZE = 256>
+struct RF24SerialBridge : public BaseRF24SerialBridge {
+    static_assert(STACK_SIZE >= 128, "RF24SerialBridge stack is too small");
+
+    /**
+     * @param serial the radio side
+     * @param channel the other side
+     * @param gap how long the channel must be quiet before a part filled
+     * packet is sent
+     */
+    RF24SerialBridge(BaseRF24Serial &serial, BaseAsynchronousChannel *channel, sysinterval_t gap = BRIDGE_GAP) :
+        BaseRF24SerialBridge(serial, channel, gap, wa, sizeof(wa)) {
+    }
+
+private:
+    THD_WORKING_AREA(wa, STACK_SIZE);
+};
+
+}
+}
+
+#endif // _RF24_CHIBIOS_BRIDGE_H_
@@ -18,6 +18,7 @@
 #include "ch.h"
 #include "hal.h"
 #include "rf24-chibios-io.h"
+#include "rf24-chibios-timing.h"
 
 constexpr uint8_t _BV(uint8_t bit) {
     return (1<<bit);
@@ -56,13 +57,17 @@ static inline void delay(uint32_t milisec) {
 }
 
 static inline void delayMicroseconds(uint32_t usec) {
-    chThdSleepMicroseconds(usec);
+    rf24DelayMicroseconds(usec);
 }
 
 static inline long millis() {
     return TIME_I2MS(chVTGetSystemTime());
 }
 
+static inline uint32_t micros() {
+    return rf24Micros();
+}
+
 extern void printf_P(const char *fmt, ...);
 
 #define LOW PAL_LOW
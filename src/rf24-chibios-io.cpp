@@ -2,31 +2,127 @@
 
 
 #include "rf24-chibios-io.h"
+#include "rf24-chibios-timing.h"
 
 #ifdef CHIBIOS
 
 #include <algorithm>
 #include <string.h>
 
+// The ChibiOS linker scripts export the bounds of the main RAM region,
+// which the DMA controller can always reach.
+extern "C" {
+extern uint8_t __ram0_start__[];
+extern uint8_t __ram0_end__[];
+}
+
+static inline bool dmaReachable(const uint8_t *buf, uint32_t len) {
+    return buf >= __ram0_start__ && buf + len <= __ram0_end__;
+}
+
+Rf24ChibiosSpi::Rf24ChibiosSpi(SPIDriver *driver)
+    : driver(driver), head(NULL), tail(NULL), current(NULL), owner(NULL), nested(0) {
+    chThdQueueObjectInit(&waiting);
+}
+
+void Rf24ChibiosSpi::startNextI() {
+    current = head;
+    head = head->next;
+    if(head == NULL) {
+        tail = NULL;
+    }
+    spiSelectI(driver);
+    spiStartExchangeI(driver, current->length, current->tx, current->rx);
+}
+
+void Rf24ChibiosSpi::startI(Rf24SpiTransaction *transaction) {
+    transaction->next = NULL;
+    if(tail == NULL) {
+        head = transaction;
+    } else {
+        tail->next = transaction;
+    }
+    tail = transaction;
+    if(owner == NULL && current == NULL) {
+        startNextI();
+    }
+}
+
+void Rf24ChibiosSpi::endI() {
+    // The end callback runs for synchronous transfers too
+    if(current == NULL) {
+        return;
+    }
+
+    spiUnselectI(driver);
+    Rf24SpiTransaction *done = current;
+    current = NULL;
+    done->complete(done);
+    if(current == NULL) {
+        if(head != NULL) {
+            startNextI();
+        } else {
+            chThdDequeueNextI(&waiting, MSG_OK);
+        }
+    }
+}
+
+void Rf24ChibiosSpi::acquire() {
+    chSysLock();
+    if(owner == chThdGetSelfX()) {
+        nested++;
+        chSysUnlock();
+        return;
+    }
+    while(owner != NULL || current != NULL || head != NULL) {
+        chThdEnqueueTimeoutS(&waiting, TIME_INFINITE);
+    }
+    owner = chThdGetSelfX();
+    chSysUnlock();
+}
+
+void Rf24ChibiosSpi::release() {
+    chSysLock();
+    if(nested > 0) {
+        nested--;
+        chSysUnlock();
+        return;
+    }
+    owner = NULL;
+    if(head != NULL) {
+        startNextI();
+    } else {
+        chThdDequeueNextI(&waiting, MSG_OK);
+    }
+    chSchRescheduleS();
+    chSysUnlock();
+}
+
 Rf24ChibiosIo::Rf24ChibiosIo(
         SPIDriver* driver,
         const SPIConfig* config,
-        ioline_t ce)
-    : driver(driver), config(config), ceLine(ce) {
+        ioline_t ce,
+        Rf24ChibiosSpi *async,
+        ioline_t irq)
+    : driver(driver), config(config), ceLine(ce), asyncSpi(async), irqLine(irq) {
 }
 
 void Rf24ChibiosIo::begin() {
     // In Chibios we leave it to the library user to set the correct modes for all pins,
     // rather than having divided responsibility.
+    rf24TimingInit();
     spiStart(driver, config);
 }
 
 void Rf24ChibiosIo::beginTransaction() {
+    if(asyncSpi != NULL) {
+        asyncSpi->acquire();
+    }
 #ifdef SPI_USE_MUTUAL_EXCLUSION
     spiAcquireBus(driver);
 #endif
     spiSelect(driver);
-    chThdSleepMicroseconds(5);
+    rf24DelayMicroseconds(5);
 }
 
 void Rf24ChibiosIo::endTransaction() {
@@ -34,6 +130,9 @@ void Rf24ChibiosIo::endTransaction() {
 #ifdef SPI_USE_MUTUAL_EXCLUSION
     spiReleaseBus(driver);
 #endif
+    if(asyncSpi != NULL) {
+        asyncSpi->release();
+    }
 }
 
 uint8_t Rf24ChibiosIo::transfer(uint8_t tx) {
@@ -42,17 +141,52 @@ uint8_t Rf24ChibiosIo::transfer(uint8_t tx) {
     return rx;
 }
 
-void Rf24ChibiosIo::transfern(const uint8_t* buf, uint32_t len) {
-    // The STM32 SPI driver is DMA, and DMA from flash isn't possible:
-    // it will result in a halt. I don't know how to work out if the
-    // source buffer is safe for the driver so for now, I'm going to assume I
-    // have to copy the buffer. The buffer will either be an address, or
-    // a packet, so the maximum size is 32 bytes.
-    constexpr uint32_t maxlen = 32;
-    uint8_t bufcopy[maxlen];
+uint8_t Rf24ChibiosIo::transaction(uint8_t cmd, const uint8_t *tx, uint8_t *rx, uint8_t len) {
+    constexpr uint8_t maxlen = 32;
+    len = std::min(len, maxlen);
+
+    // The STM32 SPI driver is DMA, and DMA from flash isn't possible: it
+    // will result in a halt. Packets and most registers live in RAM, so
+    // the data goes straight between them and the radio, after the
+    // command.
+    if((tx == NULL || dmaReachable(tx, len)) && (rx == NULL || dmaReachable(rx, len))) {
+        beginTransaction();
+        uint8_t status = transfer(cmd);
+        if(len == 0) {
+            // Just the command
+        } else if(tx == NULL && rx == NULL) {
+            spiIgnore(driver, len);
+        } else if(tx == NULL) {
+            // The driver clocks out 0xff while it receives
+            spiReceive(driver, len, rx);
+        } else if(rx == NULL) {
+            spiSend(driver, len, tx);
+        } else {
+            spiExchange(driver, len, tx, rx);
+        }
+        endTransaction();
+        return status;
+    }
+
+    // Anything else (typically a const address) goes in one exchange for
+    // the command and its data, through buffers on the stack.
+    uint8_t txbuf[maxlen + 1];
+    uint8_t rxbuf[maxlen + 1];
+    txbuf[0] = cmd;
+    if(tx != NULL) {
+        memcpy(&txbuf[1], tx, len);
+    } else {
+        memset(&txbuf[1], 0xff, len);
+    }
+
+    beginTransaction();
+    spiExchange(driver, len + 1, txbuf, rxbuf);
+    endTransaction();
 
-    memcpy(bufcopy, buf, std::min(len, maxlen));
-    spiSend(driver, len, bufcopy);
+    if(rx != NULL) {
+        memcpy(rx, &rxbuf[1], len);
+    }
+    return rxbuf[0];
 }
 
 void Rf24ChibiosIo::ce(bool level) {
@@ -16,13 +16,84 @@
 #include "ch.h"
 #include "hal.h"
 
+/**
+ * One SPI transaction for Rf24ChibiosSpi. CSN is held low for the whole
+ * of it.
+ */
+struct Rf24SpiTransaction {
+    Rf24SpiTransaction *next;
+    const uint8_t *tx;
+    uint8_t *rx;
+    size_t length;
+    /**
+     * Called from the SPI interrupt, with the system locked, when the
+     * transaction is finished. It may start another.
+     */
+    void (*complete)(Rf24SpiTransaction *transaction);
+    void *arg;
+};
+
+/**
+ * Asynchronous transactions on the radio's SPI bus, run back to back by
+ * DMA from the SPI interrupt, so that an interrupt handler can read the
+ * radio without waking a thread.
+ *
+ * The synchronous transactions of any Rf24ChibiosIo made with this take
+ * their turn with the asynchronous ones. The bus must be dedicated to the
+ * radio, and the SPIConfig's end_cb must call endI(). Give the same one
+ * to an RF24Serial's IO and it reads the radio from its interrupt.
+ */
+class Rf24ChibiosSpi {
+public:
+    Rf24ChibiosSpi(SPIDriver *driver);
+
+    /**
+     * Queue a transaction, starting it straight away if the bus is free.
+     * Call from an ISR or with the system locked.
+     */
+    void startI(Rf24SpiTransaction *transaction);
+
+    /**
+     * Call from the SPIConfig's end_cb, with the system locked from ISR.
+     */
+    void endI();
+
+    /**
+     * Wait for the queue to drain, and keep the bus for a synchronous
+     * transaction. The thread holding the bus can acquire it again, to
+     * keep it across several transactions.
+     */
+    void acquire();
+
+    /**
+     * Hand the bus back, once for each acquire(), starting anything queued
+     * in the meantime.
+     */
+    void release();
+
+private:
+    SPIDriver *driver;
+    Rf24SpiTransaction *head;
+    Rf24SpiTransaction *tail;
+    Rf24SpiTransaction *current;
+    thread_t *owner;
+    uint8_t nested;
+    threads_queue_t waiting;
+
+    void startNextI();
+};
+
 class Rf24ChibiosIo {
 public:
 
 	/**
 	* SPI constructor
+	* @param async asynchronous transactions to share the bus with, if any
+	* @param irq the radio's IRQ line, if it can be read, so that interrupts
+	* can be checked for after clearing the radio's flags
 	*/
-	Rf24ChibiosIo(SPIDriver *driver, const SPIConfig *config, ioline_t ce);
+	Rf24ChibiosIo(SPIDriver *driver, const SPIConfig *config, ioline_t ce,
+	        Rf24ChibiosSpi *async = NULL, ioline_t irq = PAL_NOLINE);
 
 	Rf24ChibiosIo(Rf24ChibiosIo &io) = default;
 
@@ -47,13 +118,14 @@ public:
 	* @return Data returned via spi
 	*/
 	uint8_t transfer(uint8_t tx_);
-	
-	/**
-	* Transfer a buffer of data, discarding the responses
-	* @param buf Pointer to a buffer of data
-	* @param len Length of the data
-	*/	
-	void transfern(const uint8_t* buf, uint32_t len);
+
+    /**
+     * Send a command and its data in one exchange.
+     * @param tx the data to send, or NULL to send 0xff
+     * @param rx where to keep the data that comes back, or NULL
+     * @return the status byte
+     */
+    uint8_t transaction(uint8_t cmd, const uint8_t *tx, uint8_t *rx, uint8_t len);
 
     /**
      * Select the device, ready for transfers. I.e. CSN goes low.
@@ -71,10 +143,26 @@ public:
      */
     void ce(bool level);
 
+    /**
+     * The asynchronous transaction queue, if there is one.
+     */
+    inline Rf24ChibiosSpi *async() const {
+        return asyncSpi;
+    }
+
+    /**
+     * The radio's IRQ line, or PAL_NOLINE.
+     */
+    inline ioline_t irq() const {
+        return irqLine;
+    }
+
 private:
 	SPIDriver *driver;
 	const SPIConfig *config;
 	ioline_t ceLine;
+	Rf24ChibiosSpi *asyncSpi;
+	ioline_t irqLine;
 };
 
 #endif
@@ -0,0 +1,500 @@
+
+#ifdef CHIBIOS
+
+#include "ch.hpp"
+#include "hal.h"
+#include "rf24-chibios-mux.h"
+
+namespace rf24 {
+namespace serial {
+
+static const eventmask_t MUX_EVENT = 0x1;
+static const eventmask_t RADIO_EVENT = 0x2;
+
+BaseMuxChannel::BaseMuxChannel(uint8_t id, uint8_t priority, TransmitClass cls, bool datagram,
+        const MuxChannelStorage &storage) :
+    vmt(&VMT), id(id), priority(priority), cls(cls), datagram(datagram), mux(NULL), next(NULL),
+    transmit_free(storage.transmitFree, storage.transmitFreeSize),
+    transmit_queue(storage.transmitQueue, storage.transmitQueueSize),
+    transmit_packet(NULL),
+    receive_queue(storage.receiveQueue, storage.receiveQueueSize),
+    receive_done(storage.receiveDone, storage.receiveDoneSize),
+    receive_packet(NULL), receive_pos(0) {
+    chThdQueueObjectInit(&transmit_waiting);
+    chThdQueueObjectInit(&receive_waiting);
+}
+
+void BaseMuxChannel::reset() {
+    transmit_free.reset();
+    transmit_queue.reset();
+    transmit_packet = NULL;
+    receive_queue.reset();
+    receive_done.reset();
+    receive_packet = NULL;
+    receive_pos = 0;
+}
+
+msg_t BaseMuxChannel::wait(PacketRing &ring, bool producer, threads_queue_t *queue, sysinterval_t timeout) {
+    msg_t msg = MSG_RESET;
+    chSysLock();
+    if(mux != NULL && mux->ready()) {
+        bool wait = producer ? ring.armProducer() : ring.armConsumer();
+        msg = wait ? chThdEnqueueTimeoutS(queue, timeout) : MSG_OK;
+    }
+    chSysUnlock();
+    return msg;
+}
+
+packet_t BaseMuxChannel::acquire(sysinterval_t timeout) {
+    packet_t packet;
+    while(!transmit_free.get(packet)) {
+        if(wait(transmit_free, false, &transmit_waiting, timeout) != MSG_OK) {
+            return NULL;
+        }
+    }
+
+    // The mux keeps one spare per channel, so it needs to know this one's gone
+    mux->wake();
+    return packet;
+}
+
+msg_t BaseMuxChannel::commit(packet_t packet) {
+    chDbgAssert(packet->length >= MUX_HEADER_SIZE && packet->data[0] == id, "MuxChannel::commit - not from acquire");
+    while(!transmit_queue.put(packet)) {
+        msg_t msg = wait(transmit_queue, true, &transmit_waiting, TIME_INFINITE);
+        if(msg != MSG_OK) {
+            release(packet);
+            return msg;
+        }
+    }
+
+    mux->wake();
+    return MSG_OK;
+}
+
+packet_t BaseMuxChannel::receive(sysinterval_t timeout) {
+    packet_t packet = receive_packet;
+    if(packet != NULL) {
+        // Hand over what the stream methods haven't read yet, behind the id
+        receive_packet = NULL;
+        packet->length -= receive_pos - MUX_HEADER_SIZE;
+        memmove(&packet->data[MUX_HEADER_SIZE], &packet->data[receive_pos], packet->length - MUX_HEADER_SIZE);
+        return packet;
+    }
+
+    while(!receive_queue.get(packet)) {
+        if(wait(receive_queue, false, &receive_waiting, timeout) != MSG_OK) {
+            return NULL;
+        }
+    }
+
+    if(receive_queue.wakeProducer()) {
+        mux->wake();
+    }
+    return packet;
+}
+
+void BaseMuxChannel::release(packet_t packet) {
+    PacketRing *ring = &receive_done;
+    threads_queue_t *queue = &receive_waiting;
+    if(mux != NULL && !mux->serial.received(packet)) {
+        // The writer's: only the mux thread can free it, and the writer
+        // only produces for transmit_queue, so it goes that way, empty
+        packet->length = 0;
+        ring = &transmit_queue;
+        queue = &transmit_waiting;
+    }
+
+    while(!ring->put(packet)) {
+        if(wait(*ring, true, queue, TIME_INFINITE) != MSG_OK) {
+            // The mux has stopped, and the packet is lost to it
+            return;
+        }
+    }
+    if(mux != NULL) {
+        mux->wake();
+    }
+}
+
+msg_t BaseMuxChannel::put(uint8_t b) {
+    if(transmit_packet == NULL) {
+        transmit_packet = acquire();
+        if(transmit_packet == NULL) {
+            return MSG_RESET;
+        }
+    }
+
+    transmit_packet->data[transmit_packet->length++] = b;
+    return (transmit_packet->length < PACKET_SIZE) ? MSG_OK : flush();
+}
+
+size_t BaseMuxChannel::write(const uint8_t *bp, size_t n) {
+    size_t written = 0;
+    while(written < n) {
+        if(transmit_packet == NULL) {
+            transmit_packet = acquire();
+            if(transmit_packet == NULL) {
+                break;
+            }
+        }
+
+        size_t length = PACKET_SIZE - transmit_packet->length;
+        if(length > n - written) {
+            length = n - written;
+        }
+        memcpy(&transmit_packet->data[transmit_packet->length], &bp[written], length);
+        transmit_packet->length += length;
+        written += length;
+        if(transmit_packet->length == PACKET_SIZE && flush() != MSG_OK) {
+            break;
+        }
+    }
+    return written;
+}
+
+msg_t BaseMuxChannel::flush() {
+    packet_t packet = transmit_packet;
+    if(packet == NULL || packet->length == MUX_HEADER_SIZE) {
+        return MSG_OK;
+    }
+
+    transmit_packet = NULL;
+    return commit(packet);
+}
+
+msg_t BaseMuxChannel::get() {
+    while(receive_packet == NULL) {
+        receive_packet = receive(TIME_INFINITE);
+        if(receive_packet == NULL) {
+            return MSG_RESET;
+        }
+        receive_pos = MUX_HEADER_SIZE;
+        if(receive_pos == receive_packet->length) {
+            release(receive_packet);
+            receive_packet = NULL;
+        }
+    }
+
+    uint8_t b = receive_packet->data[receive_pos++];
+    if(receive_pos == receive_packet->length) {
+        release(receive_packet);
+        receive_packet = NULL;
+    }
+    return b;
+}
+
+size_t BaseMuxChannel::read(uint8_t *bp, size_t n) {
+    size_t count = 0;
+    while(count < n) {
+        if(receive_packet == NULL) {
+            // Return what there is, rather than waiting for more
+            receive_packet = receive(count == 0 ? TIME_INFINITE : TIME_IMMEDIATE);
+            if(receive_packet == NULL) {
+                break;
+            }
+            receive_pos = MUX_HEADER_SIZE;
+        }
+
+        size_t length = receive_packet->length - receive_pos;
+        if(length > n - count) {
+            length = n - count;
+        }
+        memcpy(&bp[count], &receive_packet->data[receive_pos], length);
+        receive_pos += length;
+        count += length;
+        if(receive_pos == receive_packet->length) {
+            release(receive_packet);
+            receive_packet = NULL;
+        }
+    }
+    return count;
+}
+
+static size_t muxWrite(void *instance, const uint8_t *bp, size_t n) {
+    return ((BaseMuxChannel *)instance)->write(bp, n);
+}
+
+static size_t muxRead(void *instance, uint8_t *bp, size_t n) {
+    return ((BaseMuxChannel *)instance)->read(bp, n);
+}
+
+static msg_t muxPut(void *instance, uint8_t b) {
+    return ((BaseMuxChannel *)instance)->put(b);
+}
+
+static msg_t muxGet(void *instance) {
+    return ((BaseMuxChannel *)instance)->get();
+}
+
+const struct PacketTransmitStreamVMT BaseMuxChannel::VMT = {
+        0, muxWrite, muxRead, muxPut, muxGet
+};
+
+BaseRF24Mux::BaseRF24Mux(BaseRF24Serial &serial, stkalign_t *wa, size_t waSize) :
+    serial(serial), wa(wa), waSize(waSize), thread(NULL), running(false), channels(NULL),
+    transmit_pending{ NULL, NULL }, receive_held(NULL) {
+}
+
+void BaseRF24Mux::add(BaseMuxChannel &channel) {
+    chDbgAssert(thread == NULL, "RF24Mux::add - running");
+    chDbgAssert(channel.mux == NULL, "RF24Mux::add - already added");
+    chDbgAssert(find(channel.id) == NULL, "RF24Mux::add - duplicate id");
+
+    // Keep the list in priority order, so the scheduler takes the first
+    BaseMuxChannel **link = &channels;
+    while(*link != NULL && (*link)->priority <= channel.priority) {
+        link = &(*link)->next;
+    }
+    channel.next = *link;
+    *link = &channel;
+    channel.mux = this;
+}
+
+BaseMuxChannel *BaseRF24Mux::find(uint8_t id) {
+    for(BaseMuxChannel *channel = channels; channel != NULL; channel = channel->next) {
+        if(channel->id == id) {
+            return channel;
+        }
+    }
+    return NULL;
+}
+
+void BaseRF24Mux::threadStart(void *instance) {
+    chRegSetThreadName("rf24mux");
+    ((BaseRF24Mux *)instance)->main();
+}
+
+void BaseRF24Mux::start(tprio_t priority) {
+    if(thread == NULL) {
+        for(BaseMuxChannel *channel = channels; channel != NULL; channel = channel->next) {
+            channel->reset();
+        }
+        thread = chThdCreateStatic(wa, waSize, priority, threadStart, this);
+        running.store(true, std::memory_order_release);
+    }
+}
+
+void BaseRF24Mux::stop() {
+    if(thread != NULL) {
+        chSysLock();
+        running.store(false, std::memory_order_release);
+        for(BaseMuxChannel *channel = channels; channel != NULL; channel = channel->next) {
+            chThdDequeueAllI(&channel->transmit_waiting, MSG_RESET);
+            chThdDequeueAllI(&channel->receive_waiting, MSG_RESET);
+        }
+        chSchRescheduleS();
+        chSysUnlock();
+
+        chThdTerminate(thread);
+        chEvtSignal(thread, MUX_EVENT);
+        chThdWait(thread);
+        thread = NULL;
+        drain();
+    }
+}
+
+void BaseRF24Mux::wake() {
+    if(ready()) {
+        chEvtSignal(thread, MUX_EVENT);
+    }
+}
+
+void BaseRF24Mux::wakeWaiting(threads_queue_t *queue) {
+    chSysLock();
+    chThdDequeueNextI(queue, MSG_OK);
+    chSchRescheduleS();
+    chSysUnlock();
+}
+
+/**
+ * Hand received packets to their channels. A packet for a full channel
+ * is held, and nothing more is routed until the channel's reader makes
+ * room for it, unless the channel drops what it has no room for.
+ * @return whether anything moved
+ */
+bool BaseRF24Mux::route() {
+    bool moved = false;
+    for(;;) {
+        packet_t packet = receive_held;
+        if(packet == NULL && (packet = serial.receive(TIME_IMMEDIATE)) == NULL) {
+            return moved;
+        }
+
+        BaseMuxChannel *channel = (packet->length >= MUX_HEADER_SIZE) ? find(packet->data[0]) : NULL;
+        if(channel == NULL) {
+            stats.rx_unknown++;
+            serial.release(packet);
+        } else if(!channel->receive_queue.put(packet)) {
+            if(channel->datagram) {
+                stats.rx_blocked++;
+                serial.release(packet);
+            } else if(channel->receive_queue.armProducer()) {
+                // The reader's receive() wakes us when there's room
+                if(receive_held == NULL) {
+                    stats.rx_held++;
+                    receive_held = packet;
+                }
+                return moved;
+            } else {
+                // Room turned up in the meantime
+                receive_held = packet;
+                continue;
+            }
+        } else if(channel->receive_queue.wakeConsumer()) {
+            wakeWaiting(&channel->receive_waiting);
+        }
+        receive_held = NULL;
+        moved = true;
+    }
+}
+
+/**
+ * Give each channel a packet to fill, with the id already in it.
+ * @return whether anything moved
+ */
+bool BaseRF24Mux::supply() {
+    bool moved = false;
+    for(BaseMuxChannel *channel = channels; channel != NULL; channel = channel->next) {
+        if(channel->transmit_free.full()) {
+            continue;
+        }
+        packet_t packet = serial.acquire(TIME_IMMEDIATE, channel->cls);
+        if(packet == NULL) {
+            continue;
+        }
+        packet->data[0] = channel->id;
+        packet->length = MUX_HEADER_SIZE;
+        channel->transmit_free.put(packet);
+        if(channel->transmit_free.wakeConsumer()) {
+            wakeWaiting(&channel->transmit_waiting);
+        }
+        moved = true;
+    }
+    return moved;
+}
+
+/**
+ * Hand what the channels have finished with back to the RF24Serial.
+ * @return whether anything moved
+ */
+bool BaseRF24Mux::reclaim() {
+    bool moved = false;
+    for(BaseMuxChannel *channel = channels; channel != NULL; channel = channel->next) {
+        packet_t packet;
+        while(channel->receive_done.get(packet)) {
+            serial.release(packet);
+            moved = true;
+        }
+        if(channel->receive_done.wakeProducer()) {
+            wakeWaiting(&channel->receive_waiting);
+        }
+    }
+    return moved;
+}
+
+/**
+ * Send one class's packets, always taking from the highest priority
+ * channel with one waiting, for as long as the radio takes them.
+ * @return whether anything moved
+ */
+bool BaseRF24Mux::schedule(TransmitClass cls) {
+    bool moved = false;
+    packet_t &pending = transmit_pending[cls];
+    for(;;) {
+        if(pending == NULL) {
+            BaseMuxChannel *channel = channels;
+            while(channel != NULL && (channel->cls != cls || !channel->transmit_queue.get(pending))) {
+                channel = channel->next;
+            }
+            if(channel == NULL) {
+                return moved;
+            }
+            if(channel->transmit_queue.wakeProducer()) {
+                wakeWaiting(&channel->transmit_waiting);
+            }
+            if(pending->length == 0) {
+                // Acquired, then released unsent
+                serial.release(pending);
+                pending = NULL;
+                moved = true;
+                continue;
+            }
+        }
+
+        msg_t msg = serial.commit(pending, TIME_IMMEDIATE);
+        if(msg == MSG_TIMEOUT) {
+            // The commit armed the queue, so its TX_EVENT brings us back,
+            // even with free packets left in a pool bigger than the queues
+            return moved;
+        }
+        pending = NULL;
+        moved = true;
+    }
+}
+
+/**
+ * Urgent channels first, so they never wait for the bulk queue to drain.
+ */
+bool BaseRF24Mux::schedule() {
+    bool moved = schedule(TX_URGENT);
+    return schedule(TX_BULK) || moved;
+}
+
+/**
+ * Give back every packet the mux and its channels hold. Only once the
+ * mux thread has gone, and nothing else is using the channels.
+ */
+void BaseRF24Mux::drain() {
+    for(packet_t &pending : transmit_pending) {
+        if(pending != NULL) {
+            serial.release(pending);
+            pending = NULL;
+        }
+    }
+    if(receive_held != NULL) {
+        serial.release(receive_held);
+        receive_held = NULL;
+    }
+
+    for(BaseMuxChannel *channel = channels; channel != NULL; channel = channel->next) {
+        PacketRing *rings[] = {
+            &channel->transmit_free, &channel->transmit_queue, &channel->receive_queue, &channel->receive_done
+        };
+        packet_t packet;
+        for(PacketRing *ring : rings) {
+            while(ring->get(packet)) {
+                serial.release(packet);
+            }
+        }
+        if(channel->transmit_packet != NULL) {
+            serial.release(channel->transmit_packet);
+        }
+        if(channel->receive_packet != NULL) {
+            serial.release(channel->receive_packet);
+        }
+        channel->reset();
+    }
+}
+
+void BaseRF24Mux::main() {
+    EventListener radioListener;
+    serial.events()->registerMaskWithFlags(&radioListener, RADIO_EVENT, RX_EVENT | TX_EVENT);
+
+    while(!chThdShouldTerminateX()) {
+        bool moved = reclaim();
+        moved = route() || moved;
+        moved = supply() || moved;
+        moved = schedule() || moved;
+        if(!moved) {
+            chEvtWaitAny(MUX_EVENT | RADIO_EVENT);
+            radioListener.getAndClearFlags();
+        }
+    }
+
+    serial.events()->unregister(&radioListener);
+}
+
+}
+}
+
+#endif
@@ -0,0 +1,260 @@
+
+/**
+ * @file rf24-chibios-mux.h
+ * Several logical channels over one RF24Serial
+ */
+#ifndef _RF24_CHIBIOS_MUX_H_
+#define _RF24_CHIBIOS_MUX_H_
+
+#include <ch.hpp>
+#include <atomic>
+#include "rf24-chibios-serial.h"
+
+namespace rf24 {
+namespace serial {
+
+using namespace chibios_rt;
+
+/**
+ * Every packet on a multiplexed link starts with the channel id.
+ */
+static const uint8_t MUX_HEADER_SIZE = 1;
+static const uint8_t MUX_PAYLOAD_SIZE = PACKET_SIZE - MUX_HEADER_SIZE;
+
+class BaseRF24Mux;
+
+/**
+ * The memory a MuxChannel works in, provided by the MuxChannel template.
+ */
+typedef struct {
+    packet_t *transmitFree;
+    size_t transmitFreeSize;
+    packet_t *transmitQueue;
+    size_t transmitQueueSize;
+    packet_t *receiveQueue;
+    size_t receiveQueueSize;
+    packet_t *receiveDone;
+    size_t receiveDoneSize;
+} MuxChannelStorage;
+
+/**
+ * One logical channel of an RF24Mux: a byte stream, and a datagram API
+ * like RF24Serial's, with its own queues and priority.
+ *
+ * The packets are the RF24Serial's own, handed between the channel and
+ * the mux thread through single producer, single consumer rings, so
+ * nothing is copied. Like RF24Serial, a channel can have one writing
+ * thread and one reading thread.
+ *
+ * Packets from acquire() and receive() have the channel id in data[0],
+ * and the payload after it: length counts both.
+ *
+ * When a packet arrives for a channel whose receive queue is full, the
+ * mux holds it until the reader makes room, and holds up the channels
+ * behind it meanwhile, as dropping it would lose part of the stream. A
+ * datagram channel, read only through receive(), can instead have such
+ * packets dropped, so that it never holds up the rest.
+ */
+class BaseMuxChannel {
+public:
+    const struct PacketTransmitStreamVMT * const vmt;
+
+private:
+    friend class BaseRF24Mux;
+
+    const uint8_t id;
+    const uint8_t priority;
+    const TransmitClass cls;
+    const bool datagram;
+    BaseRF24Mux *mux;
+    // The next channel in the mux, in priority order
+    BaseMuxChannel *next;
+
+    // Packets from the mux to fill, and filled packets for the mux to send,
+    // along with any acquired and released unsent, emptied
+    PacketRing transmit_free;
+    PacketRing transmit_queue;
+    threads_queue_t transmit_waiting;
+    packet_t transmit_packet;
+
+    // Packets from the mux to read, and read packets for the mux to release
+    PacketRing receive_queue;
+    PacketRing receive_done;
+    threads_queue_t receive_waiting;
+    packet_t receive_packet;
+    uint8_t receive_pos;
+
+    static const struct PacketTransmitStreamVMT VMT;
+
+    void reset();
+    msg_t wait(PacketRing &ring, bool producer, threads_queue_t *queue, sysinterval_t timeout);
+
+protected:
+    BaseMuxChannel(uint8_t id, uint8_t priority, TransmitClass cls, bool datagram,
+            const MuxChannelStorage &storage);
+
+public:
+    /**
+     * Take an empty packet to fill in place, and pass to commit().
+     * @return the packet, or NULL on timeout or if the mux isn't running
+     */
+    packet_t acquire(sysinterval_t timeout = TIME_INFINITE);
+
+    /**
+     * Queue a packet from acquire() for the mux to send.
+     */
+    msg_t commit(packet_t packet);
+
+    /**
+     * Get the next packet for this channel, without copying it.
+     * @return the packet, or NULL on timeout or if the mux isn't running
+     */
+    packet_t receive(sysinterval_t timeout = TIME_INFINITE);
+
+    /**
+     * Hand back a packet from receive() or acquire(). Waits, if need be,
+     * for the mux to take back what was handed back before.
+     */
+    void release(packet_t packet);
+
+    msg_t put(uint8_t b);
+    size_t write(const uint8_t *bp, size_t n);
+    msg_t flush();
+    msg_t get();
+    size_t read(uint8_t *bp, size_t n);
+
+    inline BaseSequentialStream *stream() {
+        return (BaseSequentialStream *)this;
+    }
+
+    inline uint8_t channelId() const {
+        return id;
+    }
+};
+
+/**
+ * @tparam TX_QUEUE_COUNT the number of packets waiting for the mux to send
+ * @tparam RX_QUEUE_COUNT the number of received packets waiting to be read
+ */
+template<size_t TX_QUEUE_COUNT = 2, size_t RX_QUEUE_COUNT = 2>
+struct MuxChannel : public BaseMuxChannel {
+    static_assert(TX_QUEUE_COUNT > 0, "MuxChannel needs a transmit queue");
+    static_assert(RX_QUEUE_COUNT > 0, "MuxChannel needs a receive queue");
+
+    /**
+     * @param id the channel id, the same at both ends of the link
+     * @param priority lower goes first, among channels of the same class
+     * @param cls the RF24Serial class to send in: an urgent channel's
+     * packets go ahead of everything queued in bulk
+     * @param datagram drop packets that arrive while the receive queue is
+     * full, rather than hold up the other channels. Only for a channel
+     * whose packets stand alone: its stream loses bytes when one drops.
+     */
+    MuxChannel(uint8_t id, uint8_t priority = 0, TransmitClass cls = TX_BULK, bool datagram = false) :
+        BaseMuxChannel(id, priority, cls, datagram, {
+            transmitFreeSlots, sizeof(transmitFreeSlots) / sizeof(packet_t),
+            transmitQueueSlots, sizeof(transmitQueueSlots) / sizeof(packet_t),
+            receiveQueueSlots, sizeof(receiveQueueSlots) / sizeof(packet_t),
+            receiveDoneSlots, sizeof(receiveDoneSlots) / sizeof(packet_t) }) {
+    }
+
+private:
+    // Each ring has one more slot than it holds. The reader can hand back
+    // everything queued plus the packet it's reading without waiting for
+    // the mux; one that has taken more than that may have to.
+    packet_t transmitFreeSlots[2];
+    packet_t transmitQueueSlots[TX_QUEUE_COUNT + 1];
+    packet_t receiveQueueSlots[RX_QUEUE_COUNT + 1];
+    packet_t receiveDoneSlots[RX_QUEUE_COUNT + 2];
+};
+
+/**
+ * Carries several channels over one RF24Serial, which it must have to
+ * itself. One thread routes received packets to their channels, keeps
+ * each channel supplied with an empty packet, and sends the channels'
+ * packets, highest priority first. A packet for a channel whose receive
+ * queue is full waits, counted in rx_held, until that channel is read,
+ * unless the channel is a datagram one, when it is dropped and counted in
+ * rx_blocked.
+ *
+ * The RF24Serial's pool must hold two packets per channel, for the one
+ * being filled and the one waiting to be, besides the queues, and its
+ * urgent packets two for each urgent channel.
+ */
+class BaseRF24Mux {
+private:
+    friend class BaseMuxChannel;
+
+    BaseRF24Serial &serial;
+    stkalign_t * const wa;
+    const size_t waSize;
+    thread_t *thread;
+    std::atomic<bool> running;
+    BaseMuxChannel *channels;
+
+    // For each class, a packet the radio hasn't taken yet
+    packet_t transmit_pending[TX_CLASS_COUNT];
+    // A received packet its channel hasn't taken yet
+    packet_t receive_held;
+
+    BaseMuxChannel *find(uint8_t id);
+    bool route();
+    bool supply();
+    bool reclaim();
+    bool schedule();
+    bool schedule(TransmitClass cls);
+    void drain();
+    void wake();
+    static void wakeWaiting(threads_queue_t *queue);
+    static void threadStart(void *instance);
+
+protected:
+    BaseRF24Mux(BaseRF24Serial &serial, stkalign_t *wa, size_t waSize);
+
+public:
+    /**
+     * Add a channel. Only while the mux is stopped.
+     */
+    void add(BaseMuxChannel &channel);
+
+    /**
+     * Start the mux thread. The RF24Serial must have been started.
+     */
+    void start(tprio_t priority = NORMALPRIO);
+
+    /**
+     * Stop the mux thread, releasing anything waiting on a channel, and
+     * hand every packet the channels hold back to the RF24Serial. Only
+     * stop the mux when nothing else is using its channels.
+     */
+    void stop();
+
+    void main();
+
+    inline bool ready() {
+        return running.load(std::memory_order_acquire);
+    }
+
+    struct {
+        uint32_t rx_unknown = 0, rx_blocked = 0, rx_held = 0;
+    } stats;
+};
+
+/**
+ * @tparam STACK_SIZE the size of the mux thread's working area
+ */
+template<size_t STACK_SIZE = 256>
+struct RF24Mux : public BaseRF24Mux {
+    static_assert(STACK_SIZE >= 128, "RF24Mux stack is too small");
+
+    RF24Mux(BaseRF24Serial &serial) : BaseRF24Mux(serial, wa, sizeof(wa)) {
+    }
+
+private:
+    THD_WORKING_AREA(wa, STACK_SIZE);
+};
+
+}
+}
+
+#endif // _RF24_CHIBIOS_MUX_H_
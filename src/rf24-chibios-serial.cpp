@@ -21,8 +21,10 @@ const eventmask_t TX_FAIL_EVENT = 0x10;
 const eventmask_t TX_OK_EVENT = 0x20;
 const eventmask_t RX_RD_EVENT = 0x40;
 
-static inline RF24Serial *rf24(void *instance) {
-    return (RF24Serial *)instance;
+static const uint8_t IRQ_FLAGS = _BV(RX_DR) | _BV(TX_DS) | _BV(MAX_RT);
+
+static inline BaseRF24Serial *rf24(void *instance) {
+    return (BaseRF24Serial *)instance;
 }
 
 static size_t write(void *instance, const uint8_t *bp, size_t n) {
@@ -48,9 +50,60 @@ const struct PacketTransmitStreamVMT VMT = {
         0, write, read, put, get
 };
 
-RF24Serial::RF24Serial(Rf24ChibiosIo io) : 
-vmt(&VMT), radio(io), radioThread(NULL) {
-    state = STOP;
+static inline BaseRF24Serial *direction(void *instance) {
+    return ((RF24SerialDirection *)instance)->serial;
+}
+
+static size_t directionWrite(void *instance, const uint8_t *bp, size_t n) {
+    return direction(instance)->write(bp, n);
+}
+
+static size_t directionRead(void *instance, uint8_t *bp, size_t n) {
+    return direction(instance)->read(bp, n);
+}
+
+static msg_t directionPut(void *instance, uint8_t b) {
+    return direction(instance)->put(b);
+}
+
+static msg_t directionGet(void *instance) {
+    return direction(instance)->get();
+}
+
+static size_t noWrite(void *, const uint8_t *, size_t) {
+    return 0;
+}
+
+static size_t noRead(void *, uint8_t *, size_t) {
+    return 0;
+}
+
+static msg_t noPut(void *, uint8_t) {
+    return MSG_RESET;
+}
+
+static msg_t noGet(void *) {
+    return MSG_RESET;
+}
+
+const struct PacketTransmitStreamVMT TRANSMIT_VMT = {
+        0, directionWrite, noRead, directionPut, noGet
+};
+
+const struct PacketTransmitStreamVMT RECEIVE_VMT = {
+        0, noWrite, directionRead, noPut, directionGet
+};
+
+BaseRF24Serial::BaseRF24Serial(Rf24ChibiosIo io, const RF24SerialStorage &storage) :
+vmt(&VMT), radio(io),
+transmitDirection({ &TRANSMIT_VMT, this }), receiveDirection({ &RECEIVE_VMT, this }),
+storage(storage), radioThread(NULL), spi(io.async()), irqLine(io.irq()),
+transmit_lanes{
+    { storage.transmitQueue, storage.transmitQueueSize, storage.transmitFree, storage.transmitFreeSize },
+    { storage.urgentQueue, storage.urgentQueueSize, storage.urgentFree, storage.urgentFreeSize } },
+receive_queue(storage.receiveQueue, storage.receiveQueueSize),
+receive_free(storage.receiveFree, storage.receiveFreeSize) {
+    state.store(STOP);
 }
 
 static void radio_thread_start(void *instance) {
@@ -58,9 +111,8 @@ static void radio_thread_start(void *instance) {
     rf24(instance)->eventMain();
 }
 
-void RF24Serial::start() {
-    stateMutex.lock();
-    if(state == State::STOP) {
+void BaseRF24Serial::start() {
+    if(transition(State::STOP, State::STARTING)) {
         radio.set(AutoAck::all.enable());
         radio.set(Retries::retries(5,15));
 
@@ -74,107 +126,595 @@ void RF24Serial::start() {
             radio.openWritingPipe(writeAddress);
             break;
         case ADHOC:
+            // No ack payloads, but headers need dynamic payloads
+            radio.enableAckPayload();
             radio.openWritingPipe(writeAddress);
             radio.openReadingPipe(readPipe, readAddress);
+            // Peers must back off for different times, or they'll collide again
+            transmit_random = chVTGetSystemTimeX();
+            for(uint8_t i = 0; i < ADDRESS_WIDTH; ++i) {
+                transmit_random = transmit_random * 31 + readAddress[i];
+            }
+            if(transmit_random == 0) {
+                transmit_random = 1;
+            }
             break;
         }
 
-        state = State::STARTING;
-        chPoolObjectInit(&packets, sizeof(struct packet), NULL);
-        chPoolLoadArray(&packets, buffer, PACKET_POOL_COUNT);
-        stateMutex.unlock();
-        transmit_packet = allocPacket();
+        for(TransmitLane &lane : transmit_lanes) {
+            lane.queue.reset();
+            lane.free.reset();
+            lane.spare = NULL;
+            chThdQueueObjectInit(&lane.waiting);
+        }
+        receive_queue.reset();
+        receive_free.reset();
+        for(size_t i = 0; i < storage.receivePacketCount; ++i) {
+            receive_free.put(&storage.packets[i]);
+        }
+        for(size_t i = storage.receivePacketCount; i < storage.packetCount; ++i) {
+            transmitLane(&storage.packets[i]).free.put(&storage.packets[i]);
+        }
+        // The radio thread starts out waiting for something to send
+        transmitArm();
+        transmit_burst = 0;
+        transmit_fifo = 0;
+        chThdQueueObjectInit(&receive_waiting);
+        receive_queued = 0;
+        receive_fetched = 0;
+        receive_spare = NULL;
+        receive_accepted = 0;
+        receive_advertised = CREDIT_INITIAL;
+        receive_more = false;
+        receive_resetting = true;
+        receive_reset_taken = false;
+        irq_busy = false;
+        irq_again = false;
+        irq_flags = 0;
+        irq_staged = false;
+        memset(irq_tx, NOP, sizeof(irq_tx));
+        transmit_sent = 0;
+        transmit_limit = CREDIT_INITIAL;
+        transmit_reset = true;
+        transmit_answer = false;
+        transmit_polled = chVTGetSystemTimeX();
+        transmit_attempts = 0;
+        transmit_backoff_start = transmit_polled;
+        transmit_backoff = ADHOC_LISTEN_TIME;
+        transmit_packet = transmitAlloc(transmit_lanes[TX_BULK]);
         transmit_pos = 0;
+        receive_packet = NULL;
         receive_pos = PACKET_SIZE;
-        radioThread = chThdCreateStatic(wa, sizeof(wa), NORMALPRIO, radio_thread_start, this);
-        while(state == State::STARTING) {
+        radioThread = chThdCreateStatic(storage.wa, storage.waSize, NORMALPRIO, radio_thread_start, this);
+        while(state.load(std::memory_order_acquire) == State::STARTING) {
             chThdYield();
         }
-    } else {
-        stateMutex.unlock();
     }
 }
 
-void RF24Serial::stop() {
-    stateMutex.lock();
-    if(ready()) {
-        state = State::STOPPING;
+void BaseRF24Serial::stop() {
+    if(transition(State::PTX, State::STOPPING) || transition(State::PRX, State::STOPPING)) {
         radioThread.signalEvents(STOP_EVENT);
-        stateMutex.unlock();
         radioThread.wait();
-        transmit_queue.reset();
-        receive_queue.reset();
+        // Anyone still waiting on the radio thread would wait forever
+        chSysLock();
+        for(TransmitLane &lane : transmit_lanes) {
+            chThdDequeueAllI(&lane.waiting, MSG_RESET);
+        }
+        chThdDequeueAllI(&receive_waiting, MSG_RESET);
+        chSchRescheduleS();
+        chSysUnlock();
         setState(State::STOP);
-    } else {
-        stateMutex.unlock();
     }
 }
 
-void RF24Serial::print(const char* fmt, ...) {
+const struct PacketTransmitStreamVMT BaseRF24Serial::PRINT_VMT = {
+        0, printWrite, noRead, printPut, noGet
+};
+
+/**
+ * The printer has filled the transmit packet: send it, and carry on in the
+ * next one.
+ * @return false if the stream stopped
+ */
+bool BaseRF24Serial::printSpill(PacketPrinter *printer) {
+    if(printer->pos == NULL) {
+        return false;
+    }
+
+    transmit_pos = printer->pos - transmit_packet->data;
+    if(flush() != MSG_OK) {
+        printer->pos = printer->end = NULL;
+        return false;
+    }
+
+    printer->pos = &transmit_packet->data[transmit_pos];
+    printer->end = &transmit_packet->data[PACKET_SIZE];
+    return true;
+}
+
+msg_t BaseRF24Serial::printPut(void *instance, uint8_t b) {
+    PacketPrinter *printer = (PacketPrinter *)instance;
+    if(printer->pos == printer->end && !printer->serial->printSpill(printer)) {
+        return MSG_RESET;
+    }
+    *printer->pos++ = b;
+    return MSG_OK;
+}
+
+size_t BaseRF24Serial::printWrite(void *instance, const uint8_t *bp, size_t n) {
+    PacketPrinter *printer = (PacketPrinter *)instance;
+    size_t written = 0;
+    while(written < n) {
+        if(printer->pos == printer->end && !printer->serial->printSpill(printer)) {
+            break;
+        }
+        size_t chunk = min((size_t)(printer->end - printer->pos), n - written);
+        memcpy(printer->pos, &bp[written], chunk);
+        printer->pos += chunk;
+        written += chunk;
+    }
+    return written;
+}
+
+void BaseRF24Serial::print(const char* fmt, ...) {
+    if(!ready() || transmit_packet == NULL) {
+        return;
+    }
+
+    PacketPrinter printer = {
+            &PRINT_VMT, this,
+            &transmit_packet->data[transmit_pos], &transmit_packet->data[PACKET_SIZE]
+    };
     va_list ap;
     va_start(ap, fmt);
-    chvprintf(stream(), fmt, ap);
+    chvprintf((BaseSequentialStream *)&printer, fmt, ap);
     va_end(ap);
+
+    if(printer.pos != NULL) {
+        transmit_pos = printer.pos - transmit_packet->data;
+        flushIfFull();
+    }
 }
 
-void RF24Serial::irq() {
+void BaseRF24Serial::irq() {
     chSysLockFromISR();
     if(ready()) {
-        radioThread.signalEventsI(IRQ_EVENT);
+        if(spi == NULL) {
+            radioThread.signalEventsI(IRQ_EVENT);
+        } else if(irq_busy) {
+            irq_again = true;
+        } else {
+            irq_busy = true;
+            irqStatusI();
+        }
     }
     chSysUnlockFromISR();
 }
 
-int RF24Serial::receiveFreeCount() {
-    cnt_t free;
-    System::lock();
-    free = receive_queue.getFreeCountI();
-    System::unlock();
-    return free;
+/**
+ * Find out which of the radio's flags are set.
+ */
+void BaseRF24Serial::irqStatusI() {
+    irq_tx[0] = NOP;
+    irq_transaction.tx = irq_tx;
+    irq_transaction.rx = irq_scratch;
+    irq_transaction.length = 1;
+    irq_transaction.complete = irqStatusCompleteI;
+    irq_transaction.arg = this;
+    spi->startI(&irq_transaction);
 }
 
-void RF24Serial::receive() {
-    uint8_t length = min(PACKET_SIZE, radio.getDynamicPayloadSize());
-    packet_t packet = allocPacket();
-    packet->length = length;
-    radio.read(packet->data, length);
-    System::lock();
-    receive_queue.postI(packet);
-    receive_queue_available += length;
-    System::unlock();
-    status = radio.status();
+/**
+ * Clear the flags that were set, and only those.
+ */
+void BaseRF24Serial::irqStatusCompleteI(Rf24SpiTransaction *transaction) {
+    BaseRF24Serial *serial = rf24(transaction->arg);
+    serial->irq_seen = serial->irq_scratch[0];
+    serial->irq_flags |= serial->irq_seen & IRQ_FLAGS;
+    serial->irq_tx[0] = W_REGISTER | NRF_STATUS;
+    serial->irq_tx[1] = serial->irq_seen & IRQ_FLAGS;
+    transaction->length = 2;
+    transaction->complete = irqClearCompleteI;
+    serial->spi->startI(transaction);
+}
+
+void BaseRF24Serial::irqClearCompleteI(Rf24SpiTransaction *transaction) {
+    BaseRF24Serial *serial = rf24(transaction->arg);
+    Status status = { serial->irq_seen };
+    if(status.rxPipeNo() != RX_P_NO_EMPTY && !serial->irq_staged.load()) {
+        serial->irq_tx[0] = R_RX_PL_WID;
+        serial->irq_tx[1] = NOP;
+        transaction->complete = irqWidthCompleteI;
+        serial->spi->startI(transaction);
+    } else {
+        serial->irqDoneI();
+    }
 }
 
-void RF24Serial::receiveNonBlocking() {
-    for(int free = receiveFreeCount(); (free > 0) && (status.rxPipeNo() != RX_P_NO_EMPTY) && !radio.fifoStatus().rxEmpty(); --free) {
-        receive();
+void BaseRF24Serial::irqWidthCompleteI(Rf24SpiTransaction *transaction) {
+    BaseRF24Serial *serial = rf24(transaction->arg);
+    uint8_t width = serial->irq_scratch[1];
+    if(width > 0 && width <= PAYLOAD_SIZE) {
+        serial->irq_tx[0] = R_RX_PAYLOAD;
+        transaction->rx = serial->irq_rx;
+        transaction->length = 1 + width;
+        transaction->complete = irqPayloadCompleteI;
+        serial->spi->startI(transaction);
+    } else {
+        // Corrupt: leave it to the radio thread to deal with
+        serial->irqDoneI();
+    }
+}
+
+void BaseRF24Serial::irqPayloadCompleteI(Rf24SpiTransaction *transaction) {
+    BaseRF24Serial *serial = rf24(transaction->arg);
+    serial->irq_length = transaction->length - 1;
+    serial->irq_staged.store(true);
+    serial->irqDoneI();
+}
+
+void BaseRF24Serial::irqDoneI() {
+    radioThread.signalEventsI(IRQ_EVENT);
+    if(irq_again || (irqLine != PAL_NOLINE && palReadLine(irqLine) == PAL_LOW)) {
+        // Another interrupt came in while we were busy
+        irq_again = false;
+        irqStatusI();
+    } else {
+        irq_busy = false;
     }
 }
 
-inline void RF24Serial::transmitNonBlocking(bool ack) {
+void BaseRF24Serial::wakeWaiting(threads_queue_t *queue) {
+    chSysLock();
+    chThdDequeueNextI(queue, MSG_OK);
+    chSchRescheduleS();
+    chSysUnlock();
+}
+
+/**
+ * Is there a free packet to receive into, and room to queue it?
+ * If not, the reader will send FETCH_EVENT when there is.
+ */
+inline bool BaseRF24Serial::receiveSpace() {
+    return (!receive_queue.full() || !receive_queue.armProducer())
+        && (receive_spare != NULL || !receive_free.empty() || !receive_free.armConsumer());
+}
+
+/**
+ * The receive limit to advertise: what we've accepted, plus what we have
+ * room for. Packets the peer has already sent against an earlier limit are
+ * covered, because accepting a packet moves one unit from the room to the
+ * accepted count, and the reader only ever makes more room.
+ */
+uint8_t BaseRF24Serial::receiveLimit() {
+    size_t room = receive_queue.capacity() - receive_queue.count();
+    room = min(room, receive_free.count() + (receive_spare == NULL ? 0 : 1));
+    room = min(room, (size_t)CREDIT_MAX);
+    return (receive_accepted + room) & CREDIT_MASK;
+}
+
+/**
+ * Get a packet to receive into. receiveSpace() must have said there's one.
+ */
+inline packet_t BaseRF24Serial::receiveTake() {
+    packet_t packet = receive_spare;
+    if(packet != NULL) {
+        receive_spare = NULL;
+    } else {
+        receive_free.get(packet);
+    }
+    return packet;
+}
+
+/**
+ * Read the payload at the head of the radio's FIFO. The interrupt reads
+ * the FIFO too, when it has an asynchronous bus, so the bus is kept from
+ * the check to the read, for the head not to move in between.
+ * @return false if there was nothing to read, and the interrupt hadn't
+ * read anything either
+ */
+bool BaseRF24Serial::receivePayload() {
+    if(spi != NULL) {
+        spi->acquire();
+    }
+    bool read = !irq_staged.load() && !radio.fifoStatus().rxEmpty();
+    uint8_t length = 0;
+    packet_t packet = NULL;
+    if(read) {
+        length = min(PAYLOAD_SIZE, radio.getDynamicPayloadSize());
+        packet = receiveTake();
+        // Leave the flags alone: whatHappened() clears the ones it has seen
+        radio.readPayload(&packet->header, length);
+        status = radio.status();
+    }
+    if(spi != NULL) {
+        spi->release();
+    }
+
+    if(read) {
+        receiveAccept(packet, length);
+    }
+    return read || irq_staged.load();
+}
+
+/**
+ * Take the payload the interrupt read.
+ */
+void BaseRF24Serial::receiveStaged() {
+    packet_t packet = receiveTake();
+    memcpy(&packet->header, &irq_rx[1], irq_length);
+    uint8_t length = irq_length;
+    irq_staged.store(false);
+    receiveAccept(packet, length);
+}
+
+void BaseRF24Serial::receiveAccept(packet_t packet, uint8_t length) {
+    if(length < HEADER_SIZE) {
+        receive_spare = packet;
+        return;
+    }
+
+    packet->length = length - HEADER_SIZE;
+    receiveHeader(packet->header, packet->length > 0);
+    if(packet->length == 0) {
+        // Only flow control
+        stats.rx_credit_only++;
+        receive_spare = packet;
+        return;
+    }
+
+    if(receive_resetting) {
+        // Sent against the counts from before our reset
+        stats.rx_stale++;
+        receive_spare = packet;
+        return;
+    }
+
+    if(receive_filter && receiveDuplicate(packet->header)) {
+        // Not counted, as the peer didn't count it either
+        stats.rx_duplicate++;
+        receive_spare = packet;
+        return;
+    }
+
+    receive_accepted = (receive_accepted + 1) & CREDIT_MASK;
+    receive_queue.put(packet);
+    receive_queued.store(receive_queued.load(std::memory_order_relaxed) + packet->length);
+    if(receive_queue.wakeConsumer()) {
+        wakeWaiting(&receive_waiting);
+    }
+    // Listeners drain the queue once woken, so only news to one that found
+    // it empty is worth the kernel lock
+    if(receive_queue.count() == 1) {
+        eventSource.broadcastFlags(RX_EVENT);
+    }
+}
+
+void BaseRF24Serial::receiveNonBlocking() {
+    while(receiveSpace()) {
+        if(irq_staged.load()) {
+            // The interrupt's payload came out of the FIFO first
+            receiveStaged();
+        } else if(status.rxPipeNo() == RX_P_NO_EMPTY || !receivePayload()) {
+            break;
+        }
+    }
+}
+
+inline void BaseRF24Serial::transmitNonBlocking(bool ack) {
     while(!status.txFifoFull() && transmitNext(ack)) {};
+    // If the queues ran dry, ask to be told about the next packet. If one
+    // turned up in the meantime, come straight back round. If we ran out of
+    // credit, the next header from the peer brings us back here, and if the
+    // bulk queue is held back, the next payload to leave the FIFO does.
+    bool capped = (transmit_fifo >= transmit_bulk_depth) && transmit_lanes[TX_URGENT].queue.empty();
+    if(!status.txFifoFull() && transmitCredit() && !transmitArm() && !capped) {
+        chEvtAddEvents(POST_EVENT);
+    }
+}
+
+inline void BaseRF24Serial::transmitPayload(const uint8_t *payload, uint8_t length, bool ack) {
+    if(ack) {
+        radio.writeAckPayload(readPipe, payload, length);
+    } else {
+        radio.startFastWrite(payload, length, false);
+    }
+    status = radio.status();
+}
+
+/**
+ * Send a payload with just a header: to tell the peer our receive limit
+ * has moved on, or, from the PTX, to pick up an ack payload.
+ * @param flags HEADER_RESET or HEADER_ANSWER, if it's one of those
+ */
+void BaseRF24Serial::transmitHeader(bool ack, uint8_t flags) {
+    uint8_t header = stamp() | flags;
+    transmitPayload(&header, HEADER_SIZE, ack);
+}
+
+/**
+ * Keep the credit moving in both directions, when there's no data to carry it.
+ * @param ack whether we're the PRX, and so send headers in ack payloads
+ */
+void BaseRF24Serial::flowControl(bool ack) {
+    if(status.txFifoFull()) {
+        return;
+    }
+
+    if(ack) {
+        // Keep one ack payload loaded with our latest limit, for the PTX to collect.
+        if(receiveLimit() != receive_advertised && radio.fifoStatus().txEmpty()) {
+            transmitHeader(true);
+        }
+    } else if(mode == ADHOC) {
+        // An ADHOC peer sends its own headers, so it only needs telling
+        if(peerBlocked()) {
+            transmitHeader(false);
+        }
+    } else if(radio.fifoStatus().txEmpty()) {
+        // The PRX can only send when we do. So tell it about new room if it
+        // has used all it was given, ask for credit if we're stuck, and
+        // collect its data if it has said there's more, or it's been a while.
+        sysinterval_t elapsed = chVTTimeElapsedSinceX(transmit_polled);
+        bool blocked = transmitStuck() && elapsed >= CREDIT_POLL_INTERVAL;
+        bool collect = (receive_more && receiveLimit() != receive_accepted)
+                || (pollInterval != TIME_INFINITE && elapsed >= pollInterval);
+        if(peerBlocked() || blocked || collect) {
+            if(blocked) {
+                stats.tx_credit_poll++;
+            }
+            // Each poll uses up the PRX's last word that it has more
+            receive_more = false;
+            transmit_polled = chVTGetSystemTimeX();
+            transmitHeader(false);
+        }
+    }
 }
 
-inline bool RF24Serial::transmitNext(bool ack) {
+/**
+ * Does an ADHOC peer have anything to send: a payload that failed last
+ * time, a packet it has credit for, or a header?
+ */
+bool BaseRF24Serial::transmitPending() {
+    return (transmitCredit() && transmitQueued())
+            || transmit_reset || transmit_answer
+            || peerBlocked()
+            || !radio.fifoStatus().txEmpty();
+}
+
+/**
+ * Start a random backoff, of up to twice as many slots as last time if
+ * the last attempt failed.
+ */
+void BaseRF24Serial::transmitBackoff(bool failed) {
+    if(failed && transmit_attempts < ADHOC_BACKOFF_MAX_EXPONENT) {
+        transmit_attempts++;
+    }
+    // xorshift32
+    transmit_random ^= transmit_random << 13;
+    transmit_random ^= transmit_random >> 17;
+    transmit_random ^= transmit_random << 5;
+    transmit_backoff_start = chVTGetSystemTimeX();
+    transmit_backoff = (1 + transmit_random % (1U << transmit_attempts)) * ADHOC_BACKOFF_SLOT;
+    stats.tx_backoff++;
+}
+
+sysinterval_t BaseRF24Serial::transmitBackoffRemaining() {
+    sysinterval_t elapsed = chVTTimeElapsedSinceX(transmit_backoff_start);
+    return (elapsed >= transmit_backoff) ? TIME_IMMEDIATE : transmit_backoff - elapsed;
+}
+
+/**
+ * Arm both transmit queues, so that a producer wakes the radio thread.
+ * @return true if both are still empty
+ */
+bool BaseRF24Serial::transmitArm() {
+    bool bulk = transmit_lanes[TX_BULK].queue.armConsumer();
+    bool urgent = transmit_lanes[TX_URGENT].queue.armConsumer();
+    return bulk && urgent;
+}
+
+/**
+ * Choose the queue to send from next: urgent first, unless bulk packets
+ * have waited for weight urgent ones, and bulk only while the radio's FIFO
+ * has fewer than the allowed number of bulk payloads in it.
+ * @return the queue, or NULL if there's nothing we can send now
+ */
+PacketRing *BaseRF24Serial::transmitSchedule() {
+    PacketRing *urgent = &transmit_lanes[TX_URGENT].queue;
+    PacketRing *bulk = &transmit_lanes[TX_BULK].queue;
+    bool bulkWaiting = !bulk->empty();
+    if(!urgent->empty() && !(bulkWaiting && transmit_weight != 0 && transmit_burst >= transmit_weight)) {
+        return urgent;
+    }
+    if(!bulkWaiting) {
+        return NULL;
+    }
+
+    if(transmit_fifo >= transmit_bulk_depth) {
+        // We only know the FIFO's count going up, so look again
+        if(!radio.fifoStatus().txEmpty()) {
+            stats.tx_bulk_capped++;
+            return NULL;
+        }
+        transmit_fifo = 0;
+    }
+    return bulk;
+}
+
+inline bool BaseRF24Serial::transmitNext(bool ack) {
     packet_t packet;
-    if(transmit_queue.fetch(&packet, TIME_IMMEDIATE) == MSG_OK) {
-        // broadcastFlags(TX_EVENT);
-        if(ack) {
-            radio.writeAckPayload(readPipe, packet->data, packet->length);
+    if(transmit_reset || transmit_answer) {
+        // Ahead of any data, so the counts start again where the peer
+        // expects them to
+        uint8_t flags = transmit_reset ? HEADER_RESET : HEADER_ANSWER;
+        transmit_reset = false;
+        transmit_answer = false;
+        if(!ack) {
+            transmit_polled = chVTGetSystemTimeX();
+        }
+        transmitHeader(ack, flags);
+        return true;
+    }
+
+    if(!transmitCredit()) {
+        stats.tx_credit_wait++;
+        return false;
+    }
+
+    PacketRing *queue = transmitSchedule();
+    if(queue != NULL && queue->get(packet)) {
+        TransmitLane &lane = transmitLane(packet);
+        // A producer found the queue full, waiting or not
+        bool unblocked = lane.queue.wakeProducer();
+        if(unblocked) {
+            wakeWaiting(&lane.waiting);
+        }
+        if(&lane == &transmit_lanes[TX_URGENT]) {
+            stats.tx_urgent++;
+            transmit_burst++;
         } else {
-            radio.startFastWrite(packet->data, packet->length, false);
+            transmit_burst = 0;
+            // Urgent payloads aren't counted: they're never held back
+            if(transmit_bulk_depth < TX_FIFO_DEPTH) {
+                transmit_fifo++;
+            }
+        }
+        packet->header = stamp() | ((transmit_sent & HEADER_SEQUENCE_MASK) << HEADER_SEQUENCE_SHIFT);
+        transmit_sent = (transmit_sent + 1) & CREDIT_MASK;
+        if(!ack) {
+            // The ack to this brings anything the PRX has, like a poll would
+            transmit_polled = chVTGetSystemTimeX();
+        }
+        transmitPayload(&packet->header, HEADER_SIZE + packet->length, ack);
+        lane.free.put(packet);
+        if(lane.free.wakeConsumer()) {
+            wakeWaiting(&lane.waiting);
+        }
+        // Likewise, only to a listener that found the queue full, or the
+        // lane with no free packets left
+        if(unblocked || lane.free.count() == 1) {
+            eventSource.broadcastFlags(TX_EVENT);
         }
-        freePacket(packet);
-        status = radio.status();
         return true;
     } else {
         return false;
     }
 }
 
-Status RF24Serial::whatHappened() {
+Status BaseRF24Serial::whatHappened() {
     stats.irq++;
-    Status status = radio.resetStatus();
+    Status status = radio.status();
+    if(status.status & IRQ_FLAGS) {
+        radio.resetStatus(status);
+    }
+    if(spi != NULL) {
+        chSysLock();
+        status.status |= irq_flags;
+        irq_flags = 0;
+        chSysUnlock();
+    }
     if(status.dataReceived()) {
         stats.rx_dr++;
         stats.rx_pipe[status.rxPipeNo()]++;
@@ -185,10 +725,16 @@ Status RF24Serial::whatHappened() {
     return status;
 }
 
-void RF24Serial::ptxMain() {
+void BaseRF24Serial::ptxMain() {
     if(transition(STARTING, PTX)) {
+        // The reset goes first
+        status = radio.status();
+        transmitNonBlocking();
         while (true) {
-            eventmask_t events = chEvtWaitAny(STOP_EVENT | IRQ_EVENT | POST_EVENT | FETCH_EVENT);
+            // Wake up to poll the PRX for credit if we're stuck, otherwise
+            // for its data
+            sysinterval_t timeout = transmitStuck() ? CREDIT_POLL_INTERVAL : pollInterval;
+            eventmask_t events = chEvtWaitAnyTimeout(STOP_EVENT | IRQ_EVENT | POST_EVENT | FETCH_EVENT, timeout);
 
             if(events & STOP_EVENT) {
                 break;
@@ -203,77 +749,108 @@ void RF24Serial::ptxMain() {
 
             receiveNonBlocking();
             transmitNonBlocking();
+            flowControl(false);
+            // Check the level: an edge that came while we were busy may have been missed
+            if(irqPending()) {
+                chEvtAddEvents(IRQ_EVENT);
+            }
         }
     }
 }
 
-void RF24Serial::prxMain() {
+void BaseRF24Serial::prxMain() {
     if(transition(STARTING, PRX)) {
         radio.startListening();
+        // Load the reset, for the PTX's next payload to collect
+        status = radio.status();
+        transmitNonBlocking(true);
         while (true) {
-            eventmask_t events = chEvtWaitAnyTimeout(STOP_EVENT | IRQ_EVENT | POST_EVENT | FETCH_EVENT, TIME_MS2I(4));
+            eventmask_t events = chEvtWaitAny(STOP_EVENT | IRQ_EVENT | POST_EVENT | FETCH_EVENT);
             if(events & STOP_EVENT) {
                 break;
-            } else {
-                if(events & IRQ_EVENT || events == 0) {
-                    status = whatHappened();
-                }
+            }
 
-                receiveNonBlocking();
-                transmitNonBlocking(true);
+            if(events & IRQ_EVENT) {
+                status = whatHappened();
+            }
+
+            receiveNonBlocking();
+            transmitNonBlocking(true);
+            flowControl(true);
+            // Check the level: an edge that came while we were busy may have been missed
+            if(irqPending()) {
+                chEvtAddEvents(IRQ_EVENT);
             }
         }
     }
 }
 
-void RF24Serial::adhocMain() {
+void BaseRF24Serial::adhocMain() {
     if(transition(STARTING, PRX)) {
+        // Set up the pipes once, leaving pipe 0 open for acks, and from then
+        // on only flip PRIM_RX. The role stays out of state, which other
+        // threads change.
         radio.startListening();
-        while(ready()) {
-            switch(chEvtWaitOne(STOP_EVENT | IRQ_EVENT | POST_EVENT | FETCH_EVENT)) {
-            case IRQ_EVENT:
-                {
-                    Status status = whatHappened();
-                    if(status.dataReceived()) {
-                        receiveNonBlocking();
-                    }
-
-                    if(status.maxRetries()) {
-                        if(transition(PTX, PRX)) {
-                            radio.startListening();
-                        }
-                    }
-
-                    if(status.dataSent()) {
-                        transmitNonBlocking();
-                        stateMutex.lock();
-                        if(state == PTX && radio.fifoStatus().txEmpty()) {
-                            radio.startListening();
-                            state = PRX;
-                        }
-                        stateMutex.unlock();
-                    }
-                }
+        radio.stopListening();
+        radio.turnaround(true);
+        bool transmitting = false;
+        while (true) {
+            sysinterval_t timeout = TIME_INFINITE;
+            if(!transmitting && transmitPending()) {
+                timeout = transmitBackoffRemaining();
+            }
+            eventmask_t events = chEvtWaitAnyTimeout(STOP_EVENT | IRQ_EVENT | POST_EVENT | FETCH_EVENT, timeout);
+
+            if(events & STOP_EVENT) {
                 break;
-            case POST_EVENT:
-                stateMutex.lock();
-                if(transition(PRX, PTX)) {
-                    radio.stopListening();
+            }
+
+            if(events & IRQ_EVENT) {
+                status = whatHappened();
+                if(status.dataSent()) {
+                    transmit_attempts = 0;
+                }
+                if(transmitting && status.maxRetries()) {
+                    // Most likely the peer was sending too. The payload stays
+                    // in the FIFO for the next attempt.
+                    radio.turnaround(true);
+                    transmitting = false;
+                    transmitBackoff(true);
                 }
+            }
 
+            receiveNonBlocking();
+
+            if(!transmitting && transmitPending() && transmitBackoffRemaining() == TIME_IMMEDIATE) {
+                if(radio.testRPD()) {
+                    stats.tx_channel_busy++;
+                    transmitBackoff(false);
+                } else {
+                    radio.turnaround(false);
+                    transmitting = true;
+                }
+            }
+
+            if(transmitting) {
                 transmitNonBlocking();
-                break;
-            case FETCH_EVENT:
-                receiveNonBlocking();
-                break;
-            case STOP_EVENT:
-                break;
+                flowControl(false);
+                if(radio.fifoStatus().txEmpty()) {
+                    // All sent: listen, for long enough to trust RPD next time
+                    radio.turnaround(true);
+                    transmitting = false;
+                    transmit_backoff_start = chVTGetSystemTimeX();
+                    transmit_backoff = ADHOC_LISTEN_TIME;
+                }
+            }
+            // Check the level: an edge that came while we were busy may have been missed
+            if(irqPending()) {
+                chEvtAddEvents(IRQ_EVENT);
             }
         }
     }
 }
 
-void RF24Serial::eventMain() {
+void BaseRF24Serial::eventMain() {
 
     switch(mode) {
     case ADHOC:
@@ -293,7 +870,7 @@ void RF24Serial::eventMain() {
 }
 
 
-msg_t RF24Serial::get() {
+msg_t BaseRF24Serial::get() {
     if(receiveEnsureAvailable() != Q_OK) {
         return Q_RESET;
     } else {
@@ -304,7 +881,7 @@ msg_t RF24Serial::get() {
     }
 }
 
-size_t RF24Serial::read(uint8_t* bp, size_t n) {
+size_t BaseRF24Serial::read(uint8_t* bp, size_t n) {
     size_t read = 0;
     while(read < n) {
         if(receiveEnsureAvailable() != MSG_OK) break;
@@ -315,7 +892,7 @@ size_t RF24Serial::read(uint8_t* bp, size_t n) {
     return read;
 }
 
-size_t RF24Serial::readPacket(uint8_t* bp) {
+size_t BaseRF24Serial::readPacket(uint8_t* bp) {
     size_t read = 0;
     if(receiveEnsureAvailable() == MSG_OK) {
         preReadCheck();
@@ -325,25 +902,21 @@ size_t RF24Serial::readPacket(uint8_t* bp) {
     return read;
 }
 
-size_t RF24Serial::available() {
-    return receive_queue_available + (receive_packet == NULL ? 0 : receive_packet->length - receive_pos);
+size_t BaseRF24Serial::available() {
+    size_t queued = receive_queued.load() - receive_fetched.load(std::memory_order_relaxed);
+    return queued + (receive_packet == NULL ? 0 : receive_packet->length - receive_pos);
 }
 
-inline msg_t RF24Serial::receiveEnsureAvailable() {
+inline msg_t BaseRF24Serial::receiveEnsureAvailable() {
     msg_t result = MSG_OK;
     if(!ready()) {
         receive_status = RECEIVE_ENSURE_AVAILABLE_NOT_READY;
         result = MSG_RESET;
     } else if(receive_packet == NULL) {
-        packet_t packet;
-        if(receive_queue.fetch(&packet, TIME_INFINITE) == MSG_OK) {
-            System::lock();
-            receive_queue_available -= packet->length;
+        packet_t packet = receiveFetch(TIME_INFINITE);
+        if(packet != NULL) {
             receive_packet = packet;
             receive_pos = 0;
-            System::unlock();
-            // signal the radio thread that there's a free slot in the receive queue
-            radioThread.signalEvents(FETCH_EVENT);
             if(receiveBufferEmpty()) {
                 receive_status = RECEIVE_ENSURE_AVAILABLE_EMPTY;
                 result = MSG_RESET;
@@ -357,22 +930,79 @@ inline msg_t RF24Serial::receiveEnsureAvailable() {
     return result;
 }
 
-inline void RF24Serial::receiveFreeBufferIfEmpty() {
+packet_t BaseRF24Serial::receiveFetch(sysinterval_t timeout) {
+    packet_t packet;
+    while(!receive_queue.get(packet)) {
+        msg_t msg = MSG_RESET;
+        chSysLock();
+        if(ready()) {
+            msg = receive_queue.armConsumer() ? chThdEnqueueTimeoutS(&receive_waiting, timeout) : MSG_OK;
+        }
+        chSysUnlock();
+        if(msg != MSG_OK) {
+            return NULL;
+        }
+    }
+
+    receive_fetched.store(receive_fetched.load(std::memory_order_relaxed) + packet->length);
+    // signal the radio thread if it stopped reading because the receive queue was full
+    if(receive_queue.wakeProducer()) {
+        radioThread.signalEvents(FETCH_EVENT);
+    }
+    return packet;
+}
+
+packet_t BaseRF24Serial::receive(sysinterval_t timeout) {
+    if(!ready()) {
+        return NULL;
+    }
+
+    packet_t packet = receive_packet;
+    if(packet == NULL) {
+        return receiveFetch(timeout);
+    }
+
+    // Hand over what the stream methods haven't read yet. This is the
+    // only case where receive copies, and only if the two are mixed.
+    receive_packet = NULL;
+    packet->length -= receive_pos;
+    memmove(packet->data, &packet->data[receive_pos], packet->length);
+    return packet;
+}
+
+void BaseRF24Serial::release(packet_t packet) {
+    validatePacket(packet);
+    if(isReceivePacket(packet)) {
+        receive_free.put(packet);
+        if(receive_free.wakeConsumer()) {
+            radioThread.signalEvents(FETCH_EVENT);
+        }
+    } else {
+        // Only the radio thread puts packets on a lane's free ring
+        TransmitLane &lane = transmitLane(packet);
+        packet->next = lane.spare;
+        lane.spare = packet;
+    }
+}
+
+inline void BaseRF24Serial::receiveFreeBufferIfEmpty() {
     if(receiveBufferEmpty()) {
-        freePacket(receive_packet);
+        release(receive_packet);
         receive_packet = NULL;
     }
 }
 
-msg_t RF24Serial::flush(void) {
+msg_t BaseRF24Serial::flush(void) {
     if(!ready()) {
         return MSG_RESET;
     } else if(transmit_pos > 0) {
         transmit_packet->length = transmit_pos;
-        if(transmit_queue.post(transmit_packet, TIME_INFINITE) == MSG_OK) {
-            radioThread.signalEvents(POST_EVENT);
-            transmit_packet = allocPacket();
+        if(transmitPost(transmit_packet) == MSG_OK) {
+            transmit_packet = transmitAlloc(transmit_lanes[TX_BULK]);
             transmit_pos = 0;
+            if(transmit_packet == NULL) {
+                return MSG_RESET;
+            }
         } else {
             return MSG_RESET;
         }
@@ -381,7 +1011,82 @@ msg_t RF24Serial::flush(void) {
     return MSG_OK;
 }
 
-msg_t RF24Serial::put(uint8_t b) {
+/**
+ * Sleep until the radio thread has made progress on ring.
+ * @param producer whether the writer is waiting to put, rather than get
+ * @return false if the stream stopped
+ */
+msg_t BaseRF24Serial::transmitWait(TransmitLane &lane, PacketRing &ring, bool producer, sysinterval_t timeout) {
+    msg_t msg = MSG_RESET;
+    chSysLock();
+    if(ready()) {
+        bool wait = producer ? ring.armProducer() : ring.armConsumer();
+        msg = wait ? chThdEnqueueTimeoutS(&lane.waiting, timeout) : MSG_OK;
+    }
+    chSysUnlock();
+    return msg;
+}
+
+inline msg_t BaseRF24Serial::transmitPost(packet_t packet, sysinterval_t timeout) {
+    TransmitLane &lane = transmitLane(packet);
+    while(!lane.queue.put(packet)) {
+        msg_t msg = transmitWait(lane, lane.queue, true, timeout);
+        if(msg != MSG_OK) {
+            return msg;
+        }
+    }
+
+    if(lane.queue.wakeConsumer()) {
+        radioThread.signalEvents(POST_EVENT);
+    }
+    return MSG_OK;
+}
+
+packet_t BaseRF24Serial::transmitAlloc(TransmitLane &lane, sysinterval_t timeout) {
+    packet_t packet = lane.spare;
+    if(packet != NULL) {
+        lane.spare = packet->next;
+        return packet;
+    }
+
+    while(!lane.free.get(packet)) {
+        if(transmitWait(lane, lane.free, false, timeout) != MSG_OK) {
+            return NULL;
+        }
+    }
+    return packet;
+}
+
+packet_t BaseRF24Serial::acquire(sysinterval_t timeout, TransmitClass cls) {
+    if(!ready()) {
+        return NULL;
+    }
+
+    packet_t packet = transmitAlloc(transmit_lanes[cls], timeout);
+    if(packet != NULL) {
+        validatePacket(packet);
+        packet->length = 0;
+    }
+    return packet;
+}
+
+msg_t BaseRF24Serial::commit(packet_t packet, sysinterval_t timeout) {
+    validatePacket(packet);
+    chDbgAssert(packet->length <= PACKET_SIZE, "RF24Serial::commit - overflow");
+    // Only the bulk lane shares the stream's order, and its thread
+    msg_t msg = (&transmitLane(packet) == &transmit_lanes[TX_BULK]) ? flush() : MSG_OK;
+    if(msg == MSG_OK) {
+        msg = transmitPost(packet, timeout);
+    }
+    if(msg == MSG_OK || msg == MSG_TIMEOUT) {
+        return msg;
+    }
+
+    release(packet);
+    return MSG_RESET;
+}
+
+msg_t BaseRF24Serial::put(uint8_t b) {
     if(!ready()) {
         return Q_RESET;
     } else {
@@ -391,7 +1096,7 @@ msg_t RF24Serial::put(uint8_t b) {
     }
 }
 
-size_t RF24Serial::write(const uint8_t *bp, size_t n) {
+size_t BaseRF24Serial::write(const uint8_t *bp, size_t n) {
     if(!ready()) {
         return 0;
     }
@@ -410,7 +1115,7 @@ static inline size_t min(size_t a, size_t b) {
     return a > b ? b : a;
 }
 
-size_t RF24Serial::append(const uint8_t *bp, size_t n) {
+size_t BaseRF24Serial::append(const uint8_t *bp, size_t n) {
     preWriteCheck();
     size_t write = min(PACKET_SIZE - transmit_pos, n);
     memcpy(&transmit_packet->data[transmit_pos], bp, write);
@@ -418,11 +1123,9 @@ size_t RF24Serial::append(const uint8_t *bp, size_t n) {
     return write;
 }
 
-void RF24Serial::setError(Error _error) {
-    stateMutex.lock();
+void BaseRF24Serial::setError(Error _error) {
     error = _error;
-    state = State::ERROR;
-    stateMutex.unlock();
+    setState(State::ERROR);
 }
 
 }
@@ -5,26 +5,140 @@
 #include <ch.hpp>
 #include <chdebug.h>
 #include <rf24.h>
+#include "rf24-spsc-ring.h"
 
 namespace rf24 {
 namespace serial {
 
 using namespace chibios_rt;
 
-static const uint8_t PACKET_SIZE = 32;
-static const uint8_t PACKET_COUNT = 5;
-static const size_t PACKET_POOL_COUNT = 2 * PACKET_COUNT;
-static const size_t QUEUE_COUNT = PACKET_COUNT - 2;
+/**
+ * Every payload starts with a one byte header, which carries flow control.
+ *
+ * Bits 0-4 of the header are the sender's receive limit: the number of
+ * data packets it has accepted (mod 32), plus the number more it has room
+ * for. Each side only sends a data packet while its count of data packets
+ * sent is short of the peer's latest limit, so the peer never gets a
+ * packet it can't queue, and the radios never burn retries on a full
+ * FIFO. A payload with nothing but a header just moves the limit on.
+ * Limits only move forward, so a stale header (an ack payload loaded a
+ * while ago, say) never gives away credit the receiver doesn't have.
+ *
+ * Bits 5-6 of a data packet's header are its sequence number: the
+ * sender's count of data packets sent before it (mod 4). When an ack is
+ * lost and the sender's retry gets through too, the receiver sees the
+ * last number again, and can drop the copy.
+ *
+ * Bit 7 is set when the sender has more data queued. The PTX uses it to
+ * poll for the PRX's ack payloads straight away, instead of waiting for
+ * its next scheduled poll.
+ *
+ * A payload with nothing but a header has no sequence number, so bits 5
+ * and 6 resynchronise the counts instead, for when one end restarts
+ * without the other. An end that starts sends HEADER_RESET before
+ * anything else: its counts are zero as of that payload. Until it hears
+ * back, it sends no data, and drops any it gets, which was sent against
+ * counts from before. The peer zeroes its counts on the reset, and
+ * answers with HEADER_ANSWER, again before anything else, so the data it
+ * sent before the answer is what got dropped. Two ends that start
+ * together both send a reset, and take each other's as the answer.
+ * Payloads arrive in order, but a retry whose ack was lost can bring one
+ * in twice, so a reset with nothing else from the peer since the last
+ * one is taken as a copy: the counts are left alone, and it is only
+ * answered again while no data has gone out against them.
+ */
+static const uint8_t HEADER_SIZE = 1;
+static const uint8_t PAYLOAD_SIZE = 32;
+static const uint8_t PACKET_SIZE = PAYLOAD_SIZE - HEADER_SIZE;
+/** The payloads the radio's transmit FIFO holds */
+static const uint8_t TX_FIFO_DEPTH = 3;
+
+static const uint8_t CREDIT_MASK = 0x1f;
+static const uint8_t HEADER_SEQUENCE_SHIFT = 5;
+static const uint8_t HEADER_SEQUENCE_MASK = 0x03;
+static const uint8_t HEADER_MORE = 0x80;
+/** In a payload with no data: the sender has started again */
+static const uint8_t HEADER_RESET = 0x20;
+/** In a payload with no data: the sender has zeroed its counts for a reset */
+static const uint8_t HEADER_ANSWER = 0x40;
+/** The most credit a receiver grants, so that limits can be compared mod 32 */
+static const uint8_t CREDIT_MAX = 15;
+/** The credit each end assumes the other has granted before hearing from it */
+static const uint8_t CREDIT_INITIAL = 1;
+/** How often a PTX with data but no credit asks the PRX for more */
+static const sysinterval_t CREDIT_POLL_INTERVAL = TIME_MS2I(2);
+/** How often an idle PTX polls the PRX for data, by default */
+static const sysinterval_t DUPLEX_POLL_INTERVAL = TIME_MS2I(10);
+/** The unit of an ADHOC peer's random backoff */
+static const sysinterval_t ADHOC_BACKOFF_SLOT = TIME_MS2I(1);
+/** An ADHOC peer backs off for up to 2^n slots after n failures in a row */
+static const uint8_t ADHOC_BACKOFF_MAX_EXPONENT = 5;
+/** How long an ADHOC peer listens before it trusts the carrier detector */
+static const sysinterval_t ADHOC_LISTEN_TIME = TIME_US2I(200);
 
 typedef struct packet {
+    // Links packets the writer has taken but handed back unused
+    struct packet *next;
     size_t length;
+    // The header goes on air immediately in front of the data
+    uint8_t header;
     uint8_t data[PACKET_SIZE];
 } *packet_t;
 
+typedef SpscRing<packet_t> PacketRing;
+
+/**
+ * Packets are sent in one of these classes. Each has its own queue and
+ * its own packets, so an urgent packet can be sent from another thread,
+ * and never waits behind the bulk queue.
+ */
+typedef enum {
+    TX_BULK, TX_URGENT, TX_CLASS_COUNT
+} TransmitClass;
+
+/**
+ * One transmit class's packets go round from free, to the producer, to
+ * queue, to the radio thread and back to free.
+ */
+struct TransmitLane {
+    PacketRing queue;
+    PacketRing free;
+    // Packets the producer acquired and released without sending
+    packet_t spare;
+    // The producer sleeps here when queue is full, or free is empty
+    threads_queue_t waiting;
+
+    TransmitLane(packet_t *queueSlots, size_t queueSize, packet_t *freeSlots, size_t freeSize) :
+        queue(queueSlots, queueSize), free(freeSlots, freeSize), spare(NULL) {
+    }
+};
+
 struct PacketTransmitStreamVMT {
     _base_sequential_stream_methods
 };
 
+struct BaseRF24Serial;
+
+/**
+ * One direction of an RF24Serial, as a stream of its own. Writes to the
+ * receive direction, and reads from the transmit direction, do nothing.
+ */
+struct RF24SerialDirection {
+    const struct PacketTransmitStreamVMT * const vmt;
+    BaseRF24Serial * const serial;
+};
+
+/**
+ * The stream print() formats into: the unused part of the transmit
+ * packet, and the packets after it as it fills up.
+ */
+struct PacketPrinter {
+    const struct PacketTransmitStreamVMT * const vmt;
+    BaseRF24Serial * const serial;
+    uint8_t *pos;
+    uint8_t *end;
+};
+
 typedef enum {
     STOP, STARTING, PRX, PTX, STOPPING, ERROR
 } State;
@@ -37,6 +151,18 @@ typedef enum {
     RECEIVE_NONE, RECEIVE_ENSURE_AVAILABLE_NOT_READY, RECEIVE_ENSURE_AVAILABLE_RESET, RECEIVE_ENSURE_AVAILABLE_EMPTY
 } ReceiveStatus;
 
+/**
+ * PTX_ONLY and PRX_ONLY are the two ends of a full duplex link: the PTX's
+ * data goes in ordinary payloads and the PRX's comes back in the ack
+ * payloads, so neither radio ever changes role. The PTX sends payloads
+ * with just a header to collect the PRX's data when it has nothing of its
+ * own to send.
+ *
+ * In ADHOC mode both ends are the same: each listens until it has
+ * something to send, checks the channel is quiet, and turns around to
+ * send it. When both send at once, neither gets an ack, and each backs off
+ * for a random time before trying again.
+ */
 typedef enum {
     ADHOC, PTX_ONLY, PRX_ONLY
 } Mode;
@@ -52,7 +178,40 @@ const eventmask_t RX_EVENT = 0x1;
  */
 const eventmask_t TX_EVENT = 0x2;
 
-struct RF24Serial {
+/**
+ * The memory an RF24Serial works in. It's provided by the RF24Serial
+ * template so that the sizes can be chosen at compile time, while the
+ * implementation stays out of the header.
+ */
+typedef struct {
+    struct packet *packets;
+    size_t packetCount;
+    /** The packets at the start of the pool are kept for receiving */
+    size_t receivePacketCount;
+    /** The packets at the end of the pool are kept for urgent sends */
+    size_t urgentPacketCount;
+    /** Each ring's slots, one more than the ring's capacity */
+    packet_t *transmitQueue;
+    size_t transmitQueueSize;
+    packet_t *transmitFree;
+    size_t transmitFreeSize;
+    packet_t *urgentQueue;
+    size_t urgentQueueSize;
+    packet_t *urgentFree;
+    size_t urgentFreeSize;
+    packet_t *receiveQueue;
+    size_t receiveQueueSize;
+    packet_t *receiveFree;
+    size_t receiveFreeSize;
+    stkalign_t *wa;
+    size_t waSize;
+} RF24SerialStorage;
+
+/**
+ * The implementation of RF24Serial, independent of the queue and
+ * stack sizes. Use RF24Serial, which provides the storage.
+ */
+struct BaseRF24Serial {
     const struct PacketTransmitStreamVMT * const vmt;
     static constexpr uint8_t ADDRESS_WIDTH = 5;
     RF24<Rf24ChibiosIo, ADDRESS_WIDTH> radio;
@@ -60,26 +219,60 @@ private:
     uint8_t readPipe = 0;
     const uint8_t *readAddress = NULL;
     const uint8_t *writeAddress = NULL;
-    volatile State state = State::STOP;
+    std::atomic<State> state;
     Mode mode = Mode::ADHOC;
+    sysinterval_t pollInterval = DUPLEX_POLL_INTERVAL;
     Error error = Error::NONE;
-    Mutex stateMutex;
+    RF24SerialDirection transmitDirection;
+    RF24SerialDirection receiveDirection;
     // We keep the last status result here
     Status status;
 
-    // This is a blob of memory big enough to hold all the packets we could need
-    __attribute__((aligned(sizeof(void *))))
-    struct packet buffer[PACKET_POOL_COUNT];
-    // We want to be able to re-init the pool each time we start, so we don't
-    // use the C++ wrapper.
-    memory_pool_t packets;
+    const RF24SerialStorage storage;
 
     // The radio IO thread
-    THD_WORKING_AREA(wa, 256);
     ThreadReference radioThread;
 
+    // Broadcasts RX_EVENT and TX_EVENT flags
+    EventSource eventSource;
+
+    // -------------------------------------------------------------
+    // Interrupt state, when the IO has asynchronous SPI. The interrupt
+    // clears the radio's flags and reads a payload into irq_rx, before
+    // the radio thread even wakes up.
+    Rf24ChibiosSpi * const spi;
+    // The IRQ line, if we can read it
+    const ioline_t irqLine;
+    Rf24SpiTransaction irq_transaction;
+    bool irq_busy;
+    bool irq_again;
+    // The status the interrupt read, before clearing its flags
+    uint8_t irq_seen;
+    // Flags cleared by the interrupt, for whatHappened()
+    uint8_t irq_flags;
+    // A payload is waiting in irq_rx, after the status byte
+    std::atomic<bool> irq_staged;
+    uint8_t irq_length;
+    uint8_t irq_tx[PAYLOAD_SIZE + 1];
+    uint8_t irq_rx[PAYLOAD_SIZE + 1];
+    // What the status, clear and width exchanges read, so that they leave
+    // a staged payload in irq_rx alone
+    uint8_t irq_scratch[2];
+
+    void irqStatusI();
+    void irqDoneI();
+    static void irqStatusCompleteI(Rf24SpiTransaction *transaction);
+    static void irqClearCompleteI(Rf24SpiTransaction *transaction);
+    static void irqWidthCompleteI(Rf24SpiTransaction *transaction);
+    static void irqPayloadCompleteI(Rf24SpiTransaction *transaction);
+
+    /**
+     * Is the stream running? This is on every byte's path, so it's just a
+     * load.
+     */
     inline bool ready() {
-        return (state == PTX || state == PRX);
+        State now = state.load(std::memory_order_acquire);
+        return (now == PTX || now == PRX);
     }
 
     /**
@@ -89,12 +282,18 @@ private:
      * @return true if the current state matches now, false otherwise
      */
     inline bool transition(State now, State next) {
-        bool valid;
-        stateMutex.lock();
-        valid = (state == now);
-        state = valid ? next : state;
-        stateMutex.unlock();
+#if defined(__ARM_ARCH_6M__)
+        // ARMv6-M has no exclusive load and store, so no lock free compare and swap
+        chSysLock();
+        bool valid = (state.load(std::memory_order_relaxed) == now);
+        if(valid) {
+            state.store(next, std::memory_order_release);
+        }
+        chSysUnlock();
         return valid;
+#else
+        return state.compare_exchange_strong(now, next, std::memory_order_acq_rel, std::memory_order_acquire);
+#endif
     }
 
     // -------------------------------------------------------------
@@ -102,21 +301,65 @@ private:
 
     /*
      * We want to have one packet in transmit_packet, one being sent
-     * and the remainder in the transmit queue. This guarantees that
-     * immediately after posting to the transmit_queue there will be
-     * a free packet in transmit_free. This wastes one packet, but
-     * simplifies the code to a single helper method: All methods leave
+     * and the remainder in the transmit queue. All methods leave
      * transmit_packet ready to accept at least one byte.
+     *
+     * The pool is split three ways, and packets go round in rings, each
+     * of which has one producer and one consumer: transmit packets go
+     * round their class's TransmitLane; receive packets go from
+     * receive_free to the radio thread, to receive_queue, to the reader
+     * and back to receive_free. So no thread needs a lock to pass a
+     * packet on, and the kernel is only involved when one has to sleep.
+     * The stream methods use the bulk lane.
      */
 
-    Mailbox<packet_t, QUEUE_COUNT> transmit_queue;
+    TransmitLane transmit_lanes[TX_CLASS_COUNT];
+    // Urgent packets to send for each bulk one when both are waiting, or
+    // zero to always send urgent packets first
+    uint8_t transmit_weight = 0;
+    uint8_t transmit_burst;
+    // How many bulk payloads may sit in the radio's FIFO, in front of
+    // the next urgent one, and how many we've put there since we last
+    // saw it empty
+    uint8_t transmit_bulk_depth = TX_FIFO_DEPTH;
+    uint8_t transmit_fifo;
     packet_t transmit_packet;
     uint8_t transmit_pos;
+    // Flow control: data packets sent, and the peer's latest limit (mod 32)
+    uint8_t transmit_sent;
+    uint8_t transmit_limit;
+    // Resynchronisation headers to send before anything else
+    bool transmit_reset;
+    bool transmit_answer;
+    systime_t transmit_polled;
+    // ADHOC: failed attempts in a row, and the backoff they've earned
+    uint8_t transmit_attempts;
+    systime_t transmit_backoff_start;
+    sysinterval_t transmit_backoff;
+    uint32_t transmit_random;
 
     // -------------------------------------------------------------
     // Receive state
-    Mailbox<packet_t, QUEUE_COUNT> receive_queue;
-    size_t receive_queue_available;
+    PacketRing receive_queue;
+    PacketRing receive_free;
+    // The reader sleeps here when receive_queue is empty
+    threads_queue_t receive_waiting;
+    // Bytes through receive_queue. Each is only written by one side.
+    std::atomic<size_t> receive_queued;
+    std::atomic<size_t> receive_fetched;
+    // A receive packet the radio thread took and didn't need to queue
+    packet_t receive_spare;
+    // Flow control: data packets accepted, and the last limit we sent (mod 32)
+    uint8_t receive_accepted;
+    uint8_t receive_advertised;
+    // Our reset hasn't been answered, so the peer's counts aren't ours
+    bool receive_resetting;
+    // The peer's last payload was a reset we took
+    bool receive_reset_taken;
+    // The peer said it has more to send
+    bool receive_more;
+    // Drop data packets carrying the last sequence number again
+    bool receive_filter = false;
     packet_t receive_packet;
     uint8_t receive_pos;
     ReceiveStatus receive_status;
@@ -124,16 +367,23 @@ private:
     void setError(Error error);
 
     inline void validatePacket(packet_t packet) {
-        chDbgAssert(packet >= buffer, "RF24Serial::checkValidPacket - underflow");
-        size_t offset = ((uint8_t *)packet) - ((uint8_t *)buffer);
+        chDbgAssert(packet >= storage.packets, "RF24Serial::checkValidPacket - underflow");
+        size_t offset = ((uint8_t *)packet) - ((uint8_t *)storage.packets);
         chDbgAssert(offset % (sizeof(struct packet)) == 0, "RF24Serial::checkValidPacket - alignment");
-        chDbgAssert(offset / (sizeof(struct packet)) < PACKET_POOL_COUNT, "RF24Serial::checkValidPacket - overflow");
+        chDbgAssert(offset / (sizeof(struct packet)) < storage.packetCount, "RF24Serial::checkValidPacket - overflow");
+    }
+
+    inline bool isReceivePacket(packet_t packet) {
+        return packet < &storage.packets[storage.receivePacketCount];
+    }
+
+    inline TransmitLane &transmitLane(packet_t packet) {
+        bool urgent = packet >= &storage.packets[storage.packetCount - storage.urgentPacketCount];
+        return transmit_lanes[urgent ? TX_URGENT : TX_BULK];
     }
 
-    inline packet_t allocPacket() {
-        packet_t packet = (packet_t)chPoolAlloc(&packets);
-        validatePacket(packet);
-        return packet;
+    inline bool transmitQueued() {
+        return !transmit_lanes[TX_BULK].queue.empty() || !transmit_lanes[TX_URGENT].queue.empty();
     }
 
     inline void preWriteCheck() {
@@ -146,14 +396,94 @@ private:
         chDbgAssert(receive_pos < PACKET_SIZE, "RF24Serial::preReadCheck - overflow");
     }
 
-    inline void freePacket(packet_t packet) {
-        chPoolFree(&packets, packet);
+    void setState(State _state) {
+        state.store(_state, std::memory_order_release);
     }
 
-    void setState(State _state) {
-        stateMutex.lock();
-        state = _state;
-        stateMutex.unlock();
+    /**
+     * Is there credit to send another data packet?
+     */
+    inline bool transmitCredit() {
+        if(receive_resetting) {
+            return false;
+        }
+        uint8_t credit = (transmit_limit - transmit_sent) & CREDIT_MASK;
+        return credit != 0 && credit <= CREDIT_MAX;
+    }
+
+    /**
+     * Is a PTX out of credit with something to send, or waiting for the
+     * answer to its reset, so that it has to poll the PRX?
+     */
+    inline bool transmitStuck() {
+        return !transmitCredit() && (transmitQueued() || receive_resetting);
+    }
+
+    /**
+     * Take in a header the peer sent. Its receive limit is only used if
+     * it isn't older than the one we have, unless it comes with a reset
+     * or the answer to ours, which start the counts again.
+     * @param data whether the payload has data after the header
+     */
+    inline void receiveHeader(uint8_t header, bool data) {
+        uint8_t limit = header & CREDIT_MASK;
+        bool reset = !data && (header & HEADER_RESET);
+        if(reset && receive_reset_taken) {
+            // A copy of the one we took: our counts already start there.
+            // Answering again is safe until we send data against them.
+            if(!transmit_answer && transmit_sent == 0) {
+                transmit_answer = true;
+            }
+            stats.reset_duplicate++;
+        } else if(reset) {
+            transmit_sent = 0;
+            transmit_limit = limit;
+            receive_accepted = 0;
+            receive_advertised = CREDIT_INITIAL;
+            // Unless it's the peer's half of starting together
+            transmit_answer = !receive_resetting;
+            receive_resetting = false;
+            stats.resync++;
+        } else if(!data && (header & HEADER_ANSWER) && receive_resetting) {
+            transmit_limit = limit;
+            receive_accepted = 0;
+            receive_resetting = false;
+            stats.resync++;
+        } else if(!receive_resetting) {
+            if(!data && (header & HEADER_ANSWER)) {
+                // To a reset before our last: its counts still start here
+                receive_accepted = 0;
+            }
+            if(((limit - transmit_limit) & CREDIT_MASK) <= CREDIT_MAX) {
+                transmit_limit = limit;
+            }
+        }
+        receive_reset_taken = reset;
+        receive_more = (header & HEADER_MORE) != 0;
+    }
+
+    /**
+     * Has the peer used all the room we told it about, when we have more?
+     * Only we can tell it, unless it's a PTX, which asks.
+     */
+    inline bool peerBlocked() {
+        return (receive_accepted == receive_advertised) && (receiveLimit() != receive_advertised);
+    }
+
+    /**
+     * Is this data packet a copy of the last one we accepted?
+     */
+    inline bool receiveDuplicate(uint8_t header) {
+        uint8_t sequence = (header >> HEADER_SEQUENCE_SHIFT) & HEADER_SEQUENCE_MASK;
+        return sequence == ((receive_accepted - 1) & HEADER_SEQUENCE_MASK);
+    }
+
+    /**
+     * Make the header for a payload we're about to send.
+     */
+    inline uint8_t stamp() {
+        receive_advertised = receiveLimit();
+        return receive_advertised | (transmitQueued() ? HEADER_MORE : 0);
     }
 
     // -------------------------------------------------------------
@@ -161,6 +491,17 @@ private:
     void transmitEventLoop();
     void transmitNonBlocking(bool ack = false);
     bool transmitNext(bool ack);
+    PacketRing *transmitSchedule();
+    bool transmitArm();
+    msg_t transmitPost(packet_t packet, sysinterval_t timeout = TIME_INFINITE);
+    void transmitPayload(const uint8_t *payload, uint8_t length, bool ack);
+    void transmitHeader(bool ack, uint8_t flags = 0);
+    void flowControl(bool ack);
+    bool transmitPending();
+    void transmitBackoff(bool failed);
+    sysinterval_t transmitBackoffRemaining();
+    packet_t transmitAlloc(TransmitLane &lane, sysinterval_t timeout = TIME_INFINITE);
+    msg_t transmitWait(TransmitLane &lane, PacketRing &ring, bool producer, sysinterval_t timeout);
 
     inline msg_t flushIfFull() {
         return (transmit_pos < PACKET_SIZE) ? MSG_OK : flush();
@@ -168,30 +509,61 @@ private:
 
     size_t append(const uint8_t *bp, size_t n);
 
+    static const struct PacketTransmitStreamVMT PRINT_VMT;
+    bool printSpill(PacketPrinter *printer);
+    static msg_t printPut(void *instance, uint8_t b);
+    static size_t printWrite(void *instance, const uint8_t *bp, size_t n);
+
     // -------------------------------------------------------------
     // Receive private methods
     inline bool receiveBufferEmpty() {
         return (receive_packet == NULL || receive_pos == receive_packet->length);
     }
 
-    int receiveFreeCount();
-    void receive();
+    bool receiveSpace();
+    uint8_t receiveLimit();
+    packet_t receiveTake();
+    void receiveAccept(packet_t packet, uint8_t length);
+    bool receivePayload();
+    void receiveStaged();
     void receiveNonBlocking();
     void receiveAckNonBlocking();
     msg_t receiveEnsureAvailable();
+    packet_t receiveFetch(sysinterval_t timeout);
     void receiveFreeBufferIfEmpty();
+    void wakeWaiting(threads_queue_t *queue);
 
     Status whatHappened();
+
+    /**
+     * Is the radio still asking for attention, after we've dealt with what
+     * it last told us? Edges on the IRQ line can be missed, but the level
+     * (or failing that, the flags) can't.
+     */
+    inline bool irqPending() {
+        if(irqLine != PAL_NOLINE) {
+            return palReadLine(irqLine) == PAL_LOW;
+        }
+        return (radio.status().status & (_BV(RX_DR) | _BV(TX_DS) | _BV(MAX_RT))) != 0;
+    }
     void ptxMain();
     void prxMain();
     void adhocMain();
 
-public:
-    RF24Serial(Rf24ChibiosIo io);
+protected:
+    BaseRF24Serial(Rf24ChibiosIo io, const RF24SerialStorage &storage);
 
-    inline void ptx(const uint8_t *address) {
+public:
+    /**
+     * Be the PTX end of a full duplex link.
+     * @param address the PRX's address
+     * @param poll how often to poll the PRX for data when there's nothing
+     * to send, or TIME_INFINITE if the PRX never sends any
+     */
+    inline void ptx(const uint8_t *address, sysinterval_t poll = DUPLEX_POLL_INTERVAL) {
         mode = Mode::PTX_ONLY;
         writeAddress = address;
+        pollInterval = poll;
     }
 
     inline void prx(uint8_t pipe, const uint8_t *address) {
@@ -200,17 +572,53 @@ public:
         readAddress = address;
     }
 
+    /**
+     * Be one of a pair of ADHOC peers, each sending whenever it has data.
+     * @param pipe the pipe to receive on, which must be 1: pipe 0 stays
+     * open on the peer's address for our acks
+     * @param readAddress our address
+     * @param writeAddress the peer's address
+     */
     inline void adhoc(uint8_t pipe, const uint8_t *readAddress, const uint8_t *writeAddress) {
-        mode = Mode::PRX_ONLY;
+        chDbgAssert(pipe == 1, "RF24Serial::adhoc - pipe 0 is for acks");
+        mode = Mode::ADHOC;
         readPipe = pipe;
-        readAddress = readAddress;
-        writeAddress = writeAddress;
+        this->readAddress = readAddress;
+        this->writeAddress = writeAddress;
+    }
+
+    /**
+     * Choose how urgent packets share the link with bulk ones. Call
+     * before start().
+     * @param weight how many urgent packets to send for each bulk one
+     * when both are waiting, or zero to always send urgent ones first
+     * @param bulkDepth how many bulk payloads may be loaded into the
+     * radio's FIFO at once, ahead of any urgent one. Less than
+     * TX_FIFO_DEPTH bounds the wait for an urgent packet, at some cost
+     * in bulk throughput.
+     */
+    inline void transmitPriority(uint8_t weight, uint8_t bulkDepth = TX_FIFO_DEPTH) {
+        chDbgAssert(bulkDepth > 0 && bulkDepth <= TX_FIFO_DEPTH, "RF24Serial::transmitPriority - depth");
+        transmit_weight = weight;
+        transmit_bulk_depth = bulkDepth;
+    }
+
+    /**
+     * Drop received data packets the peer sent twice, because our ack to
+     * the first was lost. Call before start(). The peer must be one that
+     * numbers its packets, as this version does.
+     */
+    inline void duplicateFilter(bool enable) {
+        receive_filter = enable;
     }
 
     void reset();
     void start();
     void stop();
     void main();
+    /**
+     * Call this from the radio's IRQ line interrupt.
+     */
     void irq();
     void eventMain();
     /**
@@ -248,22 +656,156 @@ public:
 
     msg_t put(uint8_t b);
     size_t write(const uint8_t *bp, size_t n);
+    /**
+     * Format straight into the transmit packets. The stream is only
+     * checked once, so each character costs little more than a store.
+     */
     void print(const char *fmt, ...);
     msg_t flush(void);
 
+    /**
+     * Take an empty packet from the pool, to be filled in place and then
+     * passed to commit(). This avoids copying the data through the stream.
+     * Waits for the radio thread to free a packet if need be.
+     * @param timeout how long to wait for a packet
+     * @param cls the class to send the packet in. Each class can have its
+     * own thread: urgent packets come from their own part of the pool.
+     * @return the packet, or NULL on timeout or if the stream isn't ready
+     */
+    packet_t acquire(sysinterval_t timeout = TIME_INFINITE, TransmitClass cls = TX_BULK);
+
+    /**
+     * Queue a packet obtained from acquire() for transmission, in the
+     * class it was acquired for. For a bulk packet, any data buffered by
+     * the stream methods is flushed first, so that the byte stream and
+     * the packets stay in order; an urgent packet goes ahead of both.
+     * The packet belongs to the radio after this call, unless it timed out.
+     * @param packet the packet, with length set to the number of bytes used
+     * @param timeout how long to wait for room in the transmit queue
+     * @return MSG_OK if the packet was queued, MSG_TIMEOUT if there was no
+     * room in time, and the caller still has the packet, or MSG_RESET
+     */
+    msg_t commit(packet_t packet, sysinterval_t timeout = TIME_INFINITE);
+
+    /**
+     * Get the next received packet, without copying it.
+     * If a packet has been partially read through the stream methods, the
+     * unread remainder is returned first. The packet must be handed back
+     * with release().
+     * @param timeout how long to wait for a packet
+     * @return the packet, or NULL on timeout or if the stream isn't ready
+     */
+    packet_t receive(sysinterval_t timeout = TIME_INFINITE);
+
+    /**
+     * Return a packet obtained from receive() or acquire() to the pool.
+     */
+    void release(packet_t packet);
+
+    /**
+     * Did @p packet come from receive(), rather than acquire()?
+     */
+    inline bool received(packet_t packet) {
+        return isReceivePacket(packet);
+    }
+
     inline BaseSequentialStream *stream() {
         return (BaseSequentialStream *)this;
     }
 
+    /**
+     * Broadcasts RX_EVENT when a packet is received into an empty queue,
+     * and TX_EVENT when one is sent from a queue that commit() found full,
+     * or frees the first packet for acquire(), as event flags, so that a
+     * thread can wait for the radio and something else at once. A
+     * listener has to take all it can each time it wakes up, as there's
+     * no more news until it has.
+     */
+    inline EventSource *events() {
+        return &eventSource;
+    }
+
+    /**
+     * The transmit half of stream(), to hand to a thread that only writes.
+     */
+    inline BaseSequentialStream *transmitStream() {
+        return (BaseSequentialStream *)&transmitDirection;
+    }
+
+    /**
+     * The receive half of stream(), to hand to a thread that only reads.
+     */
+    inline BaseSequentialStream *receiveStream() {
+        return (BaseSequentialStream *)&receiveDirection;
+    }
+
     struct {
         uint32_t tx = 0, rx = 0, irq = 0, rx_dr = 0, tx_ds = 0, max_rt = 0, rx_empty = 0, rx_fail = 0;
         uint32_t rx_pipe[8] = { 0,0,0,0,0,0,0,0 };
         uint32_t rx_wait = 0;
+        uint32_t tx_credit_wait = 0, tx_credit_poll = 0, rx_credit_only = 0;
+        uint32_t tx_channel_busy = 0, tx_backoff = 0;
+        uint32_t tx_urgent = 0, tx_bulk_capped = 0;
+        uint32_t rx_duplicate = 0;
+        uint32_t rx_stale = 0, resync = 0, reset_duplicate = 0;
         bool tx_full = false;
     } stats;
 
 };
 
+/**
+ * A byte stream over a pair of radios.
+ *
+ * @tparam POOL_COUNT the number of packets in the pool. Every queued packet
+ * comes from the pool, as do the packets being filled by the stream and
+ * read from it, so it must hold both queues plus two.
+ * @tparam TX_QUEUE_COUNT the number of packets waiting to be transmitted
+ * @tparam RX_QUEUE_COUNT the number of received packets waiting to be read
+ * @tparam STACK_SIZE the size of the radio thread's working area
+ * @tparam URGENT_COUNT the number of packets kept for urgent sends, which
+ * come out of the pool too
+ */
+template<size_t POOL_COUNT = 10, size_t TX_QUEUE_COUNT = 3, size_t RX_QUEUE_COUNT = 3, size_t STACK_SIZE = 256,
+         size_t URGENT_COUNT = 1>
+struct RF24Serial : public BaseRF24Serial {
+    static_assert(TX_QUEUE_COUNT > 0, "RF24Serial needs a transmit queue");
+    static_assert(RX_QUEUE_COUNT > 0, "RF24Serial needs a receive queue");
+    static_assert(URGENT_COUNT > 0, "RF24Serial needs an urgent packet");
+    static_assert(POOL_COUNT >= TX_QUEUE_COUNT + RX_QUEUE_COUNT + URGENT_COUNT + 2,
+                  "RF24Serial packet pool is smaller than the queues it feeds");
+    static_assert(STACK_SIZE >= 128, "RF24Serial radio thread stack is too small");
+
+private:
+    // The reader holds one receive packet while the radio thread can fill
+    // the receive queue. The writer gets the rest of the pool, bar the
+    // urgent packets, which can all be queued at once.
+    static constexpr size_t RX_PACKET_COUNT = RX_QUEUE_COUNT + 1;
+    static constexpr size_t TX_PACKET_COUNT = POOL_COUNT - RX_PACKET_COUNT - URGENT_COUNT;
+
+    // This is a blob of memory big enough to hold all the packets we could need
+    __attribute__((aligned(sizeof(void *))))
+    struct packet buffer[POOL_COUNT];
+    packet_t transmit_queue_slots[TX_QUEUE_COUNT + 1];
+    packet_t transmit_free_slots[TX_PACKET_COUNT + 1];
+    packet_t urgent_queue_slots[URGENT_COUNT + 1];
+    packet_t urgent_free_slots[URGENT_COUNT + 1];
+    packet_t receive_queue_slots[RX_QUEUE_COUNT + 1];
+    packet_t receive_free_slots[RX_PACKET_COUNT + 1];
+    THD_WORKING_AREA(wa, STACK_SIZE);
+
+public:
+    RF24Serial(Rf24ChibiosIo io) : BaseRF24Serial(io, {
+        buffer, POOL_COUNT, RX_PACKET_COUNT, URGENT_COUNT,
+        transmit_queue_slots, TX_QUEUE_COUNT + 1,
+        transmit_free_slots, TX_PACKET_COUNT + 1,
+        urgent_queue_slots, URGENT_COUNT + 1,
+        urgent_free_slots, URGENT_COUNT + 1,
+        receive_queue_slots, RX_QUEUE_COUNT + 1,
+        receive_free_slots, RX_PACKET_COUNT + 1,
+        wa, sizeof(wa)
+    }) {}
+};
+
 }
 }
 #endif // __CHIBIOS__
@@ -0,0 +1,119 @@
+
+#include "rf24-chibios-timing.h"
+
+#ifdef CHIBIOS
+
+#if PORT_SUPPORTS_RT == TRUE && defined(RF24_CPU_CLOCK)
+#define RF24_CYCLE_COUNTER
+static const uint32_t CYCLES_PER_US = RF24_CPU_CLOCK / 1000000;
+#endif
+
+// Every radio's begin() calls rf24TimingInit(), but the clock is shared
+static bool initialised = false;
+
+// Claim the init, so only the first caller does it
+static bool initClaim() {
+    chSysLock();
+    bool first = !initialised;
+    initialised = true;
+    chSysUnlock();
+    return first;
+}
+
+#ifdef RF24_CYCLE_COUNTER
+
+// The cycle counter wraps every few tens of seconds, so it's extended
+// into microseconds here, and a virtual timer makes sure that happens at
+// least once a second.
+static rtcnt_t lastCycles;
+static uint32_t cyclesLeft;
+static uint32_t microseconds;
+static virtual_timer_t keepAlive;
+
+static uint32_t microsI() {
+    rtcnt_t now = chSysGetRealtimeCounterX();
+    uint32_t cycles = (uint32_t)(now - lastCycles) + cyclesLeft;
+    lastCycles = now;
+    microseconds += cycles / CYCLES_PER_US;
+    cyclesLeft = cycles % CYCLES_PER_US;
+    return microseconds;
+}
+
+static void keepAliveCallback(void *arg) {
+    (void)arg;
+    chSysLockFromISR();
+    microsI();
+    chVTSetI(&keepAlive, TIME_MS2I(1000), keepAliveCallback, NULL);
+    chSysUnlockFromISR();
+}
+
+void rf24TimingInit() {
+    if(!initClaim()) {
+        return;
+    }
+    chSysLock();
+    lastCycles = chSysGetRealtimeCounterX();
+    chSysUnlock();
+    chVTObjectInit(&keepAlive);
+    chVTSet(&keepAlive, TIME_MS2I(1000), keepAliveCallback, NULL);
+}
+
+void rf24DelayMicroseconds(uint32_t usec) {
+    if(usec >= RF24_SLEEP_THRESHOLD_US) {
+        chThdSleepMicroseconds(usec);
+    } else {
+        chSysPolledDelayX(usec * CYCLES_PER_US);
+    }
+}
+
+uint32_t rf24Micros() {
+    chSysLock();
+    uint32_t result = microsI();
+    chSysUnlock();
+    return result;
+}
+
+#else
+
+// Without a cycle counter, busy-waits count loops, calibrated against the
+// system timer. Until then, assume a fast CPU, so delays are too long
+// rather than too short.
+static const uint32_t CALIBRATION_CHUNK = 100;
+static uint32_t loopsPerMs = 48000;
+
+static void __attribute__((noinline)) spin(uint32_t loops) {
+    while(loops-- > 0) {
+        __asm__ volatile("");
+    }
+}
+
+void rf24TimingInit() {
+    if(!initClaim()) {
+        return;
+    }
+    // Line up with a tick, then see how much spinning fits in 10ms
+    systime_t start = chVTGetSystemTimeX();
+    while(chVTGetSystemTimeX() == start) {}
+    start = chVTGetSystemTimeX();
+    uint32_t chunks = 0;
+    while(chVTTimeElapsedSinceX(start) < TIME_MS2I(10)) {
+        spin(CALIBRATION_CHUNK);
+        chunks++;
+    }
+    loopsPerMs = chunks * CALIBRATION_CHUNK / 10;
+}
+
+void rf24DelayMicroseconds(uint32_t usec) {
+    if(usec >= RF24_SLEEP_THRESHOLD_US) {
+        chThdSleepMicroseconds(usec);
+    } else {
+        spin((usec * loopsPerMs + 999) / 1000);
+    }
+}
+
+uint32_t rf24Micros() {
+    return TIME_I2US(chVTGetSystemTimeX());
+}
+
+#endif
+#endif
@@ -0,0 +1,50 @@
+
+/**
+ * @file rf24-chibios-timing.h
+ * Delays and clocks for the Chibios port
+ */
+#ifndef _RF24_CHIBIOS_TIMING_H_
+#define _RF24_CHIBIOS_TIMING_H_
+
+#ifdef CHIBIOS
+#include <stdint.h>
+#include "ch.h"
+#include "hal.h"
+
+/**
+ * The CPU clock, for turning microseconds into cycles. Define it if the
+ * HAL doesn't.
+ */
+#if !defined(RF24_CPU_CLOCK) && defined(STM32_HCLK)
+#define RF24_CPU_CLOCK STM32_HCLK
+#endif
+
+/**
+ * Delays this long or longer sleep. Shorter ones busy-wait, because a
+ * sleep rounds up to the next system tick, which would turn a 130us
+ * turnaround into a whole millisecond on a 1kHz tick.
+ */
+#ifndef RF24_SLEEP_THRESHOLD_US
+#define RF24_SLEEP_THRESHOLD_US (2000000 / CH_CFG_ST_FREQUENCY)
+#endif
+
+/**
+ * Calibrate the busy-wait, and start the microsecond clock. The IO calls
+ * this from begin(). The first call takes about 10ms, and must be made
+ * from a thread; later ones return straight away.
+ */
+void rf24TimingInit();
+
+/**
+ * Wait for at least @p usec microseconds.
+ */
+void rf24DelayMicroseconds(uint32_t usec);
+
+/**
+ * A monotonic microsecond clock, which wraps like the Arduino one.
+ * Without a cycle counter (on Cortex-M0, say) it only moves once a tick.
+ */
+uint32_t rf24Micros();
+
+#endif
+#endif // _RF24_CHIBIOS_TIMING_H_
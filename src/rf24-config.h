@@ -14,6 +14,8 @@
 #define rf24_min(a,b) (a<b?a:b)
 
 #include "rf24-chibios-config.h"
+#include "rf24-linux-config.h"
+#include "rf24-model-config.h"
 #include "rf24-arduino-config.h"
 
 #ifndef RF24_250KBPS_TX_RX_DELAY
@@ -0,0 +1,231 @@
+
+#include "rf24-linux-client.h"
+
+#ifdef RF24_LINUX
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+Rf24dClient::Rf24dClient()
+    : controlFd(-1), daemonEvent(-1), clientEvent(-1), region(NULL), radioCount(0) {
+}
+
+Rf24dClient::~Rf24dClient() {
+    end();
+}
+
+bool Rf24dClient::begin(const char *path) {
+    if(controlFd >= 0) {
+        return true;
+    }
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(address.sun_path)) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    strcpy(address.sun_path, path);
+
+    controlFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if(controlFd < 0) {
+        return false;
+    }
+    if(connect(controlFd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        goto fail;
+    }
+
+    {
+        Rf24dRequest attach;
+        memset(&attach, 0, sizeof(attach));
+        attach.command = RF24D_ATTACH;
+        if(::send(controlFd, &attach, sizeof(attach), 0) != sizeof(attach)) {
+            goto fail;
+        }
+
+        // The reply carries the descriptors
+        Rf24dReply reply;
+        int fds[3];
+        char control[CMSG_SPACE(sizeof(fds))];
+        struct iovec iov = { &reply, sizeof(reply) };
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        if(recvmsg(controlFd, &message, MSG_CMSG_CLOEXEC) != sizeof(reply)) {
+            goto fail;
+        }
+        if(reply.error != 0) {
+            errno = reply.error;
+            goto fail;
+        }
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+        if(cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+            errno = EPROTO;
+            goto fail;
+        }
+        memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+        daemonEvent = fds[1];
+        clientEvent = fds[2];
+        void *shared = mmap(NULL, sizeof(Rf24dRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+        close(fds[0]);
+        if(shared == MAP_FAILED) {
+            goto fail;
+        }
+        region = (Rf24dRegion *)shared;
+        if(region->magic != RF24D_MAGIC || region->version != RF24D_VERSION) {
+            errno = EPROTO;
+            goto fail;
+        }
+        radioCount = reply.radios;
+    }
+    return true;
+
+fail:
+    int error = errno;
+    end();
+    errno = error;
+    return false;
+}
+
+void Rf24dClient::end() {
+    if(region != NULL) {
+        munmap(region, sizeof(Rf24dRegion));
+        region = NULL;
+    }
+    if(daemonEvent >= 0) {
+        close(daemonEvent);
+        daemonEvent = -1;
+    }
+    if(clientEvent >= 0) {
+        close(clientEvent);
+        clientEvent = -1;
+    }
+    if(controlFd >= 0) {
+        close(controlFd);
+        controlFd = -1;
+    }
+    radioCount = 0;
+}
+
+void Rf24dClient::wakeDaemon() {
+    uint64_t one = 1;
+    // EAGAIN: the counter is full, so a wakeup is pending anyway. Otherwise
+    // the daemon only sees the ring move when something else wakes it.
+    if(write(daemonEvent, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        perror("rf24d client: wake daemon");
+    }
+}
+
+bool Rf24dClient::sleep(int timeoutMs) {
+    struct pollfd wait = { clientEvent, POLLIN, 0 };
+    int ready;
+    do {
+        ready = poll(&wait, 1, timeoutMs);
+    } while(ready < 0 && errno == EINTR);
+    if(ready <= 0) {
+        return false;
+    }
+    uint64_t count;
+    // EAGAIN: a reader of fd() took the wakeup after poll() saw it
+    return read(clientEvent, &count, sizeof(count)) == sizeof(count) || errno == EAGAIN;
+}
+
+bool Rf24dClient::send(const Rf24dPacket &packet, int timeoutMs) {
+    Rf24dRing &ring = region->transmit;
+    while(!ring.put(packet)) {
+        if(ring.armProducer() && (timeoutMs == 0 || !sleep(timeoutMs))) {
+            return false;
+        }
+    }
+    if(ring.wakeConsumer()) {
+        wakeDaemon();
+    }
+    return true;
+}
+
+bool Rf24dClient::receive(Rf24dPacket &packet, int timeoutMs) {
+    Rf24dRing &ring = region->receive;
+    while(!ring.get(packet)) {
+        if(ring.armConsumer()) {
+            if(timeoutMs == 0) {
+                // Leave it armed, so fd() goes readable when one comes
+                return false;
+            }
+            if(!sleep(timeoutMs)) {
+                return false;
+            }
+        }
+    }
+    // The daemon drops rather than waits, but keep to the protocol
+    if(ring.wakeProducer()) {
+        wakeDaemon();
+    }
+    return true;
+}
+
+uint32_t Rf24dClient::receiveDropped() const {
+    return region->receiveDropped.load();
+}
+
+bool Rf24dClient::request(const Rf24dRequest &request, Rf24dReply &reply) {
+    if(::send(controlFd, &request, sizeof(request), 0) != sizeof(request)) {
+        return false;
+    }
+    ssize_t length;
+    do {
+        length = recv(controlFd, &reply, sizeof(reply), 0);
+    } while(length < 0 && errno == EINTR);
+    if(length != sizeof(reply)) {
+        if(length >= 0) {
+            errno = EPROTO;
+        }
+        return false;
+    }
+    if(reply.error != 0) {
+        errno = reply.error;
+        return false;
+    }
+    return true;
+}
+
+bool Rf24dClient::subscribe(uint8_t radio, uint8_t pipeMask) {
+    Rf24dRequest command = { RF24D_SUBSCRIBE, radio, 0, pipeMask, { 0 } };
+    Rf24dReply reply;
+    return request(command, reply);
+}
+
+bool Rf24dClient::openReadingPipe(uint8_t radio, uint8_t pipe, const uint8_t address[5]) {
+    Rf24dRequest command = { RF24D_OPEN_READING, radio, pipe, 0, { 0 } };
+    memcpy(command.address, address, sizeof(command.address));
+    Rf24dReply reply;
+    return request(command, reply);
+}
+
+bool Rf24dClient::channel(uint8_t radio, uint8_t channel) {
+    Rf24dRequest command = { RF24D_CHANNEL, radio, 0, channel, { 0 } };
+    Rf24dReply reply;
+    return request(command, reply);
+}
+
+bool Rf24dClient::stats(uint8_t radio, Rf24dStats &stats) {
+    Rf24dRequest command = { RF24D_STATS, radio, 0, 0, { 0 } };
+    Rf24dReply reply;
+    if(!request(command, reply)) {
+        return false;
+    }
+    stats = reply.stats;
+    return true;
+}
+
+#endif // RF24_LINUX
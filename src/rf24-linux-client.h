@@ -0,0 +1,96 @@
+
+/**
+ * @file rf24-linux-client.h
+ * Using a radio that rf24d owns
+ */
+#ifndef _RF24_LINUX_CLIENT_H_
+#define _RF24_LINUX_CLIENT_H_
+
+#ifdef RF24_LINUX
+
+#include <stdint.h>
+#include "rf24-linux-shm.h"
+
+/**
+ * One process's connection to rf24d. Payloads go through the shared
+ * rings without any system calls, except to wake the daemon up, or to
+ * sleep until it wakes us. The control socket is only for configuration.
+ *
+ * Like the rings, a client is for one thread.
+ */
+class Rf24dClient {
+public:
+    Rf24dClient();
+    ~Rf24dClient();
+
+    /**
+     * Connect to the daemon and map the rings it makes for us.
+     * @return false, with errno set, if it can't
+     */
+    bool begin(const char *path = RF24D_SOCKET);
+
+    void end();
+
+    /**
+     * How many radios the daemon has.
+     */
+    inline uint8_t radios() const {
+        return radioCount;
+    }
+
+    /**
+     * Queue a payload for the daemon to send, to the address in it. The
+     * daemon moves the radio's writing pipe there, and pipe 0 with it for
+     * the acks, once what it has queued for other addresses has gone.
+     * @param timeoutMs how long to wait for space, or -1 for ever
+     * @return false if there was no space in time
+     */
+    bool send(const Rf24dPacket &packet, int timeoutMs = -1);
+
+    /**
+     * Take the next payload received on a subscribed pipe.
+     * @param timeoutMs how long to wait for one, or -1 for ever
+     * @return false if none came in time
+     */
+    bool receive(Rf24dPacket &packet, int timeoutMs = -1);
+
+    /**
+     * A descriptor that becomes readable when the daemon wakes us, for
+     * callers with their own poll or epoll loop. Call receive() with a 0
+     * timeout when it does; that also consumes the wakeup.
+     */
+    inline int fd() const {
+        return clientEvent;
+    }
+
+    /**
+     * The request functions return false, with errno set, if the daemon
+     * refused or couldn't be asked.
+     */
+    bool subscribe(uint8_t radio, uint8_t pipeMask);
+    bool openReadingPipe(uint8_t radio, uint8_t pipe, const uint8_t address[5]);
+    bool channel(uint8_t radio, uint8_t channel);
+    bool stats(uint8_t radio, Rf24dStats &stats);
+
+    /**
+     * Payloads the daemon dropped because we didn't keep up.
+     */
+    uint32_t receiveDropped() const;
+
+private:
+    int controlFd;
+    int daemonEvent;
+    int clientEvent;
+    Rf24dRegion *region;
+    uint8_t radioCount;
+
+    bool request(const Rf24dRequest &request, Rf24dReply &reply);
+    void wakeDaemon();
+    bool sleep(int timeoutMs);
+
+    Rf24dClient(const Rf24dClient &) = delete;
+    Rf24dClient &operator=(const Rf24dClient &) = delete;
+};
+
+#endif // RF24_LINUX
+#endif // _RF24_LINUX_CLIENT_H_
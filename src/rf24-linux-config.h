@@ -0,0 +1,65 @@
+
+/*
+ Copyright (C) 2011 J. Coliz <maniacbug@ymail.com>
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+
+ */
+
+#ifndef __RF24_LINUX_CONFIG_H__
+#define __RF24_LINUX_CONFIG_H__
+
+#ifdef RF24_LINUX
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "rf24-linux-io.h"
+#include "rf24-linux-timing.h"
+
+constexpr uint8_t _BV(uint8_t bit) {
+    return (1<<bit);
+}
+
+#undef SERIAL_DEBUG
+#ifdef SERIAL_DEBUG
+#define IF_SERIAL_DEBUG(x) ({x;})
+#else
+#define IF_SERIAL_DEBUG(x)
+#endif
+
+typedef uint16_t prog_uint16_t;
+#define PSTR(x) (x)
+#define strlen_P strlen
+#define PROGMEM
+#define pgm_read_word(p) (*(p))
+#define PRIPSTR "%s"
+#define printf_P printf
+
+static inline uint8_t pgm_read_byte(const uint8_t *p) {
+    return *p;
+}
+
+static inline void delay(uint32_t milisec) {
+    rf24DelayMicroseconds(milisec * 1000);
+}
+
+static inline void delayMicroseconds(uint32_t usec) {
+    rf24DelayMicroseconds(usec);
+}
+
+static inline uint32_t millis() {
+    return rf24Millis();
+}
+
+static inline uint32_t micros() {
+    return rf24Micros();
+}
+
+#define LOW 0
+#define HIGH 1
+
+#endif // RF24_LINUX
+#endif // __RF24_LINUX_CONFIG_H__
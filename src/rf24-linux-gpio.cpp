@@ -0,0 +1,283 @@
+
+#include "rf24-linux-gpio.h"
+
+#ifdef RF24_LINUX
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <linux/gpio.h>
+
+static const char CONSUMER[] = "rf24";
+
+Rf24LinuxGpio::Rf24LinuxGpio(const char *chip, unsigned line, int sysfsPin)
+    : chip(chip), line(line), sysfsPin(sysfsPin), handleFd(-1), valueFd(-1) {
+}
+
+Rf24LinuxGpio::Rf24LinuxGpio(unsigned sysfsPin)
+    : chip(NULL), line(0), sysfsPin(sysfsPin), handleFd(-1), valueFd(-1) {
+}
+
+Rf24LinuxGpio::~Rf24LinuxGpio() {
+    end();
+}
+
+bool Rf24LinuxGpio::begin() {
+    if(handleFd >= 0 || valueFd >= 0) {
+        return true;
+    }
+
+    if(chip != NULL) {
+        if(beginChardev()) {
+            return true;
+        }
+        if(sysfsPin < 0) {
+            return false;
+        }
+    }
+    return beginSysfs();
+}
+
+bool Rf24LinuxGpio::beginChardev() {
+    int chipFd = open(chip, O_RDONLY | O_CLOEXEC);
+    if(chipFd < 0) {
+        return false;
+    }
+
+    struct gpiohandle_request request;
+    memset(&request, 0, sizeof(request));
+    request.lineoffsets[0] = line;
+    request.lines = 1;
+    request.flags = GPIOHANDLE_REQUEST_OUTPUT;
+    request.default_values[0] = 0;
+    strncpy(request.consumer_label, CONSUMER, sizeof(request.consumer_label) - 1);
+
+    // The handle stays valid once the chip is closed
+    int result = ioctl(chipFd, GPIO_GET_LINEHANDLE_IOCTL, &request);
+    int error = errno;
+    close(chipFd);
+    if(result < 0) {
+        errno = error;
+        return false;
+    }
+
+    handleFd = request.fd;
+    return true;
+}
+
+static bool writeFile(const char *path, const char *value) {
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return false;
+    }
+    ssize_t written = write(fd, value, strlen(value));
+    int error = errno;
+    close(fd);
+    errno = error;
+    return written == (ssize_t)strlen(value);
+}
+
+bool Rf24LinuxGpio::beginSysfs() {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/class/gpio/gpio%d/value", sysfsPin);
+    if(access(path, F_OK) != 0) {
+        char number[16];
+        snprintf(number, sizeof(number), "%d", sysfsPin);
+        if(!writeFile("/sys/class/gpio/export", number)) {
+            return false;
+        }
+    }
+
+    char direction[64];
+    snprintf(direction, sizeof(direction), "/sys/class/gpio/gpio%d/direction", sysfsPin);
+    if(!writeFile(direction, "low")) {
+        return false;
+    }
+
+    valueFd = open(path, O_WRONLY | O_CLOEXEC);
+    return valueFd >= 0;
+}
+
+void Rf24LinuxGpio::end() {
+    if(handleFd >= 0) {
+        close(handleFd);
+        handleFd = -1;
+    }
+    if(valueFd >= 0) {
+        close(valueFd);
+        valueFd = -1;
+    }
+}
+
+void Rf24LinuxGpio::write(bool level) {
+    if(handleFd >= 0) {
+        struct gpiohandle_data data;
+        memset(&data, 0, sizeof(data));
+        data.values[0] = level ? 1 : 0;
+        if(ioctl(handleFd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data) < 0) {
+            perror("can't set gpio line");
+            abort();
+        }
+        return;
+    }
+
+    // The value file takes a write at any offset, so no seek is needed
+    if(::write(valueFd, level ? "1" : "0", 1) != 1) {
+        perror("can't set gpio");
+        abort();
+    }
+}
+
+Rf24LinuxIrq::Rf24LinuxIrq(const char *chip, unsigned line, int sysfsPin)
+    : chip(chip), line(line), sysfsPin(sysfsPin), eventFd(-1), sysfs(false) {
+}
+
+Rf24LinuxIrq::Rf24LinuxIrq(unsigned sysfsPin)
+    : chip(NULL), line(0), sysfsPin(sysfsPin), eventFd(-1), sysfs(false) {
+}
+
+Rf24LinuxIrq::~Rf24LinuxIrq() {
+    end();
+}
+
+bool Rf24LinuxIrq::begin() {
+    if(eventFd >= 0) {
+        return true;
+    }
+
+    if(chip != NULL) {
+        if(beginChardev()) {
+            return true;
+        }
+        if(sysfsPin < 0) {
+            return false;
+        }
+    }
+    return beginSysfs();
+}
+
+bool Rf24LinuxIrq::beginChardev() {
+    int chipFd = open(chip, O_RDONLY | O_CLOEXEC);
+    if(chipFd < 0) {
+        return false;
+    }
+
+    struct gpioevent_request request;
+    memset(&request, 0, sizeof(request));
+    request.lineoffset = line;
+    request.handleflags = GPIOHANDLE_REQUEST_INPUT;
+    request.eventflags = GPIOEVENT_REQUEST_FALLING_EDGE;
+    strncpy(request.consumer_label, CONSUMER, sizeof(request.consumer_label) - 1);
+
+    int result = ioctl(chipFd, GPIO_GET_LINEEVENT_IOCTL, &request);
+    int error = errno;
+    close(chipFd);
+    if(result < 0) {
+        errno = error;
+        return false;
+    }
+
+    // Non-blocking, so acknowledge() can read until there's nothing left
+    fcntl(request.fd, F_SETFL, fcntl(request.fd, F_GETFL) | O_NONBLOCK);
+    eventFd = request.fd;
+    sysfs = false;
+    return true;
+}
+
+bool Rf24LinuxIrq::beginSysfs() {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/class/gpio/gpio%d/value", sysfsPin);
+    if(access(path, F_OK) != 0) {
+        char number[16];
+        snprintf(number, sizeof(number), "%d", sysfsPin);
+        if(!writeFile("/sys/class/gpio/export", number)) {
+            return false;
+        }
+    }
+
+    char attribute[64];
+    snprintf(attribute, sizeof(attribute), "/sys/class/gpio/gpio%d/direction", sysfsPin);
+    if(!writeFile(attribute, "in")) {
+        return false;
+    }
+    snprintf(attribute, sizeof(attribute), "/sys/class/gpio/gpio%d/edge", sysfsPin);
+    if(!writeFile(attribute, "falling")) {
+        return false;
+    }
+
+    eventFd = open(path, O_RDONLY | O_CLOEXEC);
+    sysfs = true;
+    return eventFd >= 0;
+}
+
+void Rf24LinuxIrq::end() {
+    if(eventFd >= 0) {
+        close(eventFd);
+        eventFd = -1;
+    }
+}
+
+uint32_t Rf24LinuxIrq::events() const {
+    return sysfs ? (EPOLLPRI | EPOLLERR) : EPOLLIN;
+}
+
+static uint64_t clockNanos(clockid_t clock) {
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (uint64_t)now.tv_sec * 1000000000U + now.tv_nsec;
+}
+
+uint64_t Rf24LinuxIrq::acknowledge() {
+    if(sysfs) {
+        // Reading the value from the start rearms the notification
+        char value[4];
+        if(pread(eventFd, value, sizeof(value), 0) < 0 && errno != EAGAIN) {
+            // The watchdog still finds the radio, if not the next edge
+            perror("can't rearm gpio edge");
+        }
+        return 0;
+    }
+
+    struct gpioevent_data event;
+    uint64_t first = 0;
+    while(read(eventFd, &event, sizeof(event)) == sizeof(event)) {
+        if(first == 0) {
+            first = event.timestamp;
+        }
+    }
+    if(first == 0) {
+        return 0;
+    }
+
+    // Kernels before 5.7 stamp events with the wall clock
+    uint64_t monotonic = clockNanos(CLOCK_MONOTONIC);
+    if(first > monotonic) {
+        first = first - clockNanos(CLOCK_REALTIME) + monotonic;
+    }
+    return first;
+}
+
+bool Rf24LinuxIrq::low() {
+    if(sysfs) {
+        char value;
+        if(pread(eventFd, &value, 1, 0) != 1) {
+            return false;
+        }
+        return value == '0';
+    }
+
+    struct gpiohandle_data data;
+    memset(&data, 0, sizeof(data));
+    if(ioctl(eventFd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data) < 0) {
+        return false;
+    }
+    return data.values[0] == 0;
+}
+
+#endif // RF24_LINUX
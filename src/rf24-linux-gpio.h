@@ -0,0 +1,138 @@
+
+#ifndef _RF24_LINUX_GPIO_H_
+#define _RF24_LINUX_GPIO_H_
+
+#ifdef RF24_LINUX
+
+#include <stdint.h>
+
+/**
+ * A GPIO output, such as CE.
+ *
+ * Given a chip, it asks the GPIO character device for a line handle, and
+ * sets the line with one ioctl. Otherwise, or if the kernel has no
+ * character device, it falls back to sysfs, keeping the value file open so
+ * that each write is a single write(). Either way, nothing is opened or
+ * formatted after begin().
+ */
+class Rf24LinuxGpio {
+public:
+    /**
+     * A line on a GPIO chip.
+     * @param chip the chip's device, e.g. "/dev/gpiochip0"
+     * @param line the line's offset on the chip
+     * @param sysfsPin the same pin's sysfs number, to fall back on, or -1
+     */
+    Rf24LinuxGpio(const char *chip, unsigned line, int sysfsPin = -1);
+
+    /**
+     * A pin through sysfs only.
+     */
+    Rf24LinuxGpio(unsigned sysfsPin);
+
+    ~Rf24LinuxGpio();
+
+    /**
+     * Claim the line as an output, driven low.
+     * @return false, with errno set, if neither way works
+     */
+    bool begin();
+
+    void end();
+
+    void write(bool level);
+
+    /**
+     * Whether begin() got a character device line handle.
+     */
+    inline bool chardev() const {
+        return handleFd >= 0;
+    }
+
+private:
+    const char * const chip;
+    const unsigned line;
+    const int sysfsPin;
+    int handleFd;
+    int valueFd;
+
+    bool beginChardev();
+    bool beginSysfs();
+
+    Rf24LinuxGpio(const Rf24LinuxGpio &) = delete;
+    Rf24LinuxGpio &operator=(const Rf24LinuxGpio &) = delete;
+};
+
+/**
+ * The radio's IRQ line, as a file descriptor that becomes ready on each
+ * falling edge, to wait on with poll or epoll.
+ *
+ * Like Rf24LinuxGpio, it uses the GPIO character device's line events if
+ * it can, and sysfs edge notification otherwise.
+ */
+class Rf24LinuxIrq {
+public:
+    /**
+     * @param chip the chip's device, e.g. "/dev/gpiochip0"
+     * @param line the line's offset on the chip
+     * @param sysfsPin the same pin's sysfs number, to fall back on, or -1
+     */
+    Rf24LinuxIrq(const char *chip, unsigned line, int sysfsPin = -1);
+
+    /**
+     * A pin through sysfs only.
+     */
+    Rf24LinuxIrq(unsigned sysfsPin);
+
+    ~Rf24LinuxIrq();
+
+    /**
+     * Claim the line as an input, with falling edge events.
+     * @return false, with errno set, if neither way works
+     */
+    bool begin();
+
+    void end();
+
+    /**
+     * The descriptor to wait on.
+     */
+    inline int fd() const {
+        return eventFd;
+    }
+
+    /**
+     * The epoll events that mean an edge: sysfs signals them as priority
+     * data.
+     */
+    uint32_t events() const;
+
+    /**
+     * Consume the edges seen so far, so that the descriptor only becomes
+     * ready again on the next one. Call this before dealing with the radio.
+     * @return when the first of them happened, in CLOCK_MONOTONIC
+     * nanoseconds, or 0 if the kernel didn't say, as sysfs doesn't
+     */
+    uint64_t acknowledge();
+
+    /**
+     * Is the line low, i.e. is the radio still asking for attention?
+     */
+    bool low();
+
+private:
+    const char * const chip;
+    const unsigned line;
+    const int sysfsPin;
+    int eventFd;
+    bool sysfs;
+
+    bool beginChardev();
+    bool beginSysfs();
+
+    Rf24LinuxIrq(const Rf24LinuxIrq &) = delete;
+    Rf24LinuxIrq &operator=(const Rf24LinuxIrq &) = delete;
+};
+
+#endif // RF24_LINUX
+#endif // _RF24_LINUX_GPIO_H_
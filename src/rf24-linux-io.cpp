@@ -0,0 +1,111 @@
+
+#include "rf24-linux-io.h"
+
+#ifdef RF24_LINUX
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+
+Rf24LinuxSpi::Rf24LinuxSpi(const char *device, uint32_t speed)
+    : device(device), speed(speed), deviceFd(-1) {
+}
+
+Rf24LinuxSpi::~Rf24LinuxSpi() {
+    end();
+}
+
+bool Rf24LinuxSpi::begin() {
+    if(deviceFd >= 0) {
+        return true;
+    }
+
+    int fd = open(device, O_RDWR | O_CLOEXEC);
+    if(fd < 0) {
+        return false;
+    }
+
+    uint8_t mode = SPI_MODE_0;
+    uint8_t bits = 8;
+    uint32_t hz = speed;
+    if(ioctl(fd, SPI_IOC_WR_MODE, &mode) < 0
+            || ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0
+            || ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &hz) < 0) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return false;
+    }
+
+    deviceFd = fd;
+    return true;
+}
+
+void Rf24LinuxSpi::end() {
+    if(deviceFd >= 0) {
+        close(deviceFd);
+        deviceFd = -1;
+    }
+}
+
+bool Rf24LinuxSpi::exchange(const uint8_t *tx, uint8_t *rx, uint32_t len) {
+    struct spi_ioc_transfer transfer;
+    memset(&transfer, 0, sizeof(transfer));
+    transfer.tx_buf = (unsigned long)tx;
+    transfer.rx_buf = (unsigned long)rx;
+    transfer.len = len;
+    transfer.speed_hz = speed;
+    transfer.bits_per_word = 8;
+    return ioctl(deviceFd, SPI_IOC_MESSAGE(1), &transfer) >= 0;
+}
+
+Rf24LinuxIo::Rf24LinuxIo(Rf24LinuxSpi *spi, Rf24LinuxGpio *ce) : spi(spi), cePin(ce) {
+}
+
+void Rf24LinuxIo::begin() {
+    if(!spi->begin()) {
+        perror("can't open spi device");
+        abort();
+    }
+    if(!cePin->begin()) {
+        perror("can't open ce gpio");
+        abort();
+    }
+}
+
+uint8_t Rf24LinuxIo::transaction(uint8_t cmd, const uint8_t *tx, uint8_t *rx, uint8_t len) {
+    constexpr uint8_t maxlen = 32;
+    uint8_t txbuf[maxlen + 1];
+    uint8_t rxbuf[maxlen + 1];
+
+    if(len > maxlen) {
+        len = maxlen;
+    }
+    txbuf[0] = cmd;
+    if(tx != NULL) {
+        memcpy(&txbuf[1], tx, len);
+    } else {
+        memset(&txbuf[1], 0xff, len);
+    }
+
+    if(!spi->exchange(txbuf, rxbuf, len + 1)) {
+        perror("can't send spi message");
+        abort();
+    }
+
+    if(rx != NULL) {
+        memcpy(rx, &rxbuf[1], len);
+    }
+    return rxbuf[0];
+}
+
+void Rf24LinuxIo::ce(bool level) {
+    cePin->write(level);
+}
+
+#endif // RF24_LINUX
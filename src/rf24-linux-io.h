@@ -0,0 +1,95 @@
+
+#ifndef _RF24_LINUX_IO_H_
+#define _RF24_LINUX_IO_H_
+
+#ifdef RF24_LINUX
+
+#include <stdint.h>
+#include "rf24-linux-gpio.h"
+
+/**
+ * The SPI clock, unless the Rf24LinuxSpi is given another. The nRF24L01+
+ * takes up to 10MHz.
+ */
+#ifndef RF24_LINUX_SPI_SPEED
+#define RF24_LINUX_SPI_SPEED 8000000
+#endif
+
+/**
+ * A spidev device, opened and configured once, and then used for whole
+ * transactions: each is a single SPI_IOC_MESSAGE, with the kernel
+ * driving CSN around it.
+ */
+class Rf24LinuxSpi {
+public:
+    /**
+     * @param device the spidev node, e.g. "/dev/spidev0.0"
+     * @param speed the SPI clock in Hz
+     */
+    Rf24LinuxSpi(const char *device, uint32_t speed = RF24_LINUX_SPI_SPEED);
+    ~Rf24LinuxSpi();
+
+    /**
+     * Open and configure the device, if it isn't already.
+     * @return false, with errno set, if it can't be
+     */
+    bool begin();
+
+    void end();
+
+    /**
+     * Clock @p len bytes out of @p tx and into @p rx, in one message.
+     * @return false, with errno set, if the transfer failed
+     */
+    bool exchange(const uint8_t *tx, uint8_t *rx, uint32_t len);
+
+    inline int fd() const {
+        return deviceFd;
+    }
+
+private:
+    const char * const device;
+    const uint32_t speed;
+    int deviceFd;
+
+    Rf24LinuxSpi(const Rf24LinuxSpi &) = delete;
+    Rf24LinuxSpi &operator=(const Rf24LinuxSpi &) = delete;
+};
+
+/**
+ * The RF24 IO for Linux. It's copied into the RF24, so it only refers to
+ * the Rf24LinuxSpi and Rf24LinuxGpio, which own the file descriptors.
+ */
+class Rf24LinuxIo {
+public:
+    Rf24LinuxIo(Rf24LinuxSpi *spi, Rf24LinuxGpio *ce);
+
+    Rf24LinuxIo(const Rf24LinuxIo &io) = default;
+
+    /**
+     * Open the SPI device and the CE pin. As in the other Linux utilities,
+     * there's nothing the radio can do without them, so failure aborts.
+     */
+    void begin();
+
+    /**
+     * Send a command and its data in one SPI message.
+     * @param tx the data to send, or NULL to send 0xff
+     * @param rx where to keep the data that comes back, or NULL
+     * @return the status byte
+     */
+    uint8_t transaction(uint8_t cmd, const uint8_t *tx, uint8_t *rx, uint8_t len);
+
+    /**
+     * Set the level of the CE pin
+     * @param level
+     */
+    void ce(bool level);
+
+private:
+    Rf24LinuxSpi *spi;
+    Rf24LinuxGpio *cePin;
+};
+
+#endif // RF24_LINUX
+#endif // _RF24_LINUX_IO_H_
@@ -0,0 +1,183 @@
+
+#include "rf24-linux-loop.h"
+
+#ifdef RF24_LINUX
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+static const int MAX_EVENTS = 8;
+
+Rf24LinuxLoop::Rf24LinuxLoop() : epollFd(-1), wakeFd(-1), stopping(false) {
+    wakeWatch.handler = wakeEvent;
+    wakeWatch.arg = this;
+}
+
+Rf24LinuxLoop::~Rf24LinuxLoop() {
+    end();
+}
+
+bool Rf24LinuxLoop::begin() {
+    if(epollFd >= 0) {
+        return true;
+    }
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if(epollFd < 0) {
+        return false;
+    }
+
+    wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(wakeFd < 0 || !add(wakeFd, EPOLLIN, &wakeWatch)) {
+        int error = errno;
+        end();
+        errno = error;
+        return false;
+    }
+    return true;
+}
+
+void Rf24LinuxLoop::end() {
+    if(wakeFd >= 0) {
+        close(wakeFd);
+        wakeFd = -1;
+    }
+    if(epollFd >= 0) {
+        close(epollFd);
+        epollFd = -1;
+    }
+}
+
+bool Rf24LinuxLoop::add(int fd, uint32_t events, Rf24LinuxWatch *watch) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.ptr = watch;
+    return epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+bool Rf24LinuxLoop::remove(int fd) {
+    // Events already fetched for it in this batch still get dispatched, so
+    // a handler that removes another descriptor must leave its watch valid
+    // until runOnce() returns
+    return epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL) == 0;
+}
+
+int Rf24LinuxLoop::runOnce(int timeoutMs) {
+    struct epoll_event events[MAX_EVENTS];
+    int count = epoll_wait(epollFd, events, MAX_EVENTS, timeoutMs);
+    if(count < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+
+    for(int i = 0; i < count; i++) {
+        Rf24LinuxWatch *watch = (Rf24LinuxWatch *)events[i].data.ptr;
+        watch->handler(watch->arg, events[i].events);
+    }
+    return count;
+}
+
+bool Rf24LinuxLoop::run() {
+    // A stop() from another thread before we get here still counts
+    while(!stopping) {
+        if(runOnce() < 0) {
+            stopping = false;
+            return false;
+        }
+    }
+    stopping = false;
+    return true;
+}
+
+bool Rf24LinuxLoop::stop() {
+    // Only async-signal-safe calls here
+    stopping = true;
+    uint64_t one = 1;
+    // EAGAIN: the counter is full, so a wakeup is pending anyway
+    return write(wakeFd, &one, sizeof(one)) == sizeof(one) || errno == EAGAIN;
+}
+
+void Rf24LinuxLoop::wakeEvent(void *arg, uint32_t events) {
+    (void)events;
+    Rf24LinuxLoop *loop = (Rf24LinuxLoop *)arg;
+    uint64_t count;
+    // EAGAIN: another wakeup already took it
+    if(read(loop->wakeFd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        perror("can't read loop wakeup");
+    }
+}
+
+Rf24LinuxTimer::Rf24LinuxTimer(Rf24LinuxHandler handler, void *arg)
+    : handler(handler), arg(arg), loop(NULL), timerFd(-1) {
+    watch.handler = timerEvent;
+    watch.arg = this;
+}
+
+Rf24LinuxTimer::~Rf24LinuxTimer() {
+    end();
+}
+
+bool Rf24LinuxTimer::begin(Rf24LinuxLoop &loop) {
+    if(timerFd >= 0) {
+        return true;
+    }
+
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if(timerFd < 0) {
+        return false;
+    }
+    if(!loop.add(timerFd, EPOLLIN, &watch)) {
+        int error = errno;
+        close(timerFd);
+        timerFd = -1;
+        errno = error;
+        return false;
+    }
+    this->loop = &loop;
+    return true;
+}
+
+void Rf24LinuxTimer::end() {
+    if(timerFd >= 0) {
+        loop->remove(timerFd);
+        close(timerFd);
+        timerFd = -1;
+        loop = NULL;
+    }
+}
+
+static void toTimespec(uint32_t usec, struct timespec *ts) {
+    ts->tv_sec = usec / 1000000U;
+    ts->tv_nsec = (usec % 1000000U) * 1000;
+}
+
+void Rf24LinuxTimer::start(uint32_t usec, uint32_t periodUsec) {
+    struct itimerspec spec;
+    // A zero value would disarm it
+    toTimespec(usec > 0 ? usec : 1, &spec.it_value);
+    toTimespec(periodUsec, &spec.it_interval);
+    timerfd_settime(timerFd, 0, &spec, NULL);
+}
+
+void Rf24LinuxTimer::cancel() {
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    timerfd_settime(timerFd, 0, &spec, NULL);
+}
+
+void Rf24LinuxTimer::timerEvent(void *arg, uint32_t events) {
+    (void)events;
+    Rf24LinuxTimer *timer = (Rf24LinuxTimer *)arg;
+    uint64_t expirations;
+    // Nothing to read means it was cancelled or rearmed after it fired
+    if(read(timer->timerFd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+        timer->handler(timer->arg, events);
+    }
+}
+
+#endif // RF24_LINUX
@@ -0,0 +1,133 @@
+
+/**
+ * @file rf24-linux-loop.h
+ * An epoll event loop, and timers for it, for driving the radio from its
+ * IRQ line on Linux
+ */
+#ifndef _RF24_LINUX_LOOP_H_
+#define _RF24_LINUX_LOOP_H_
+
+#ifdef RF24_LINUX
+
+#include <stdint.h>
+
+/**
+ * Called by the loop when a descriptor is ready
+ * @param arg as given to Rf24LinuxWatch
+ * @param events the epoll events that happened
+ */
+typedef void (*Rf24LinuxHandler)(void *arg, uint32_t events);
+
+/**
+ * A descriptor being waited on, and what to do when it's ready. The loop
+ * keeps a pointer to it, so it has to outlive its registration.
+ */
+struct Rf24LinuxWatch {
+    Rf24LinuxHandler handler;
+    void *arg;
+};
+
+/**
+ * A single-threaded epoll loop. Everything it calls runs on the thread
+ * that runs it, so handlers can use the radio without locking.
+ */
+class Rf24LinuxLoop {
+public:
+    Rf24LinuxLoop();
+    ~Rf24LinuxLoop();
+
+    /**
+     * Create the epoll instance.
+     * @return false, with errno set, if it can't be
+     */
+    bool begin();
+
+    void end();
+
+    /**
+     * Start waiting on @p fd for @p events.
+     * @return false, with errno set, if epoll refuses it
+     */
+    bool add(int fd, uint32_t events, Rf24LinuxWatch *watch);
+
+    /**
+     * Stop waiting on @p fd. Safe from a handler, including the
+     * descriptor's own.
+     */
+    bool remove(int fd);
+
+    /**
+     * Wait for, and dispatch, one batch of events.
+     * @param timeoutMs how long to wait, or -1 for ever
+     * @return the number dispatched, or -1, with errno set, on an error
+     * other than an interrupted wait
+     */
+    int runOnce(int timeoutMs = -1);
+
+    /**
+     * Dispatch events until stop().
+     * @return false, with errno set, if waiting failed
+     */
+    bool run();
+
+    /**
+     * Make run() return, or, if it isn't running yet, the next run()
+     * return at once. Safe from a handler, another thread or a signal
+     * handler.
+     * @return false, with errno set, if a waiting run() couldn't be woken:
+     * it then returns after the next event it dispatches
+     */
+    bool stop();
+
+private:
+    int epollFd;
+    int wakeFd;
+    volatile bool stopping;
+    Rf24LinuxWatch wakeWatch;
+
+    static void wakeEvent(void *arg, uint32_t events);
+
+    Rf24LinuxLoop(const Rf24LinuxLoop &) = delete;
+    Rf24LinuxLoop &operator=(const Rf24LinuxLoop &) = delete;
+};
+
+/**
+ * A timerfd on a loop, calling its handler once per expiry, or once for
+ * several if the loop fell behind.
+ */
+class Rf24LinuxTimer {
+public:
+    Rf24LinuxTimer(Rf24LinuxHandler handler, void *arg);
+    ~Rf24LinuxTimer();
+
+    /**
+     * Create the timer, disarmed, and add it to @p loop.
+     * @return false, with errno set, if it can't be
+     */
+    bool begin(Rf24LinuxLoop &loop);
+
+    void end();
+
+    /**
+     * Fire after @p usec microseconds, then every @p periodUsec if that
+     * isn't 0. Rearming an armed timer replaces its schedule.
+     */
+    void start(uint32_t usec, uint32_t periodUsec = 0);
+
+    void cancel();
+
+private:
+    Rf24LinuxWatch watch;
+    Rf24LinuxHandler handler;
+    void *arg;
+    Rf24LinuxLoop *loop;
+    int timerFd;
+
+    static void timerEvent(void *arg, uint32_t events);
+
+    Rf24LinuxTimer(const Rf24LinuxTimer &) = delete;
+    Rf24LinuxTimer &operator=(const Rf24LinuxTimer &) = delete;
+};
+
+#endif // RF24_LINUX
+#endif // _RF24_LINUX_LOOP_H_
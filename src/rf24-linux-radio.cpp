@@ -0,0 +1,176 @@
+
+#include "rf24-linux-radio.h"
+#include "rf24-linux-rt.h"
+
+#ifdef RF24_LINUX
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+// An IRQ line that stays low through this many passes is stuck, or wired
+// to something else: leave the rest to the watchdog
+static const int MAX_SERVICE_PASSES = 8;
+
+Rf24LinuxRadio::Rf24LinuxRadio(Rf24LinuxIo io, Rf24LinuxIrq *irq)
+    : radio(io), irq(irq), loop(NULL), watchdog(watchdogEvent, this), latency(NULL),
+      turnaround(false), transmitting(false),
+      receiveHandler(NULL), receiveArg(NULL), sentHandler(NULL), sentArg(NULL) {
+    memset(&stats, 0, sizeof(stats));
+    irqWatch.handler = irqEvent;
+    irqWatch.arg = this;
+}
+
+Rf24LinuxRadio::~Rf24LinuxRadio() {
+    stop();
+}
+
+void Rf24LinuxRadio::onReceive(ReceiveHandler handler, void *arg) {
+    receiveHandler = handler;
+    receiveArg = arg;
+}
+
+void Rf24LinuxRadio::onSent(SentHandler handler, void *arg) {
+    sentHandler = handler;
+    sentArg = arg;
+}
+
+void Rf24LinuxRadio::measure(Rf24LatencyHistogram *histogram) {
+    latency = histogram;
+}
+
+bool Rf24LinuxRadio::start(Rf24LinuxLoop &loop, uint32_t watchdogUs) {
+    if(!irq->begin() || !loop.add(irq->fd(), irq->events(), &irqWatch)) {
+        return false;
+    }
+    if(!watchdog.begin(loop)) {
+        int error = errno;
+        loop.remove(irq->fd());
+        errno = error;
+        return false;
+    }
+    this->loop = &loop;
+    watchdog.start(watchdogUs, watchdogUs);
+
+    // The line may have fallen before anyone was watching it
+    irq->acknowledge();
+    service();
+    return true;
+}
+
+void Rf24LinuxRadio::stop() {
+    if(loop != NULL) {
+        watchdog.end();
+        loop->remove(irq->fd());
+        loop = NULL;
+    }
+}
+
+void Rf24LinuxRadio::halfDuplex(bool enable) {
+    turnaround = enable;
+}
+
+bool Rf24LinuxRadio::send(const void *payload, uint8_t length, bool multicast) {
+    if(radio.fifoStatus().txFull()) {
+        return false;
+    }
+    if(turnaround && !transmitting) {
+        radio.turnaround(false);
+        transmitting = true;
+    }
+    radio.startFastWrite(payload, length, multicast);
+    stats.tx++;
+    return true;
+}
+
+void Rf24LinuxRadio::service() {
+    for(int pass = 0; pass < MAX_SERVICE_PASSES; pass++) {
+        serviceOnce();
+        if(!irq->low()) {
+            break;
+        }
+    }
+}
+
+bool Rf24LinuxRadio::serviceOnce() {
+    Status status = radio.status();
+    bool pending = status.dataReceived() || status.dataSent() || status.maxRetries()
+            || status.rxPipeNo() != RX_P_NO_EMPTY;
+    if(!pending) {
+        return false;
+    }
+
+    // Clear only what we're about to deal with, so anything raised from
+    // here on pulls the line low again
+    radio.resetStatus(status);
+
+    if(status.dataReceived() || status.rxPipeNo() != RX_P_NO_EMPTY) {
+        receiveAll();
+    }
+
+    if(status.dataSent()) {
+        stats.tx_ds++;
+        if(sentHandler != NULL) {
+            sentHandler(sentArg, true);
+        }
+    }
+
+    if(status.maxRetries()) {
+        stats.max_rt++;
+        // The failed payload would otherwise block the FIFO for good
+        radio.flush_tx();
+        if(sentHandler != NULL) {
+            sentHandler(sentArg, false);
+        }
+    }
+
+    // Back to listening once the handlers have nothing more to send
+    if(transmitting && (status.dataSent() || status.maxRetries()) && radio.fifoStatus().txEmpty()) {
+        radio.turnaround(true);
+        transmitting = false;
+    }
+    return true;
+}
+
+void Rf24LinuxRadio::receiveAll() {
+    uint8_t payload[PAYLOAD_SIZE];
+    Status status = radio.status();
+    while(status.rxPipeNo() != RX_P_NO_EMPTY) {
+        uint8_t pipe = status.rxPipeNo();
+        uint8_t length = radio.getDynamicPayloadSize();
+        if(length > PAYLOAD_SIZE) {
+            length = PAYLOAD_SIZE;
+        }
+        radio.readPayload(payload, length);
+        stats.rx++;
+        if(receiveHandler != NULL) {
+            receiveHandler(receiveArg, pipe, payload, length);
+        }
+        status = radio.status();
+    }
+}
+
+void Rf24LinuxRadio::irqEvent(void *arg, uint32_t events) {
+    (void)events;
+    Rf24LinuxRadio *radio = (Rf24LinuxRadio *)arg;
+    radio->stats.irq++;
+    uint64_t edge = radio->irq->acknowledge();
+    if(edge != 0 && radio->latency != NULL) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        uint64_t nanos = (uint64_t)now.tv_sec * 1000000000U + now.tv_nsec;
+        radio->latency->record(nanos > edge ? (nanos - edge) / 1000 : 0);
+    }
+    radio->service();
+}
+
+void Rf24LinuxRadio::watchdogEvent(void *arg, uint32_t events) {
+    (void)events;
+    Rf24LinuxRadio *radio = (Rf24LinuxRadio *)arg;
+    if(radio->serviceOnce()) {
+        radio->stats.watchdog++;
+        radio->service();
+    }
+}
+
+#endif // RF24_LINUX
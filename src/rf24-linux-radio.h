@@ -0,0 +1,133 @@
+
+/**
+ * @file rf24-linux-radio.h
+ * Driving the radio from its IRQ line on a Linux event loop
+ */
+#ifndef _RF24_LINUX_RADIO_H_
+#define _RF24_LINUX_RADIO_H_
+
+#ifdef RF24_LINUX
+
+#include <stdint.h>
+#include "rf24.h"
+#include "rf24-linux-io.h"
+#include "rf24-linux-loop.h"
+
+class Rf24LatencyHistogram;
+
+/**
+ * How often the radio is looked at even without an edge on the IRQ line,
+ * in case one was missed. An edge that comes while the flags are being
+ * cleared can be, because the line never goes high in between.
+ */
+#ifndef RF24_LINUX_WATCHDOG_US
+#define RF24_LINUX_WATCHDOG_US 100000
+#endif
+
+/**
+ * The radio, serviced from an Rf24LinuxLoop whenever the IRQ line falls,
+ * instead of by polling. The thread sleeps in epoll_wait until the radio
+ * has something to say.
+ *
+ * It relies on dynamic payloads, which RF24Serial and the examples all
+ * enable, to know how long each received payload is. Set the radio up,
+ * including the mode, through @ref radio before start().
+ */
+class Rf24LinuxRadio {
+public:
+    /**
+     * Called with each payload received
+     * @param pipe the pipe it came in on
+     */
+    typedef void (*ReceiveHandler)(void *arg, uint8_t pipe, const uint8_t *payload, uint8_t length);
+
+    /**
+     * Called when a payload has gone: @p delivered is false if it ran out
+     * of retries, in which case the transmit FIFO has been flushed.
+     */
+    typedef void (*SentHandler)(void *arg, bool delivered);
+
+    static constexpr uint8_t ADDRESS_WIDTH = 5;
+    static constexpr uint8_t PAYLOAD_SIZE = 32;
+    RF24<Rf24LinuxIo, ADDRESS_WIDTH> radio;
+
+    struct {
+        uint32_t irq;        //!< IRQ line edges
+        uint32_t watchdog;   //!< watchdog ticks that found something to do
+        uint32_t rx;         //!< payloads received
+        uint32_t tx;         //!< payloads queued
+        uint32_t tx_ds;      //!< transmit done interrupts
+        uint32_t max_rt;     //!< maximum retries interrupts
+    } stats;
+
+    Rf24LinuxRadio(Rf24LinuxIo io, Rf24LinuxIrq *irq);
+    ~Rf24LinuxRadio();
+
+    void onReceive(ReceiveHandler handler, void *arg);
+    void onSent(SentHandler handler, void *arg);
+
+    /**
+     * Claim the IRQ line and start servicing the radio from @p loop.
+     * @return false, with errno set, if the line or the timer can't be had
+     */
+    bool start(Rf24LinuxLoop &loop, uint32_t watchdogUs = RF24_LINUX_WATCHDOG_US);
+
+    void stop();
+
+    /**
+     * Record how long after each IRQ edge the radio got serviced in
+     * @p histogram, or stop if it's NULL. Only the GPIO character device
+     * timestamps edges, so there's nothing to record over sysfs.
+     */
+    void measure(Rf24LatencyHistogram *histogram);
+
+    /**
+     * Share one radio between sending and receiving: start() it
+     * listening, and send() turns it round to transmit, and it turns back
+     * once its transmit FIFO is empty. That needs pipe 0 open on the
+     * writing address, for the acks.
+     */
+    void halfDuplex(bool enable);
+
+    /**
+     * Queue a payload on the writing pipe, and start it going.
+     * @return false if the transmit FIFO is full: try again after the
+     * next SentHandler call
+     */
+    bool send(const void *payload, uint8_t length, bool multicast = false);
+
+    /**
+     * Deal with everything the radio has flagged, until the IRQ line
+     * goes high again. The loop calls this; it's public for anything else
+     * that knows the radio needs attention.
+     */
+    void service();
+
+private:
+    Rf24LinuxIrq *irq;
+    Rf24LinuxLoop *loop;
+    Rf24LinuxWatch irqWatch;
+    Rf24LinuxTimer watchdog;
+    Rf24LatencyHistogram *latency;
+    bool turnaround;
+    bool transmitting;
+    ReceiveHandler receiveHandler;
+    void *receiveArg;
+    SentHandler sentHandler;
+    void *sentArg;
+
+    /**
+     * @return whether there was anything to do
+     */
+    bool serviceOnce();
+    void receiveAll();
+
+    static void irqEvent(void *arg, uint32_t events);
+    static void watchdogEvent(void *arg, uint32_t events);
+
+    Rf24LinuxRadio(const Rf24LinuxRadio &) = delete;
+    Rf24LinuxRadio &operator=(const Rf24LinuxRadio &) = delete;
+};
+
+#endif // RF24_LINUX
+#endif // _RF24_LINUX_RADIO_H_
@@ -0,0 +1,167 @@
+
+#include "rf24-linux-rt.h"
+
+#ifdef RF24_LINUX
+
+#include <errno.h>
+#include <malloc.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+
+Rf24LatencyHistogram::Rf24LatencyHistogram() {
+    reset();
+}
+
+void Rf24LatencyHistogram::record(uint32_t usec) {
+    uint32_t bucket = usec < RF24_LATENCY_BUCKETS ? usec : RF24_LATENCY_BUCKETS;
+    counts[bucket].fetch_add(1, std::memory_order_relaxed);
+    if(usec > maximum.load(std::memory_order_relaxed)) {
+        // Only the radio thread records, so there's no race to lose
+        maximum.store(usec, std::memory_order_relaxed);
+    }
+}
+
+void Rf24LatencyHistogram::reset() {
+    for(uint32_t i = 0; i <= RF24_LATENCY_BUCKETS; i++) {
+        counts[i].store(0, std::memory_order_relaxed);
+    }
+    maximum.store(0, std::memory_order_relaxed);
+}
+
+uint32_t Rf24LatencyHistogram::count() const {
+    uint32_t total = 0;
+    for(uint32_t i = 0; i <= RF24_LATENCY_BUCKETS; i++) {
+        total += counts[i].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+uint32_t Rf24LatencyHistogram::percentile(double percent) const {
+    uint32_t total = count();
+    if(total == 0) {
+        return 0;
+    }
+
+    uint64_t wanted = (uint64_t)(total * percent / 100.0 + 0.5);
+    if(wanted == 0) {
+        wanted = 1;
+    }
+    uint64_t seen = 0;
+    for(uint32_t i = 0; i < RF24_LATENCY_BUCKETS; i++) {
+        seen += counts[i].load(std::memory_order_relaxed);
+        if(seen >= wanted) {
+            return i;
+        }
+    }
+    return max();
+}
+
+void Rf24LatencyHistogram::report(FILE *out, bool buckets) const {
+    fprintf(out, "latency us: n=%u p50=%u p90=%u p99=%u p99.9=%u max=%u over%u=%u\n",
+            count(), percentile(50), percentile(90), percentile(99), percentile(99.9), max(),
+            RF24_LATENCY_BUCKETS, counts[RF24_LATENCY_BUCKETS].load(std::memory_order_relaxed));
+    if(buckets) {
+        for(uint32_t i = 0; i <= RF24_LATENCY_BUCKETS; i++) {
+            uint32_t n = counts[i].load(std::memory_order_relaxed);
+            if(n != 0) {
+                fprintf(out, "%s%u %u\n", i == RF24_LATENCY_BUCKETS ? ">=" : "", i, n);
+            }
+        }
+    }
+}
+
+Rf24RtThread::Rf24RtThread() : loop(NULL), prefault(0), started(false), result(false) {
+}
+
+Rf24RtThread::~Rf24RtThread() {
+    stop();
+}
+
+// Touch the stack the thread will use, before it starts on the radio, so
+// it's already mapped, and locked, when it's needed.
+static void __attribute__((noinline)) prefaultStack(size_t size) {
+    volatile char *stack = (volatile char *)__builtin_alloca(size);
+    for(size_t i = 0; i < size; i += 4096) {
+        stack[i] = 0;
+    }
+}
+
+void *Rf24RtThread::main(void *arg) {
+    Rf24RtThread *self = (Rf24RtThread *)arg;
+    if(self->prefault != 0) {
+        prefaultStack(self->prefault);
+    }
+    self->result = self->loop->run();
+    return NULL;
+}
+
+bool Rf24RtThread::start(Rf24LinuxLoop &loop, const Rf24RtConfig &config) {
+    if(started) {
+        return true;
+    }
+
+    if(config.lockMemory) {
+        if(mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+            return false;
+        }
+        // Keep freed memory, rather than giving it back and faulting it in
+        // again, and don't satisfy big allocations with fresh mappings
+        mallopt(M_TRIM_THRESHOLD, -1);
+        mallopt(M_MMAP_MAX, 0);
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    int error = 0;
+    if(config.stackSize != 0) {
+        error = pthread_attr_setstacksize(&attr, config.stackSize);
+    }
+    if(error == 0 && config.priority > 0) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = config.priority;
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        error = pthread_attr_setschedparam(&attr, &param);
+    }
+    if(error == 0 && config.cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(config.cpu, &cpus);
+        error = pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+
+    this->loop = &loop;
+    prefault = 0;
+    if(config.lockMemory) {
+        // Leave the rest of a small stack for the loop itself
+        size_t stackSize = 0;
+        pthread_attr_getstacksize(&attr, &stackSize);
+        prefault = stackSize < 2 * RF24_RT_PREFAULT_STACK ? stackSize / 2 : RF24_RT_PREFAULT_STACK;
+    }
+    if(error == 0) {
+        error = pthread_create(&thread, &attr, main, this);
+    }
+    pthread_attr_destroy(&attr);
+    if(error != 0) {
+        errno = error;
+        return false;
+    }
+    started = true;
+    return true;
+}
+
+bool Rf24RtThread::stop() {
+    if(!started) {
+        return result;
+    }
+    // Unwoken, the loop still stops after its next event, such as the
+    // radio's watchdog
+    loop->stop();
+    pthread_join(thread, NULL);
+    started = false;
+    return result;
+}
+
+#endif // RF24_LINUX
@@ -0,0 +1,133 @@
+
+/**
+ * @file rf24-linux-rt.h
+ * Running the radio's event loop on a real-time thread, and measuring how
+ * late it wakes up
+ */
+#ifndef _RF24_LINUX_RT_H_
+#define _RF24_LINUX_RT_H_
+
+#ifdef RF24_LINUX
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <atomic>
+#include "rf24-linux-loop.h"
+
+/**
+ * Latencies up to this many microseconds get a bucket each; anything
+ * later goes in one overflow bucket.
+ */
+#ifndef RF24_LATENCY_BUCKETS
+#define RF24_LATENCY_BUCKETS 1000
+#endif
+
+/**
+ * How much stack the radio thread touches before it starts, so that it
+ * doesn't take page faults later.
+ */
+#ifndef RF24_RT_PREFAULT_STACK
+#define RF24_RT_PREFAULT_STACK (64 * 1024)
+#endif
+
+/**
+ * A histogram of wakeup latencies, at one microsecond resolution. The
+ * radio thread records, and anyone can read, so the counts are relaxed
+ * atomics: a report taken while it's running may be a few samples out.
+ */
+class Rf24LatencyHistogram {
+public:
+    Rf24LatencyHistogram();
+
+    void record(uint32_t usec);
+
+    void reset();
+
+    uint32_t count() const;
+
+    uint32_t max() const {
+        return maximum.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * The latency that @p percent of the samples were no later than. If
+     * that's in the overflow bucket, the worst seen.
+     */
+    uint32_t percentile(double percent) const;
+
+    /**
+     * Print the count, percentiles and worst case on one line, and then
+     * the non-empty buckets if @p buckets.
+     */
+    void report(FILE *out, bool buckets = false) const;
+
+private:
+    std::atomic<uint32_t> counts[RF24_LATENCY_BUCKETS + 1];
+    std::atomic<uint32_t> maximum;
+};
+
+/**
+ * How to run the radio thread. The defaults leave the scheduling alone,
+ * so that it works without privileges.
+ */
+struct Rf24RtConfig {
+    /** SCHED_FIFO priority, 1 to 99, or 0 to stay SCHED_OTHER */
+    int priority;
+    /** The CPU to pin it to, or -1 for any */
+    int cpu;
+    /** mlockall() the whole process, current and future pages, and
+     *  prefault the thread's stack, up to RF24_RT_PREFAULT_STACK */
+    bool lockMemory;
+    /** The thread's stack size, or 0 for the default */
+    size_t stackSize;
+};
+
+static const Rf24RtConfig RF24_RT_DEFAULT = { 0, -1, false, 0 };
+
+/**
+ * A thread that runs an Rf24LinuxLoop, and so everything the loop drives,
+ * with the scheduling in an Rf24RtConfig.
+ *
+ * Only the loop's handlers should use the radio once it's running. Other
+ * threads talk to them through descriptors on the loop, as rf24d's
+ * clients do through their eventfds.
+ */
+class Rf24RtThread {
+public:
+    Rf24RtThread();
+    ~Rf24RtThread();
+
+    /**
+     * Start running @p loop.
+     * @return false, with errno set, if the thread can't have the
+     * scheduling asked for: EPERM usually means it needs CAP_SYS_NICE, or
+     * CAP_IPC_LOCK, or a bigger RLIMIT_RTPRIO or RLIMIT_MEMLOCK.
+     */
+    bool start(Rf24LinuxLoop &loop, const Rf24RtConfig &config = RF24_RT_DEFAULT);
+
+    /**
+     * Stop the loop and wait for the thread.
+     * @return whether the loop ran without errors
+     */
+    bool stop();
+
+    inline bool running() const {
+        return started;
+    }
+
+private:
+    pthread_t thread;
+    Rf24LinuxLoop *loop;
+    size_t prefault;
+    bool started;
+    bool result;
+
+    static void *main(void *arg);
+
+    Rf24RtThread(const Rf24RtThread &) = delete;
+    Rf24RtThread &operator=(const Rf24RtThread &) = delete;
+};
+
+#endif // RF24_LINUX
+#endif // _RF24_LINUX_RT_H_
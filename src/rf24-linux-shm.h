@@ -0,0 +1,307 @@
+
+/**
+ * @file rf24-linux-shm.h
+ * What rf24d and its clients share: the rings in shared memory, and the
+ * messages on the control socket
+ */
+#ifndef _RF24_LINUX_SHM_H_
+#define _RF24_LINUX_SHM_H_
+
+#ifdef RF24_LINUX
+
+#include <errno.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+/**
+ * Where rf24d listens, unless it's told otherwise.
+ */
+#ifndef RF24D_SOCKET
+#define RF24D_SOCKET "/run/rf24d.sock"
+#endif
+
+/**
+ * Slots in each of a client's rings, one more than they hold.
+ */
+#ifndef RF24D_RING_SIZE
+#define RF24D_RING_SIZE 64
+#endif
+
+static const uint8_t RF24D_MAX_RADIOS = 4;
+static const uint8_t RF24D_PAYLOAD_SIZE = 32;
+static const uint32_t RF24D_MAGIC = 0x52463234; // "RF24"
+static const uint32_t RF24D_VERSION = 2;
+
+/**
+ * A payload on its way to or from a radio.
+ */
+struct Rf24dPacket {
+    uint8_t radio;   //!< which of the daemon's radios
+    uint8_t pipe;    //!< the pipe it came in on; ignored on the way out
+    uint8_t length;  //!< 1 to RF24D_PAYLOAD_SIZE
+    uint8_t flags;   //!< RF24D_PACKET_MULTICAST on the way out
+    uint8_t address[5];  //!< where it goes; ignored on the way in
+    uint8_t data[RF24D_PAYLOAD_SIZE];
+};
+
+static const uint8_t RF24D_PACKET_MULTICAST = 0x01;
+
+/**
+ * The same single producer, single consumer ring, and the same arm/wake
+ * protocol, as rf24::SpscRing. But the two sides are in different
+ * processes, which map it at different addresses, so the slots are kept
+ * inline, and the indexes are 32 bits, which are lock free everywhere
+ * the daemon runs.
+ *
+ * The daemon can't trust what a client writes here, so it uses the
+ * overloads that take its own index: it keeps that in its own memory, and
+ * only ever stores it to the ring, and it checks the client's before
+ * using it.
+ */
+template<typename T, uint32_t SIZE>
+class Rf24ShmRing {
+private:
+    std::atomic<uint32_t> head; /**< The next slot to write, owned by the producer */
+    std::atomic<uint32_t> tail; /**< The next slot to read, owned by the consumer */
+    std::atomic<uint32_t> producerWaiting;
+    std::atomic<uint32_t> consumerWaiting;
+    T slots[SIZE];
+
+    static_assert(ATOMIC_INT_LOCK_FREE == 2, "Rf24ShmRing needs address-free atomics");
+
+    static inline uint32_t next(uint32_t index) {
+        return (index + 1 == SIZE) ? 0 : index + 1;
+    }
+
+public:
+    /**
+     * Empty the ring. The creator calls this, before sharing it.
+     */
+    void reset() {
+        head.store(0);
+        tail.store(0);
+        producerWaiting.store(0);
+        consumerWaiting.store(0);
+    }
+
+    static constexpr uint32_t capacity() {
+        return SIZE - 1;
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+    bool full() const {
+        return next(head.load(std::memory_order_acquire)) == tail.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Add an item. Producer only.
+     * @return false if the ring is full
+     */
+    bool put(const T &item) {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        uint32_t n = next(h);
+        if(n == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        slots[h] = item;
+        head.store(n);
+        return true;
+    }
+
+    /**
+     * The oldest item, left in the ring until pop(). Consumer only.
+     * @return NULL if the ring is empty
+     */
+    const T *front() const {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        if(t == head.load(std::memory_order_acquire)) {
+            return NULL;
+        }
+        return &slots[t];
+    }
+
+    /**
+     * Drop the item front() returned. Consumer only.
+     */
+    void pop() {
+        tail.store(next(tail.load(std::memory_order_relaxed)));
+    }
+
+    /**
+     * Remove the oldest item. Consumer only.
+     * @return false if the ring is empty
+     */
+    bool get(T &item) {
+        const T *oldest = front();
+        if(oldest == NULL) {
+            return false;
+        }
+        item = *oldest;
+        pop();
+        return true;
+    }
+
+    /**
+     * put(), for a producer that keeps its own head, @p h.
+     * @return false if the ring is full, with errno ENOBUFS, or if the
+     * consumer's tail is out of range, with errno EPROTO
+     */
+    bool put(const T &item, uint32_t &h) {
+        uint32_t t = tail.load(std::memory_order_acquire);
+        if(t >= SIZE) {
+            errno = EPROTO;
+            return false;
+        }
+        uint32_t n = next(h);
+        if(n == t) {
+            errno = ENOBUFS;
+            return false;
+        }
+        slots[h] = item;
+        h = n;
+        head.store(n);
+        return true;
+    }
+
+    /**
+     * front(), for a consumer that keeps its own tail, @p t. The item is
+     * still in shared memory: copy it before checking it.
+     * @return NULL if the ring is empty, with errno EAGAIN, or if the
+     * producer's head is out of range, with errno EPROTO
+     */
+    const T *front(uint32_t t) const {
+        uint32_t h = head.load(std::memory_order_acquire);
+        if(h >= SIZE) {
+            errno = EPROTO;
+            return NULL;
+        }
+        if(h == t) {
+            errno = EAGAIN;
+            return NULL;
+        }
+        return &slots[t];
+    }
+
+    /**
+     * pop(), for a consumer that keeps its own tail, @p t.
+     */
+    void pop(uint32_t &t) {
+        t = next(t);
+        tail.store(t);
+    }
+
+    /**
+     * Producer only: ask to be woken when the ring stops being full.
+     * @return true if the ring is still full, so the producer should sleep
+     */
+    bool armProducer() {
+        producerWaiting.store(1);
+        if(!full()) {
+            producerWaiting.store(0);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Consumer only: ask to be woken when the ring stops being empty.
+     * @return true if the ring is still empty, so the consumer should sleep
+     */
+    bool armConsumer() {
+        consumerWaiting.store(1);
+        if(!empty()) {
+            consumerWaiting.store(0);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * armConsumer(), for a consumer that keeps its own tail, @p t.
+     */
+    bool armConsumer(uint32_t t) {
+        consumerWaiting.store(1);
+        if(head.load(std::memory_order_acquire) != t) {
+            consumerWaiting.store(0);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Consumer only, after get() or pop(): does the producer need waking?
+     */
+    bool wakeProducer() {
+        return producerWaiting.exchange(0) != 0;
+    }
+
+    /**
+     * Producer only, after put(): does the consumer need waking?
+     */
+    bool wakeConsumer() {
+        return consumerWaiting.exchange(0) != 0;
+    }
+};
+
+typedef Rf24ShmRing<Rf24dPacket, RF24D_RING_SIZE> Rf24dRing;
+
+/**
+ * The shared memory rf24d creates for each client.
+ *
+ * The daemon writes to its eventfd when the client needs waking, and the
+ * client to the daemon's; the rings say which of them is waiting.
+ */
+struct Rf24dRegion {
+    uint32_t magic;
+    uint32_t version;
+    Rf24dRing transmit;                      //!< client to daemon
+    Rf24dRing receive;                       //!< daemon to client
+    std::atomic<uint32_t> receiveDropped;    //!< payloads lost to a full receive ring
+    std::atomic<uint32_t> transmitRejected;  //!< payloads for radios that don't exist, or of no possible length
+};
+
+/**
+ * The control socket is a unix SOCK_SEQPACKET socket, with one request,
+ * and then one reply, at a time.
+ */
+enum Rf24dCommand : uint8_t {
+    /** Reply carries the region's memfd, then the daemon's and the client's eventfds */
+    RF24D_ATTACH = 1,
+    /** Get payloads from the pipes in the mask @c value */
+    RF24D_SUBSCRIBE,
+    /** Open @c pipe, 1 to 5, on @c address */
+    RF24D_OPEN_READING,
+    /** Move to RF channel @c value */
+    RF24D_CHANNEL,
+    /** Reply carries the radio's stats */
+    RF24D_STATS
+};
+
+struct Rf24dRequest {
+    uint8_t command;
+    uint8_t radio;
+    uint8_t pipe;
+    uint8_t value;
+    uint8_t address[5];
+};
+
+struct Rf24dStats {
+    uint32_t irq;
+    uint32_t rx;
+    uint32_t tx;
+    uint32_t tx_ds;
+    uint32_t max_rt;
+};
+
+struct Rf24dReply {
+    int32_t error;      //!< 0, or an errno value
+    uint32_t radios;    //!< how many the daemon has
+    Rf24dStats stats;
+};
+
+#endif // RF24_LINUX
+#endif // _RF24_LINUX_SHM_H_
@@ -0,0 +1,39 @@
+
+#include "rf24-linux-timing.h"
+
+#ifdef RF24_LINUX
+
+#include <errno.h>
+#include <time.h>
+
+static inline uint64_t monotonicMicros() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000U + now.tv_nsec / 1000;
+}
+
+void rf24DelayMicroseconds(uint32_t usec) {
+    if(usec < RF24_SLEEP_THRESHOLD_US) {
+        uint64_t start = monotonicMicros();
+        while(monotonicMicros() - start < usec) {
+        }
+        return;
+    }
+
+    struct timespec req;
+    req.tv_sec = usec / 1000000;
+    req.tv_nsec = (usec % 1000000) * 1000L;
+    while(clock_nanosleep(CLOCK_MONOTONIC, 0, &req, &req) == EINTR) {
+        // Interrupted by a signal: sleep for what's left
+    }
+}
+
+uint32_t rf24Micros() {
+    return (uint32_t)monotonicMicros();
+}
+
+uint32_t rf24Millis() {
+    return (uint32_t)(monotonicMicros() / 1000);
+}
+
+#endif
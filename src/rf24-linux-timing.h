@@ -0,0 +1,37 @@
+
+/**
+ * @file rf24-linux-timing.h
+ * Delays and clocks for the Linux port
+ */
+#ifndef _RF24_LINUX_TIMING_H_
+#define _RF24_LINUX_TIMING_H_
+
+#ifdef RF24_LINUX
+#include <stdint.h>
+
+/**
+ * Delays this long or longer sleep. Shorter ones busy-wait, because the
+ * kernel wakes a sleeper up late by tens of microseconds, which is most of
+ * a radio turnaround.
+ */
+#ifndef RF24_SLEEP_THRESHOLD_US
+#define RF24_SLEEP_THRESHOLD_US 200
+#endif
+
+/**
+ * Wait for at least @p usec microseconds.
+ */
+void rf24DelayMicroseconds(uint32_t usec);
+
+/**
+ * A monotonic microsecond clock, which wraps like the Arduino one.
+ */
+uint32_t rf24Micros();
+
+/**
+ * A monotonic millisecond clock.
+ */
+uint32_t rf24Millis();
+
+#endif
+#endif // _RF24_LINUX_TIMING_H_
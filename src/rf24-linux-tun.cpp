@@ -0,0 +1,169 @@
+
+#include "rf24-linux-tun.h"
+
+#ifdef RF24_LINUX
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/if_tun.h>
+#include "rf24-linux-timing.h"
+
+using namespace rf24::lowpan;
+
+Rf24LinuxTun::Rf24LinuxTun(Rf24LinuxRadio &radio, const char *name)
+    : radio(radio), loop(NULL), tunFd(-1), payloadLength(0) {
+    memset(&stats, 0, sizeof(stats));
+    strncpy(interfaceName, name, sizeof(interfaceName) - 1);
+    interfaceName[sizeof(interfaceName) - 1] = '\0';
+    tunWatch.handler = tunEvent;
+    tunWatch.arg = this;
+}
+
+Rf24LinuxTun::~Rf24LinuxTun() {
+    end();
+}
+
+bool Rf24LinuxTun::begin(Rf24LinuxLoop &loop) {
+    if(tunFd >= 0) {
+        return true;
+    }
+
+    tunFd = open("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if(tunFd < 0) {
+        return false;
+    }
+
+    struct ifreq request;
+    memset(&request, 0, sizeof(request));
+    request.ifr_flags = IFF_TUN | IFF_NO_PI;
+    memcpy(request.ifr_name, interfaceName, IFNAMSIZ);
+    bool ok = ioctl(tunFd, TUNSETIFF, &request) == 0;
+    if(ok) {
+        memcpy(interfaceName, request.ifr_name, IFNAMSIZ);
+        // Edge triggered, since pump() reads until there's nothing left, or
+        // until the radio is full, when the radio's next TX_DS carries on
+        ok = configure() && loop.add(tunFd, EPOLLIN | EPOLLET, &tunWatch);
+    }
+    if(!ok) {
+        int error = errno;
+        close(tunFd);
+        tunFd = -1;
+        errno = error;
+        return false;
+    }
+
+    this->loop = &loop;
+    radio.onReceive(radioReceive, this);
+    radio.onSent(radioSent, this);
+    pump();
+    return true;
+}
+
+// The MTU, and up
+bool Rf24LinuxTun::configure() {
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if(sock < 0) {
+        return false;
+    }
+
+    struct ifreq request;
+    memset(&request, 0, sizeof(request));
+    memcpy(request.ifr_name, interfaceName, IFNAMSIZ);
+    request.ifr_mtu = MTU;
+    bool ok = ioctl(sock, SIOCSIFMTU, &request) == 0
+            && ioctl(sock, SIOCGIFFLAGS, &request) == 0;
+    if(ok) {
+        request.ifr_flags |= IFF_UP | IFF_RUNNING;
+        ok = ioctl(sock, SIOCSIFFLAGS, &request) == 0;
+    }
+    int error = errno;
+    close(sock);
+    errno = error;
+    return ok;
+}
+
+void Rf24LinuxTun::end() {
+    if(tunFd >= 0) {
+        radio.onReceive(NULL, NULL);
+        radio.onSent(NULL, NULL);
+        loop->remove(tunFd);
+        close(tunFd);
+        tunFd = -1;
+        loop = NULL;
+    }
+}
+
+// Feed the radio until it's full, or until there are no more packets
+void Rf24LinuxTun::pump() {
+    for(;;) {
+        if(payloadLength != 0) {
+            if(!radio.send(payload, payloadLength)) {
+                return;
+            }
+            payloadLength = 0;
+        }
+
+        if(fragmenter.pending()) {
+            payloadLength = fragmenter.next(payload);
+            continue;
+        }
+
+        uint8_t packet[MTU];
+        ssize_t length = read(tunFd, packet, sizeof(packet));
+        if(length <= 0) {
+            return;
+        }
+        uint16_t datagramLength = compressor.compress(packet, length, datagram, sizeof(datagram));
+        if(datagramLength == 0) {
+            stats.tx_dropped++;
+            continue;
+        }
+        fragmenter.start(datagram, datagramLength);
+        stats.tx_packets++;
+    }
+}
+
+void Rf24LinuxTun::tunEvent(void *arg, uint32_t events) {
+    (void)events;
+    ((Rf24LinuxTun *)arg)->pump();
+}
+
+void Rf24LinuxTun::radioSent(void *arg, bool delivered) {
+    Rf24LinuxTun *tun = (Rf24LinuxTun *)arg;
+    if(!delivered) {
+        // The radio flushed its FIFO, so the rest of this datagram would
+        // only be dropped at the other end
+        tun->stats.tx_failed++;
+        tun->fragmenter.cancel();
+        tun->payloadLength = 0;
+    }
+    tun->pump();
+}
+
+void Rf24LinuxTun::radioReceive(void *arg, uint8_t pipe, const uint8_t *payload, uint8_t length) {
+    Rf24LinuxTun *tun = (Rf24LinuxTun *)arg;
+    const uint8_t *datagram;
+    uint16_t datagramLength = tun->reassembler.receive(pipe, payload, length, rf24Millis(), datagram);
+    if(datagramLength == 0) {
+        return;
+    }
+
+    uint8_t packet[MTU];
+    uint16_t packetLength = tun->compressor.decompress(datagram, datagramLength, packet, sizeof(packet));
+    if(packetLength == 0) {
+        tun->stats.rx_dropped++;
+        return;
+    }
+    if(write(tun->tunFd, packet, packetLength) == packetLength) {
+        tun->stats.rx_packets++;
+    } else {
+        tun->stats.rx_dropped++;
+    }
+}
+
+#endif // RF24_LINUX
@@ -0,0 +1,94 @@
+
+/**
+ * @file rf24-linux-tun.h
+ * A network interface over the radio
+ */
+#ifndef _RF24_LINUX_TUN_H_
+#define _RF24_LINUX_TUN_H_
+
+#ifdef RF24_LINUX
+
+#include <stdint.h>
+#include <net/if.h>
+#include "rf24-lowpan.h"
+#include "rf24-linux-loop.h"
+#include "rf24-linux-radio.h"
+
+/**
+ * A TUN interface whose packets go over an Rf24LinuxRadio, compressed and
+ * fragmented as rf24-lowpan.h describes, so IP traffic can be routed to
+ * radio nodes. Its MTU is the IPv6 minimum, 1280.
+ *
+ * It takes over the radio's handlers, so the radio is the interface's
+ * alone. It's point to point: everything goes to the radio's writing
+ * pipe, and everything that arrives on any pipe comes out of the
+ * interface, so a hub with several nodes routes over several of them.
+ */
+class Rf24LinuxTun {
+public:
+    /**
+     * @param name the interface's name, which can have a %d for the
+     * kernel to fill in
+     */
+    Rf24LinuxTun(Rf24LinuxRadio &radio, const char *name = "rf24tun%d");
+    ~Rf24LinuxTun();
+
+    /**
+     * Contexts for header compression: set them before begin().
+     */
+    rf24::lowpan::Compressor compressor;
+
+    /**
+     * Create the interface, bring it up, and start moving packets on
+     * @p loop, which must be the one the radio was started on.
+     * @return false, with errno set, if the interface can't be made;
+     * EPERM means it needs CAP_NET_ADMIN
+     */
+    bool begin(Rf24LinuxLoop &loop);
+
+    void end();
+
+    /**
+     * The name the interface got.
+     */
+    inline const char *name() const {
+        return interfaceName;
+    }
+
+    struct {
+        uint32_t tx_packets;     //!< packets handed to the radio
+        uint32_t tx_dropped;     //!< packets that couldn't be compressed
+        uint32_t tx_failed;      //!< packets cut short by MAX_RT
+        uint32_t rx_packets;     //!< packets delivered to the interface
+        uint32_t rx_dropped;     //!< datagrams that didn't decompress
+    } stats;
+
+    inline const rf24::lowpan::Reassembler &reassembly() const {
+        return reassembler;
+    }
+
+private:
+    Rf24LinuxRadio &radio;
+    Rf24LinuxLoop *loop;
+    char interfaceName[IFNAMSIZ];
+    int tunFd;
+    Rf24LinuxWatch tunWatch;
+    rf24::lowpan::Fragmenter fragmenter;
+    rf24::lowpan::Reassembler reassembler;
+    uint8_t datagram[rf24::lowpan::DATAGRAM_MAX];
+    uint8_t payload[rf24::lowpan::PAYLOAD_SIZE];
+    uint8_t payloadLength;
+
+    bool configure();
+    void pump();
+
+    static void tunEvent(void *arg, uint32_t events);
+    static void radioReceive(void *arg, uint8_t pipe, const uint8_t *payload, uint8_t length);
+    static void radioSent(void *arg, bool delivered);
+
+    Rf24LinuxTun(const Rf24LinuxTun &) = delete;
+    Rf24LinuxTun &operator=(const Rf24LinuxTun &) = delete;
+};
+
+#endif // RF24_LINUX
+#endif // _RF24_LINUX_TUN_H_
@@ -0,0 +1,642 @@
+#include "rf24-lowpan.h"
+#include <string.h>
+
+namespace rf24 {
+namespace lowpan {
+
+static const uint8_t IPV6_HEADER_SIZE = 40;
+static const uint8_t IPV4_HEADER_SIZE = 20;
+static const uint8_t UDP_HEADER_SIZE = 8;
+static const uint8_t NEXT_HEADER_UDP = 17;
+
+static const uint8_t IPHC_TF_SHIFT = 3;
+static const uint8_t IPHC_NH = 0x04;
+static const uint8_t IPHC_CID = 0x80;
+static const uint8_t IPHC_SAC = 0x40;
+static const uint8_t IPHC_SAM_SHIFT = 4;
+static const uint8_t IPHC_M = 0x08;
+static const uint8_t IPHC_DAC = 0x04;
+
+/** Address modes, as SAM and DAM encode them for unicast addresses */
+static const uint8_t ADDRESS_INLINE = 0;   // 128 bits, or with a context, unspecified
+static const uint8_t ADDRESS_IID = 1;      // 64 bit interface id
+static const uint8_t ADDRESS_SHORT = 2;    // 16 bits, in 0000:00ff:fe00:XXXX
+static const uint8_t ADDRESS_DERIVED = 3;  // from the link layer, which we don't have
+
+static const uint8_t NHC_UDP = 0xf0;
+static const uint8_t NHC_UDP_MASK = 0xf8;
+static const uint8_t NHC_UDP_CHECKSUM = 0x04;
+
+static const uint8_t LINK_LOCAL[8] = { 0xfe, 0x80, 0, 0, 0, 0, 0, 0 };
+static const uint8_t SHORT_IID[6] = { 0, 0, 0, 0xff, 0xfe, 0 };
+
+// Bounds checked appending, so the compressor can write first and check
+// once at the end
+struct Writer {
+    uint8_t *out;
+    uint16_t size;
+    uint16_t pos;
+    bool overflow;
+
+    void put(uint8_t byte) {
+        if(pos < size) {
+            out[pos] = byte;
+        } else {
+            overflow = true;
+        }
+        pos++;
+    }
+
+    void put(const uint8_t *bytes, uint16_t length) {
+        if(pos + length <= size) {
+            memcpy(out + pos, bytes, length);
+        } else {
+            overflow = true;
+        }
+        pos += length;
+    }
+};
+
+struct Reader {
+    const uint8_t *in;
+    uint16_t length;
+    uint16_t pos;
+    bool underflow;
+
+    uint8_t get() {
+        if(pos < length) {
+            return in[pos++];
+        }
+        underflow = true;
+        return 0;
+    }
+
+    void get(uint8_t *bytes, uint16_t count) {
+        if(pos + count <= length) {
+            memcpy(bytes, in + pos, count);
+            pos += count;
+        } else {
+            underflow = true;
+        }
+    }
+
+    uint16_t remaining() const {
+        return pos < length ? length - pos : 0;
+    }
+};
+
+static inline uint16_t get16(const uint8_t *bytes) {
+    return (bytes[0] << 8) | bytes[1];
+}
+
+static inline void set16(uint8_t *bytes, uint16_t value) {
+    bytes[0] = value >> 8;
+    bytes[1] = value;
+}
+
+Compressor::Compressor() : valid(0) {
+    memset(prefixes, 0, sizeof(prefixes));
+}
+
+bool Compressor::context(uint8_t id, const uint8_t prefix[8]) {
+    if(id >= CONTEXT_COUNT) {
+        return false;
+    }
+    if(prefix == NULL) {
+        valid &= ~(1 << id);
+    } else {
+        memcpy(prefixes[id], prefix, 8);
+        valid |= 1 << id;
+    }
+    return true;
+}
+
+int8_t Compressor::findContext(const uint8_t *address) const {
+    for(uint8_t id = 0; id < CONTEXT_COUNT; id++) {
+        if((valid & (1 << id)) && memcmp(prefixes[id], address, 8) == 0) {
+            return id;
+        }
+    }
+    return -1;
+}
+
+// The shortest way to send an interface id, once the prefix is known
+static uint8_t iidMode(const uint8_t *address) {
+    return memcmp(address + 8, SHORT_IID, sizeof(SHORT_IID)) == 0 ? ADDRESS_SHORT : ADDRESS_IID;
+}
+
+static void putIid(Writer &out, const uint8_t *address, uint8_t mode) {
+    if(mode == ADDRESS_SHORT) {
+        out.put(address + 14, 2);
+    } else {
+        out.put(address + 8, 8);
+    }
+}
+
+uint16_t Compressor::compress(const uint8_t *packet, uint16_t length, uint8_t *datagram, uint16_t size) const {
+    Writer out = { datagram, size, 0, false };
+
+    if(length >= IPV4_HEADER_SIZE && (packet[0] >> 4) == 4) {
+        out.put(DISPATCH_IPV4);
+        out.put(packet, length);
+        return out.overflow ? 0 : out.pos;
+    }
+    if(length < IPV6_HEADER_SIZE || (packet[0] >> 4) != 6
+            || IPV6_HEADER_SIZE + get16(packet + 4) != length) {
+        return 0;
+    }
+
+    const uint8_t *source = packet + 8;
+    const uint8_t *destination = packet + 24;
+    uint8_t iphc0 = DISPATCH_IPHC;
+    uint8_t iphc1 = 0;
+    uint8_t sci = 0, dci = 0;
+
+    // Traffic class, with ECN and DSCP swapped round, and flow label
+    uint8_t tc = ((packet[0] & 0x0f) << 4) | (packet[1] >> 4);
+    uint32_t flow = ((uint32_t)(packet[1] & 0x0f) << 16) | get16(packet + 2);
+    uint8_t ecn = tc & 0x03;
+    uint8_t dscp = tc >> 2;
+    uint8_t tf;
+    if(flow == 0) {
+        tf = (tc == 0) ? 3 : 2;
+    } else {
+        tf = (dscp == 0) ? 1 : 0;
+    }
+    iphc0 |= tf << IPHC_TF_SHIFT;
+
+    uint8_t nextHeader = packet[6];
+    bool udp = nextHeader == NEXT_HEADER_UDP && length >= IPV6_HEADER_SIZE + UDP_HEADER_SIZE;
+    if(udp) {
+        iphc0 |= IPHC_NH;
+    }
+
+    uint8_t hopLimit = packet[7];
+    switch(hopLimit) {
+    case 1: iphc0 |= 1; break;
+    case 64: iphc0 |= 2; break;
+    case 255: iphc0 |= 3; break;
+    default: break;
+    }
+
+    // Source: unspecified, link local, under a context, or in full
+    static const uint8_t UNSPECIFIED[16] = { 0 };
+    uint8_t sam;
+    int8_t context = -1;
+    if(memcmp(source, UNSPECIFIED, 16) == 0) {
+        iphc1 |= IPHC_SAC;
+        sam = ADDRESS_INLINE;
+    } else if(memcmp(source, LINK_LOCAL, 8) == 0) {
+        sam = iidMode(source);
+    } else if((context = findContext(source)) >= 0) {
+        iphc1 |= IPHC_SAC;
+        sci = context;
+        sam = iidMode(source);
+    } else {
+        sam = ADDRESS_INLINE;
+    }
+    iphc1 |= sam << IPHC_SAM_SHIFT;
+
+    // Destination: the same, or one of the short multicast forms
+    uint8_t dam;
+    bool multicast = destination[0] == 0xff;
+    if(multicast) {
+        iphc1 |= IPHC_M;
+        if(destination[1] == 0x02 && memcmp(destination + 2, UNSPECIFIED, 13) == 0) {
+            dam = 3;
+        } else if(memcmp(destination + 2, UNSPECIFIED, 11) == 0) {
+            dam = 2;
+        } else if(memcmp(destination + 2, UNSPECIFIED, 9) == 0) {
+            dam = 1;
+        } else {
+            dam = 0;
+        }
+    } else if(memcmp(destination, LINK_LOCAL, 8) == 0) {
+        dam = iidMode(destination);
+    } else if((context = findContext(destination)) >= 0) {
+        iphc1 |= IPHC_DAC;
+        dci = context;
+        dam = iidMode(destination);
+    } else {
+        dam = ADDRESS_INLINE;
+    }
+    iphc1 |= dam;
+
+    if(sci != 0 || dci != 0) {
+        iphc1 |= IPHC_CID;
+    }
+
+    out.put(iphc0);
+    out.put(iphc1);
+    if(iphc1 & IPHC_CID) {
+        out.put((sci << 4) | dci);
+    }
+
+    switch(tf) {
+    case 0:
+        out.put((ecn << 6) | dscp);
+        out.put(flow >> 16);
+        out.put(flow >> 8);
+        out.put(flow);
+        break;
+    case 1:
+        out.put((ecn << 6) | (flow >> 16));
+        out.put(flow >> 8);
+        out.put(flow);
+        break;
+    case 2:
+        out.put((ecn << 6) | dscp);
+        break;
+    default:
+        break;
+    }
+
+    if(!udp) {
+        out.put(nextHeader);
+    }
+    if((iphc0 & 0x03) == 0) {
+        out.put(hopLimit);
+    }
+
+    if(sam == ADDRESS_INLINE) {
+        if(!(iphc1 & IPHC_SAC)) {
+            out.put(source, 16);
+        }
+    } else {
+        putIid(out, source, sam);
+    }
+
+    if(multicast) {
+        switch(dam) {
+        case 0: out.put(destination, 16); break;
+        case 1: out.put(destination[1]); out.put(destination + 11, 5); break;
+        case 2: out.put(destination[1]); out.put(destination + 13, 3); break;
+        default: out.put(destination[15]); break;
+        }
+    } else if(dam == ADDRESS_INLINE) {
+        out.put(destination, 16);
+    } else {
+        putIid(out, destination, dam);
+    }
+
+    const uint8_t *payload = packet + IPV6_HEADER_SIZE;
+    if(udp) {
+        uint16_t sourcePort = get16(payload);
+        uint16_t destinationPort = get16(payload + 2);
+        if((sourcePort & 0xfff0) == 0xf0b0 && (destinationPort & 0xfff0) == 0xf0b0) {
+            out.put(NHC_UDP | 3);
+            out.put(((sourcePort & 0x0f) << 4) | (destinationPort & 0x0f));
+        } else if((destinationPort & 0xff00) == 0xf000) {
+            out.put(NHC_UDP | 1);
+            out.put(payload, 2);
+            out.put(destinationPort & 0xff);
+        } else if((sourcePort & 0xff00) == 0xf000) {
+            out.put(NHC_UDP | 2);
+            out.put(sourcePort & 0xff);
+            out.put(payload + 2, 2);
+        } else {
+            out.put(NHC_UDP);
+            out.put(payload, 4);
+        }
+        // The length is elided, but the checksum goes as it is
+        out.put(payload + 6, 2);
+        payload += UDP_HEADER_SIZE;
+    }
+    out.put(payload, packet + length - payload);
+
+    return out.overflow ? 0 : out.pos;
+}
+
+// Rebuild a unicast address from its mode, with @p prefix, if it has one
+static bool getAddress(Reader &in, uint8_t *address, uint8_t mode, const uint8_t *prefix) {
+    memset(address, 0, 16);
+    if(prefix == NULL) {
+        if(mode == ADDRESS_INLINE) {
+            in.get(address, 16);
+            return true;
+        }
+        prefix = LINK_LOCAL;
+    } else if(mode == ADDRESS_INLINE) {
+        // The unspecified address
+        return true;
+    }
+
+    memcpy(address, prefix, 8);
+    switch(mode) {
+    case ADDRESS_IID:
+        in.get(address + 8, 8);
+        return true;
+    case ADDRESS_SHORT:
+        memcpy(address + 8, SHORT_IID, sizeof(SHORT_IID));
+        in.get(address + 14, 2);
+        return true;
+    default:
+        return false;
+    }
+}
+
+uint16_t Compressor::decompress(const uint8_t *datagram, uint16_t length, uint8_t *packet, uint16_t size) const {
+    if(length < 1) {
+        return 0;
+    }
+
+    if(datagram[0] == DISPATCH_IPV4 || datagram[0] == DISPATCH_IPV6) {
+        if(length - 1u > size) {
+            return 0;
+        }
+        memcpy(packet, datagram + 1, length - 1);
+        return length - 1;
+    }
+
+    if((datagram[0] & DISPATCH_IPHC_MASK) != DISPATCH_IPHC || size < IPV6_HEADER_SIZE + UDP_HEADER_SIZE) {
+        return 0;
+    }
+
+    Reader in = { datagram, length, 0, false };
+    uint8_t iphc0 = in.get();
+    uint8_t iphc1 = in.get();
+    uint8_t sci = 0, dci = 0;
+    if(iphc1 & IPHC_CID) {
+        uint8_t cid = in.get();
+        sci = cid >> 4;
+        dci = cid & 0x0f;
+    }
+
+    uint8_t ecn = 0, dscp = 0;
+    uint32_t flow = 0;
+    switch((iphc0 >> IPHC_TF_SHIFT) & 0x03) {
+    case 0: {
+        uint8_t byte = in.get();
+        ecn = byte >> 6;
+        dscp = byte & 0x3f;
+        flow = (uint32_t)(in.get() & 0x0f) << 16;
+        flow |= in.get() << 8;
+        flow |= in.get();
+        break;
+    }
+    case 1: {
+        uint8_t byte = in.get();
+        ecn = byte >> 6;
+        flow = (uint32_t)(byte & 0x0f) << 16;
+        flow |= in.get() << 8;
+        flow |= in.get();
+        break;
+    }
+    case 2: {
+        uint8_t byte = in.get();
+        ecn = byte >> 6;
+        dscp = byte & 0x3f;
+        break;
+    }
+    default:
+        break;
+    }
+    uint8_t tc = (dscp << 2) | ecn;
+    packet[0] = 0x60 | (tc >> 4);
+    packet[1] = (tc << 4) | ((flow >> 16) & 0x0f);
+    set16(packet + 2, flow);
+
+    bool compressedNext = iphc0 & IPHC_NH;
+    packet[6] = compressedNext ? NEXT_HEADER_UDP : in.get();
+
+    static const uint8_t HOP_LIMITS[] = { 0, 1, 64, 255 };
+    packet[7] = (iphc0 & 0x03) ? HOP_LIMITS[iphc0 & 0x03] : in.get();
+
+    const uint8_t *sourcePrefix = NULL;
+    if(iphc1 & IPHC_SAC) {
+        if(!(valid & (1 << sci)) && ((iphc1 >> IPHC_SAM_SHIFT) & 0x03) != ADDRESS_INLINE) {
+            return 0;
+        }
+        sourcePrefix = prefixes[sci];
+    }
+    if(!getAddress(in, packet + 8, (iphc1 >> IPHC_SAM_SHIFT) & 0x03, sourcePrefix)) {
+        return 0;
+    }
+
+    uint8_t *destination = packet + 24;
+    uint8_t dam = iphc1 & 0x03;
+    if(iphc1 & IPHC_M) {
+        // Context based multicast isn't used
+        if(iphc1 & IPHC_DAC) {
+            return 0;
+        }
+        memset(destination, 0, 16);
+        destination[0] = 0xff;
+        switch(dam) {
+        case 0: in.get(destination, 16); break;
+        case 1: destination[1] = in.get(); in.get(destination + 11, 5); break;
+        case 2: destination[1] = in.get(); in.get(destination + 13, 3); break;
+        default: destination[1] = 0x02; destination[15] = in.get(); break;
+        }
+    } else {
+        const uint8_t *destinationPrefix = NULL;
+        if(iphc1 & IPHC_DAC) {
+            if(!(valid & (1 << dci)) || dam == ADDRESS_INLINE) {
+                return 0;
+            }
+            destinationPrefix = prefixes[dci];
+        }
+        if(!getAddress(in, destination, dam, destinationPrefix)) {
+            return 0;
+        }
+    }
+
+    uint8_t *payload = packet + IPV6_HEADER_SIZE;
+    uint16_t headerLength = 0;
+    if(compressedNext) {
+        uint8_t nhc = in.get();
+        // A checksum we'd have to compute isn't something we send
+        if((nhc & NHC_UDP_MASK) != NHC_UDP || (nhc & NHC_UDP_CHECKSUM)) {
+            return 0;
+        }
+        switch(nhc & 0x03) {
+        case 0:
+            in.get(payload, 4);
+            break;
+        case 1:
+            in.get(payload, 2);
+            payload[2] = 0xf0;
+            payload[3] = in.get();
+            break;
+        case 2:
+            payload[0] = 0xf0;
+            payload[1] = in.get();
+            in.get(payload + 2, 2);
+            break;
+        default: {
+            uint8_t ports = in.get();
+            set16(payload, 0xf0b0 | (ports >> 4));
+            set16(payload + 2, 0xf0b0 | (ports & 0x0f));
+            break;
+        }
+        }
+        in.get(payload + 6, 2);
+        headerLength = UDP_HEADER_SIZE;
+    }
+    if(in.underflow) {
+        return 0;
+    }
+
+    uint16_t rest = in.remaining();
+    uint16_t payloadLength = headerLength + rest;
+    if(IPV6_HEADER_SIZE + payloadLength > size) {
+        return 0;
+    }
+    in.get(payload + headerLength, rest);
+    set16(packet + 4, payloadLength);
+    if(compressedNext) {
+        set16(payload + 4, payloadLength);
+    }
+    return IPV6_HEADER_SIZE + payloadLength;
+}
+
+Fragmenter::Fragmenter() : datagram(NULL), length(0), offset(0), index(0), tag(0) {
+}
+
+void Fragmenter::start(const uint8_t *datagram, uint16_t length) {
+    this->datagram = datagram;
+    this->length = length;
+    offset = 0;
+    index = 0;
+    tag = (tag + 1) & FRAME_TAG_MASK;
+}
+
+uint8_t Fragmenter::next(uint8_t *payload) {
+    if(datagram == NULL) {
+        return 0;
+    }
+
+    uint8_t header;
+    uint16_t chunk;
+    if(index == 0 && length <= PAYLOAD_SIZE - WHOLE_HEADER_SIZE) {
+        payload[0] = FRAME_WHOLE | tag;
+        header = WHOLE_HEADER_SIZE;
+    } else if(index == 0) {
+        payload[0] = FRAME_FIRST | tag;
+        set16(payload + 1, length);
+        header = FIRST_HEADER_SIZE;
+    } else {
+        payload[0] = FRAME_NEXT | tag;
+        payload[1] = index;
+        header = NEXT_HEADER_SIZE;
+    }
+
+    chunk = length - offset;
+    if(chunk > PAYLOAD_SIZE - header) {
+        chunk = PAYLOAD_SIZE - header;
+    }
+    memcpy(payload + header, datagram + offset, chunk);
+    offset += chunk;
+    index++;
+    if(offset == length) {
+        datagram = NULL;
+    }
+    return header + chunk;
+}
+
+Reassembler::Reassembler() {
+    memset(&stats, 0, sizeof(stats));
+    for(uint8_t i = 0; i < LINK_COUNT; i++) {
+        partials[i].active = false;
+        // No tag matches this, so the first datagram isn't a duplicate
+        partials[i].tag = 0xff;
+    }
+}
+
+uint16_t Reassembler::receive(uint8_t link, const uint8_t *payload, uint8_t length,
+        uint32_t nowMs, const uint8_t *&datagram) {
+    if(link >= LINK_COUNT || length < 1) {
+        stats.malformed++;
+        return 0;
+    }
+
+    Partial &partial = partials[link];
+    if(partial.active && nowMs - partial.started > TIMEOUT_MS) {
+        partial.active = false;
+        stats.dropped++;
+    }
+
+    uint8_t kind = payload[0] & FRAME_KIND_MASK;
+    uint8_t tag = payload[0] & FRAME_TAG_MASK;
+
+    if(kind == FRAME_WHOLE) {
+        if(length < 2) {
+            stats.malformed++;
+            return 0;
+        }
+        if(tag == partial.tag && !partial.active) {
+            stats.duplicate++;
+            return 0;
+        }
+        partial.tag = tag;
+        if(partial.active) {
+            partial.active = false;
+            stats.dropped++;
+        }
+        // Copied, so it's held like any other
+        memcpy(partial.data, payload + WHOLE_HEADER_SIZE, length - WHOLE_HEADER_SIZE);
+        datagram = partial.data;
+        return length - WHOLE_HEADER_SIZE;
+    }
+
+    if(kind == FRAME_FIRST) {
+        if(length <= FIRST_HEADER_SIZE) {
+            stats.malformed++;
+            return 0;
+        }
+        uint16_t total = get16(payload + 1);
+        if(partial.tag == tag && (!partial.active || partial.index == 1)) {
+            stats.duplicate++;
+            return 0;
+        }
+        if(partial.active) {
+            partial.active = false;
+            stats.dropped++;
+        }
+        uint16_t chunk = length - FIRST_HEADER_SIZE;
+        if(total > DATAGRAM_MAX || chunk >= total) {
+            stats.malformed++;
+            return 0;
+        }
+        memcpy(partial.data, payload + FIRST_HEADER_SIZE, chunk);
+        partial.length = total;
+        partial.received = chunk;
+        partial.tag = tag;
+        partial.index = 1;
+        partial.active = true;
+        partial.started = nowMs;
+        return 0;
+    }
+
+    if(kind != FRAME_NEXT || length <= NEXT_HEADER_SIZE) {
+        stats.malformed++;
+        return 0;
+    }
+    uint8_t index = payload[1];
+    if(!partial.active || partial.tag != tag) {
+        // The rest of one we've already finished or given up on
+        return 0;
+    }
+    if(index + 1 == partial.index) {
+        stats.duplicate++;
+        return 0;
+    }
+    uint16_t chunk = length - NEXT_HEADER_SIZE;
+    if(index != partial.index || partial.received + chunk > partial.length) {
+        partial.active = false;
+        stats.dropped++;
+        return 0;
+    }
+    memcpy(partial.data + partial.received, payload + NEXT_HEADER_SIZE, chunk);
+    partial.received += chunk;
+    partial.index++;
+    if(partial.received < partial.length) {
+        return 0;
+    }
+    partial.active = false;
+    datagram = partial.data;
+    return partial.length;
+}
+
+}
+}
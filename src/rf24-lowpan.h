@@ -0,0 +1,185 @@
+/**
+ * @file rf24-lowpan.h
+ * Carrying IP packets in 32 byte payloads: 6LoWPAN style header
+ * compression, and fragmentation
+ */
+#ifndef _RF24_LOWPAN_H_
+#define _RF24_LOWPAN_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace rf24 {
+namespace lowpan {
+
+/**
+ * A datagram is an IP packet, compressed, behind a dispatch byte:
+ *
+ * - 011xxxxx: IPv6 with an RFC 6282 IPHC header. The payload length, and
+ *   a UDP header's length, are always elided, since the fragments say
+ *   how long the datagram is. Addresses can't be derived from the link
+ *   layer, because the radio doesn't say who sent a payload, so the IPHC
+ *   address modes that need that aren't used.
+ * - 0x41: IPv6, uncompressed, as in RFC 4944.
+ * - 0x40: IPv4, uncompressed. This one is ours.
+ *
+ * Every payload then starts with a frame header:
+ *
+ * - 00tttttt: the whole of datagram t follows, in up to 31 bytes.
+ * - 10tttttt, then the datagram's size in two bytes, big endian: the first
+ *   29 bytes of datagram t.
+ * - 11tttttt, then the fragment's index: the next 30 bytes of datagram t.
+ *
+ * The sender tags each datagram with the next number, mod 64. Fragments
+ * must arrive in order, which they do over one link, but a repeated
+ * payload, from a retry whose ack got lost, is recognised by its tag and
+ * index and ignored.
+ */
+static const uint8_t PAYLOAD_SIZE = 32;
+static const uint16_t MTU = 1280;
+
+static const uint8_t FRAME_WHOLE = 0x00;
+static const uint8_t FRAME_FIRST = 0x80;
+static const uint8_t FRAME_NEXT = 0xc0;
+static const uint8_t FRAME_KIND_MASK = 0xc0;
+static const uint8_t FRAME_TAG_MASK = 0x3f;
+static const uint8_t WHOLE_HEADER_SIZE = 1;
+static const uint8_t FIRST_HEADER_SIZE = 3;
+static const uint8_t NEXT_HEADER_SIZE = 2;
+
+static const uint8_t DISPATCH_IPV4 = 0x40;
+static const uint8_t DISPATCH_IPV6 = 0x41;
+static const uint8_t DISPATCH_IPHC = 0x60;
+static const uint8_t DISPATCH_IPHC_MASK = 0xe0;
+
+/** The most a datagram can grow by: a dispatch byte on an uncompressed packet */
+static const uint16_t DATAGRAM_MAX = MTU + 1;
+
+/** Prefixes shared by everyone on the network, by IPHC context id */
+static const uint8_t CONTEXT_COUNT = 16;
+
+/**
+ * Compresses IP packets into datagrams, and back.
+ *
+ * Addresses under one of the configured /64 prefixes, the contexts,
+ * compress like link local ones do, so a sensor's global address costs 2
+ * or 8 bytes instead of 16. Every node on the network must be given the
+ * same contexts.
+ */
+class Compressor {
+public:
+    Compressor();
+
+    /**
+     * Set, or with NULL clear, context @p id.
+     * @return false if there's no such context id
+     */
+    bool context(uint8_t id, const uint8_t prefix[8]);
+
+    /**
+     * @return the datagram's length, or 0 if @p packet isn't an IP packet,
+     * or the datagram won't fit in @p size
+     */
+    uint16_t compress(const uint8_t *packet, uint16_t length, uint8_t *datagram, uint16_t size) const;
+
+    /**
+     * @return the packet's length, or 0 if the datagram is malformed, uses
+     * an unknown context, or the packet won't fit in @p size
+     */
+    uint16_t decompress(const uint8_t *datagram, uint16_t length, uint8_t *packet, uint16_t size) const;
+
+private:
+    uint8_t prefixes[CONTEXT_COUNT][8];
+    uint16_t valid;
+
+    int8_t findContext(const uint8_t *address) const;
+};
+
+/**
+ * Cuts datagrams into payloads.
+ */
+class Fragmenter {
+public:
+    Fragmenter();
+
+    /**
+     * Start sending @p datagram, which has to stay put until the last
+     * payload has been taken.
+     */
+    void start(const uint8_t *datagram, uint16_t length);
+
+    /**
+     * Is there a payload left to take?
+     */
+    inline bool pending() const {
+        return datagram != NULL;
+    }
+
+    /**
+     * Give up on the rest of the datagram.
+     */
+    inline void cancel() {
+        datagram = NULL;
+    }
+
+    /**
+     * Write the next payload into @p payload, which needs PAYLOAD_SIZE
+     * bytes.
+     * @return its length, or 0 if there isn't one
+     */
+    uint8_t next(uint8_t *payload);
+
+private:
+    const uint8_t *datagram;
+    uint16_t length;
+    uint16_t offset;
+    uint8_t index;
+    uint8_t tag;
+};
+
+/**
+ * Puts datagrams back together, one at a time from each of up to
+ * LINK_COUNT links, which are whatever the caller uses to tell senders
+ * apart: the radio's pipes, say.
+ */
+class Reassembler {
+public:
+    static const uint8_t LINK_COUNT = 6;
+
+    /** How long a datagram can take to arrive before it's given up on */
+    static const uint32_t TIMEOUT_MS = 2000;
+
+    Reassembler();
+
+    /**
+     * Take a payload received on @p link.
+     * @param nowMs a millisecond clock, for the timeout
+     * @param datagram set to the datagram, once the payload completes one.
+     * It stays valid until the next payload from the same link.
+     * @return the datagram's length, or 0 if there isn't one yet
+     */
+    uint16_t receive(uint8_t link, const uint8_t *payload, uint8_t length,
+            uint32_t nowMs, const uint8_t *&datagram);
+
+    struct {
+        uint32_t malformed;    //!< payloads that made no sense
+        uint32_t dropped;      //!< datagrams abandoned part way
+        uint32_t duplicate;    //!< repeated fragments ignored
+    } stats;
+
+private:
+    struct Partial {
+        uint8_t data[DATAGRAM_MAX];
+        uint16_t length;    //!< the whole datagram's
+        uint16_t received;
+        uint8_t tag;        //!< the last datagram's started
+        uint8_t index;      //!< the next fragment's
+        bool active;
+        uint32_t started;
+    } partials[LINK_COUNT];
+};
+
+}
+}
+
+#endif // _RF24_LOWPAN_H_
@@ -0,0 +1,29 @@
+
+/**
+ * @file rf24-model-timing.h
+ * Delays and clocks for the model, on its virtual clock
+ */
+#ifndef _RF24_MODEL_TIMING_H_
+#define _RF24_MODEL_TIMING_H_
+
+#ifdef RF24_MODEL
+#include <stdint.h>
+
+/**
+ * Move the shared model clock on by @p usec microseconds, running the
+ * chips as it goes.
+ */
+void rf24DelayMicroseconds(uint32_t usec);
+
+/**
+ * The shared model clock, in microseconds, wrapping like the Arduino one.
+ */
+uint32_t rf24Micros();
+
+/**
+ * The shared model clock, in milliseconds.
+ */
+uint32_t rf24Millis();
+
+#endif
+#endif // _RF24_MODEL_TIMING_H_
@@ -0,0 +1,885 @@
+
+#include "rf24-model.h"
+#include <math.h>
+#include <string.h>
+#include "nRF24L01.h"
+
+namespace rf24 {
+namespace model {
+
+static const uint8_t INTERRUPTS = (1 << RX_DR) | (1 << TX_DS) | (1 << MAX_RT);
+
+// The bits each one byte register keeps; the rest read as 0
+static const uint8_t WRITABLE[0x20] = {
+    0x7f, 0x3f, 0x3f, 0x03, 0xff, 0x7f, 0xbe, 0x00,     // CONFIG to STATUS
+    0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff,     // OBSERVE_TX to RX_ADDR_P5
+    0x00, 0x3f, 0x3f, 0x3f, 0x3f, 0x3f, 0x3f, 0x00,     // TX_ADDR to FIFO_STATUS
+    0x00, 0x00, 0x00, 0x00, 0x3f, 0x07, 0x00, 0x00      // DYNPD, FEATURE
+};
+
+Timer::Timer(Handler handler, void *arg)
+    : handler(handler), arg(arg), at(0), next(NULL), scheduled(false) {
+}
+
+Clock::Clock() : nowNs(0), timers(NULL) {
+}
+
+void Clock::schedule(Timer &timer, uint64_t at) {
+    cancel(timer);
+    timer.at = at < nowNs ? nowNs : at;
+    timer.scheduled = true;
+
+    // After any due at the same time, so they fire in the order they
+    // were scheduled
+    Timer **link = &timers;
+    while(*link != NULL && (*link)->at <= timer.at) {
+        link = &(*link)->next;
+    }
+    timer.next = *link;
+    *link = &timer;
+}
+
+void Clock::cancel(Timer &timer) {
+    if(!timer.scheduled) {
+        return;
+    }
+    for(Timer **link = &timers; *link != NULL; link = &(*link)->next) {
+        if(*link == &timer) {
+            *link = timer.next;
+            break;
+        }
+    }
+    timer.next = NULL;
+    timer.scheduled = false;
+}
+
+void Clock::fireNext() {
+    Timer *timer = timers;
+    timers = timer->next;
+    timer->next = NULL;
+    timer->scheduled = false;
+    nowNs = timer->at;
+    timer->handler(timer->arg);
+}
+
+void Clock::advanceTo(uint64_t at) {
+    while(timers != NULL && timers->at <= at) {
+        fireNext();
+    }
+    if(at > nowNs) {
+        nowNs = at;
+    }
+}
+
+bool Clock::step() {
+    if(timers == NULL) {
+        return false;
+    }
+    fireNext();
+    return true;
+}
+
+void Clock::reset() {
+    while(timers != NULL) {
+        cancel(*timers);
+    }
+    nowNs = 0;
+}
+
+Clock &Clock::shared() {
+    static Clock clock;
+    return clock;
+}
+
+static uint32_t bitsPerSecond(Rate rate) {
+    switch(rate) {
+    case RATE_2MBPS:
+        return 2000000;
+    case RATE_250KBPS:
+        return 250000;
+    default:
+        return 1000000;
+    }
+}
+
+// The datasheet's, for 0.1% bit errors
+static double sensitivity(Rate rate) {
+    switch(rate) {
+    case RATE_2MBPS:
+        return -82;
+    case RATE_250KBPS:
+        return -94;
+    default:
+        return -85;
+    }
+}
+
+// Channels are 1MHz apart, and a 2Mbps signal is 2MHz wide
+static bool overlap(uint8_t channel, Rate rate, uint8_t otherChannel, Rate otherRate) {
+    int apart = channel > otherChannel ? channel - otherChannel : otherChannel - channel;
+    return apart < ((rate == RATE_2MBPS || otherRate == RATE_2MBPS) ? 2 : 1);
+}
+
+uint32_t Packet::bits() const {
+    // The packet control field is 9 bits: length, PID and NO_ACK
+    uint8_t preamble = rate == RATE_2MBPS ? 2 : 1;
+    return 8 * (preamble + addressWidth + length + crc) + 9;
+}
+
+uint64_t Packet::airTime() const {
+    return (uint64_t)bits() * 1000000000 / bitsPerSecond(rate);
+}
+
+Air::Air(Clock &clock) : time(clock), chips(NULL), next(0), randomState(1) {
+    conditions.loss = 0;
+    conditions.bitErrorRate = 0;
+    conditions.pathLossExponent = 2;
+    conditions.captureDb = 9;
+    memset(&stats, 0, sizeof(stats));
+    memset(history, 0, sizeof(history));
+}
+
+void Air::attach(Chip *chip) {
+    chip->nextOnAir = chips;
+    chips = chip;
+}
+
+void Air::detach(Chip *chip) {
+    for(Chip **link = &chips; *link != NULL; link = &(*link)->nextOnAir) {
+        if(*link == chip) {
+            *link = chip->nextOnAir;
+            break;
+        }
+    }
+    for(uint16_t i = 0; i < HISTORY; i++) {
+        if(history[i].from == chip) {
+            history[i].from = NULL;
+        }
+    }
+}
+
+void Air::place(Chip &chip, double x, double y) {
+    chip.x = x;
+    chip.y = y;
+}
+
+double Air::power(const Chip &from, const Chip &to) const {
+    double distance = hypot(from.x - to.x, from.y - to.y);
+    if(distance < 1) {
+        distance = 1;
+    }
+    return from.powerDbm() - 40 - 10 * conditions.pathLossExponent * log10(distance);
+}
+
+void Air::seed(uint32_t seed) {
+    randomState = seed == 0 ? 1 : seed;
+}
+
+// xorshift32: plenty for deciding which packets get lost
+double Air::uniform() {
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState / 4294967296.0;
+}
+
+void Air::transmit(const Chip &from, const Packet &packet) {
+    Transmission &transmission = history[next];
+    next = (next + 1) % HISTORY;
+    transmission.from = &from;
+    transmission.channel = packet.channel;
+    transmission.rate = packet.rate;
+    transmission.start = time.now();
+    transmission.end = transmission.start + packet.airTime();
+    stats.transmissions++;
+}
+
+bool Air::collided(const Chip &from, const Chip &to, const Packet &packet, uint64_t start, double signal) const {
+    for(uint16_t i = 0; i < HISTORY; i++) {
+        const Transmission &other = history[i];
+        if(other.from == NULL || other.from == &from || other.from == &to
+                || other.end <= start || other.start >= time.now()
+                || !overlap(packet.channel, packet.rate, other.channel, other.rate)) {
+            continue;
+        }
+        if(signal - power(*other.from, to) < conditions.captureDb) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Air::deliver(const Chip &from, const Packet &packet, uint64_t start) {
+    for(Chip *chip = chips; chip != NULL; chip = chip->nextOnAir) {
+        if(chip == &from || (chip->state != Chip::RX && chip->state != Chip::ACK_WAIT)
+                || !overlap(packet.channel, packet.rate, chip->registers[RF_CH], chip->rate())) {
+            continue;
+        }
+        double signal = power(from, *chip);
+        if(chip->state == Chip::RX && signal >= RPD_DBM) {
+            chip->rpd = true;
+        }
+        if(packet.channel != chip->registers[RF_CH] || packet.rate != chip->rate()
+                || start < chip->listeningSince) {
+            continue;
+        }
+
+        if(signal < sensitivity(packet.rate)) {
+            stats.weak++;
+        } else if(collided(from, *chip, packet, start, signal)) {
+            stats.collisions++;
+        } else if(uniform() < conditions.loss
+                || (conditions.bitErrorRate > 0
+                    && uniform() >= pow(1 - conditions.bitErrorRate, packet.bits()))) {
+            stats.lost++;
+        } else {
+            chip->hear(packet);
+        }
+    }
+}
+
+void Chip::Fifo::clear() {
+    count = 0;
+}
+
+void Chip::Fifo::remove(uint8_t index) {
+    memmove(&entries[index], &entries[index + 1], (count - index - 1) * sizeof(Entry));
+    count--;
+}
+
+Chip::Entry *Chip::Fifo::push() {
+    return count == FIFO_DEPTH ? NULL : &entries[count++];
+}
+
+Chip::Chip(Air &air)
+    : air(air), nextOnAir(NULL), x(0), y(0), timer(fire, this), irqHandler(NULL), irqArg(NULL) {
+    memset(&spi, 0, sizeof(spi));
+    memset(&stats, 0, sizeof(stats));
+    air.attach(this);
+    reset();
+}
+
+Chip::~Chip() {
+    clock().cancel(timer);
+    air.detach(this);
+}
+
+void Chip::reset() {
+    clock().cancel(timer);
+
+    memset(registers, 0, sizeof(registers));
+    registers[CONFIG] = 0x08;
+    registers[EN_AA] = 0x3f;
+    registers[EN_RXADDR] = 0x03;
+    registers[SETUP_AW] = 0x03;
+    registers[SETUP_RETR] = 0x03;
+    registers[RF_CH] = 0x02;
+    registers[RF_SETUP] = 0x0e;
+    registers[RX_ADDR_P2] = 0xc3;
+    registers[RX_ADDR_P3] = 0xc4;
+    registers[RX_ADDR_P4] = 0xc5;
+    registers[RX_ADDR_P5] = 0xc6;
+    memset(rxAddress[0], 0xe7, sizeof(rxAddress[0]));
+    memset(rxAddress[1], 0xc2, sizeof(rxAddress[1]));
+    memset(txAddress, 0xe7, sizeof(txAddress));
+
+    status = 0;
+    observeTx = 0;
+    txFifo.clear();
+    rxFifo.clear();
+    reuse = false;
+    reuseSent = false;
+    flushed = false;
+
+    state = POWER_DOWN;
+    ceHigh = false;
+    cePulsed = false;
+    readyAt = 0;
+    listeningSince = 0;
+    rpd = false;
+    pid = 0;
+    retransmits = 0;
+    lastValid = false;
+    ackPayload = false;
+}
+
+uint8_t Chip::statusByte() const {
+    uint8_t pipe = rxFifo.count == 0 ? 0b111 : rxFifo.entries[0].pipe;
+    return status | (pipe << RX_P_NO) | (txFifo.count == FIFO_DEPTH ? 1 << TX_FULL : 0);
+}
+
+uint8_t Chip::fifoStatus() const {
+    return (reuse ? 1 << TX_REUSE : 0)
+            | (txFifo.count == FIFO_DEPTH ? 1 << FIFO_FULL : 0)
+            | (txFifo.count == 0 ? 1 << TX_EMPTY : 0)
+            | (rxFifo.count == FIFO_DEPTH ? 1 << RX_FULL : 0)
+            | (rxFifo.count == 0 ? 1 << RX_EMPTY : 0);
+}
+
+Rate Chip::rate() const {
+    if(registers[RF_SETUP] & (1 << RF_DR_LOW)) {
+        return RATE_250KBPS;
+    }
+    return (registers[RF_SETUP] & (1 << RF_DR_HIGH)) ? RATE_2MBPS : RATE_1MBPS;
+}
+
+// Enhanced ShockBurst forces the CRC on
+int8_t Chip::powerDbm() const {
+    return -18 + 6 * ((registers[RF_SETUP] >> 1) & 0x03);
+}
+
+uint8_t Chip::crcBytes() const {
+    if(!(registers[CONFIG] & (1 << EN_CRC)) && registers[EN_AA] == 0) {
+        return 0;
+    }
+    return (registers[CONFIG] & (1 << CRCO)) ? 2 : 1;
+}
+
+uint8_t Chip::addressWidth() const {
+    uint8_t aw = registers[SETUP_AW] & 0x03;
+    return aw == 0 ? 3 : aw + 2;
+}
+
+bool Chip::dynamicPipe(uint8_t pipe) const {
+    return (registers[FEATURE] & (1 << EN_DPL)) && (registers[DYNPD] & (1 << pipe));
+}
+
+// Pipes 2 to 5 share all but the first byte with pipe 1
+void Chip::pipeAddress(uint8_t pipe, uint8_t *address) const {
+    memcpy(address, rxAddress[pipe == 0 ? 0 : 1], sizeof(rxAddress[0]));
+    if(pipe > 1) {
+        address[0] = registers[RX_ADDR_P0 + pipe];
+    }
+}
+
+int8_t Chip::firstEntry(int8_t pipe) const {
+    for(uint8_t i = 0; i < txFifo.count; i++) {
+        if(txFifo.entries[i].pipe == pipe) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+uint8_t Chip::peek(uint8_t reg) const {
+    reg &= REGISTER_MASK;
+    switch(reg) {
+    case NRF_STATUS:
+        return statusByte();
+    case FIFO_STATUS:
+        return fifoStatus();
+    case OBSERVE_TX:
+        return observeTx;
+    case RPD:
+        return rpd ? 1 : 0;
+    case RX_ADDR_P0:
+    case RX_ADDR_P1:
+        return rxAddress[reg - RX_ADDR_P0][0];
+    case TX_ADDR:
+        return txAddress[0];
+    default:
+        return registers[reg];
+    }
+}
+
+bool Chip::irq() const {
+    return status & ~registers[CONFIG] & INTERRUPTS;
+}
+
+void Chip::onIrq(Handler handler, void *arg) {
+    irqHandler = handler;
+    irqArg = arg;
+}
+
+void Chip::notify(bool before) {
+    if(!before && irq() && irqHandler != NULL) {
+        irqHandler(irqArg);
+    }
+}
+
+void Chip::raise(uint8_t flags) {
+    bool before = irq();
+    status |= flags;
+    notify(before);
+}
+
+void Chip::readRegister(uint8_t reg, uint8_t *rx, uint8_t len) const {
+    if(rx == NULL) {
+        return;
+    }
+    memset(rx, 0, len);
+    if(reg == RX_ADDR_P0 || reg == RX_ADDR_P1 || reg == TX_ADDR) {
+        const uint8_t *address = reg == TX_ADDR ? txAddress : rxAddress[reg - RX_ADDR_P0];
+        memcpy(rx, address, len < sizeof(txAddress) ? len : sizeof(txAddress));
+    } else if(len > 0) {
+        rx[0] = peek(reg);
+    }
+}
+
+void Chip::writeRegister(uint8_t reg, const uint8_t *tx, uint8_t len) {
+    if(len == 0) {
+        return;
+    }
+
+    switch(reg) {
+    case RX_ADDR_P0:
+    case RX_ADDR_P1:
+    case TX_ADDR: {
+        // Least significant byte first, so a short write leaves the rest
+        uint8_t *address = reg == TX_ADDR ? txAddress : rxAddress[reg - RX_ADDR_P0];
+        memcpy(address, tx, len < sizeof(txAddress) ? len : sizeof(txAddress));
+        break;
+    }
+    case NRF_STATUS:
+        status &= ~(tx[0] & INTERRUPTS);
+        // Clearing MAX_RT lets the TX FIFO go again
+        update();
+        break;
+    case RF_CH:
+        registers[RF_CH] = tx[0] & WRITABLE[RF_CH];
+        observeTx &= 0x0f;
+        break;
+    case CONFIG: {
+        bool before = irq();
+        bool wasUp = registers[CONFIG] & (1 << PWR_UP);
+        registers[CONFIG] = tx[0] & WRITABLE[CONFIG];
+        if(!wasUp && (registers[CONFIG] & (1 << PWR_UP))) {
+            readyAt = clock().now() + POWER_UP_NS;
+        }
+        notify(before);
+        update();
+        break;
+    }
+    default:
+        registers[reg] = tx[0] & WRITABLE[reg];
+        break;
+    }
+}
+
+void Chip::writeTx(const uint8_t *tx, uint8_t len, bool noAck, int8_t pipe) {
+    if(pipe < 0 && reuse) {
+        // A new payload ends reuse, and the reused one with it
+        reuse = false;
+        if(reuseSent && firstEntry(-1) >= 0) {
+            txFifo.remove(firstEntry(-1));
+        }
+    }
+    Entry *entry = txFifo.push();
+    if(entry == NULL || len == 0) {
+        if(entry != NULL) {
+            txFifo.count--;
+        }
+        return;
+    }
+    memcpy(entry->payload, tx, len);
+    entry->length = len;
+    entry->noAck = noAck;
+    entry->pipe = pipe;
+    entry->pid = -1;
+    update();
+}
+
+uint8_t Chip::command(uint8_t cmd, const uint8_t *tx, uint8_t *rx, uint8_t len) {
+    uint8_t result = statusByte();
+    uint8_t ones[PAYLOAD_SIZE];
+    if(len > PAYLOAD_SIZE) {
+        len = PAYLOAD_SIZE;
+    }
+    if(tx == NULL) {
+        memset(ones, 0xff, sizeof(ones));
+        tx = ones;
+    }
+
+    if((cmd & ~REGISTER_MASK) == R_REGISTER) {
+        readRegister(cmd & REGISTER_MASK, rx, len);
+    } else if((cmd & ~REGISTER_MASK) == W_REGISTER) {
+        writeRegister(cmd & REGISTER_MASK, tx, len);
+    } else if((cmd & ~0x07) == W_ACK_PAYLOAD) {
+        if((cmd & 0x07) < PIPE_COUNT) {
+            writeTx(tx, len, false, cmd & 0x07);
+        }
+    } else {
+        switch(cmd) {
+        case R_RX_PAYLOAD:
+            if(rx != NULL) {
+                memset(rx, 0, len);
+            }
+            if(rxFifo.count > 0) {
+                const Entry &entry = rxFifo.entries[0];
+                if(rx != NULL) {
+                    memcpy(rx, entry.payload, len < entry.length ? len : entry.length);
+                }
+                rxFifo.remove(0);
+            }
+            break;
+        case R_RX_PL_WID:
+            if(rx != NULL && len > 0) {
+                rx[0] = rxFifo.count > 0 ? rxFifo.entries[0].length : 0;
+            }
+            break;
+        case W_TX_PAYLOAD:
+            writeTx(tx, len, false, -1);
+            break;
+        case W_TX_PAYLOAD_NO_ACK:
+            if(registers[FEATURE] & (1 << EN_DYN_ACK)) {
+                writeTx(tx, len, true, -1);
+            }
+            break;
+        case FLUSH_TX:
+            txFifo.clear();
+            reuse = false;
+            flushed = true;
+            break;
+        case FLUSH_RX:
+            rxFifo.clear();
+            break;
+        case REUSE_TX_PL:
+            reuse = true;
+            reuseSent = false;
+            break;
+        default:
+            // NOP, and ACTIVATE, which the + doesn't need
+            break;
+        }
+    }
+    return result;
+}
+
+void Chip::ce(bool level) {
+    if(level && !ceHigh) {
+        cePulsed = true;
+    }
+    ceHigh = level;
+    update();
+}
+
+bool Chip::canTransmit() const {
+    return !(status & (1 << MAX_RT)) && firstEntry(-1) >= 0;
+}
+
+// Move between power down, standby, RX and TX, as the registers, CE and
+// the TX FIFO say. A packet, or an ack, on its way finishes first.
+void Chip::update() {
+    if(!(registers[CONFIG] & (1 << PWR_UP))) {
+        clock().cancel(timer);
+        state = POWER_DOWN;
+        return;
+    }
+
+    bool rx = registers[CONFIG] & (1 << PRIM_RX);
+    switch(state) {
+    case TX_SETTLING:
+    case TX:
+    case ACK_WAIT:
+    case ACK_SETTLING:
+    case ACK_TX:
+        return;
+    case RX_SETTLING:
+    case RX:
+        if(ceHigh && rx) {
+            return;
+        }
+        clock().cancel(timer);
+        break;
+    default:
+        break;
+    }
+    state = STANDBY;
+
+    uint64_t ready = (readyAt > clock().now() ? readyAt : clock().now()) + SETTLE_NS;
+    if(rx) {
+        cePulsed = false;
+        if(ceHigh) {
+            state = RX_SETTLING;
+            clock().schedule(timer, ready);
+        }
+    } else if(ceHigh || cePulsed) {
+        // A pulse sends one payload, if there is one
+        cePulsed = false;
+        if(canTransmit()) {
+            state = TX_SETTLING;
+            clock().schedule(timer, ready);
+        }
+    }
+}
+
+void Chip::compose(Packet &packet, const uint8_t *address, const uint8_t *payload, uint8_t length) const {
+    memcpy(packet.address, address, sizeof(packet.address));
+    packet.addressWidth = addressWidth();
+    if(length > 0) {
+        memcpy(packet.payload, payload, length);
+    }
+    packet.length = length;
+    packet.pid = 0;
+    packet.noAck = false;
+    packet.dynamic = false;
+    packet.ack = false;
+    packet.crc = crcBytes();
+    packet.channel = registers[RF_CH];
+    packet.rate = rate();
+}
+
+void Chip::startTx(bool retransmit) {
+    if(retransmit) {
+        retransmits++;
+        observeTx = (observeTx & 0xf0) | retransmits;
+        stats.retransmits++;
+    } else {
+        // A payload keeps its PID until it's gone, so that sending it
+        // again after MAX_RT, or reusing it, looks like a retransmit
+        Entry &entry = txFifo.entries[firstEntry(-1)];
+        if(entry.pid < 0) {
+            pid = (pid + 1) & 0x03;
+            entry.pid = pid;
+        }
+        compose(onAir, txAddress, entry.payload, entry.length);
+        onAir.pid = entry.pid;
+        onAir.noAck = entry.noAck;
+        onAir.dynamic = dynamicPipe(0);
+        retransmits = 0;
+        observeTx &= 0xf0;
+        flushed = false;
+        stats.sent++;
+    }
+    state = TX;
+    send(onAir);
+}
+
+void Chip::send(const Packet &packet) {
+    air.transmit(*this, packet);
+    onAirStart = clock().now();
+    stats.airNs += packet.airTime();
+    clock().schedule(timer, onAirStart + packet.airTime());
+}
+
+// The end of a packet of ours: wait for its ack, if it wants one
+void Chip::sent() {
+    air.deliver(*this, onAir, onAirStart);
+    if(!onAir.noAck && (registers[EN_AA] & (1 << ENAA_P0))) {
+        // ARD runs from the end of one transmission to the start of the
+        // next
+        uint64_t ard = 250000 * ((registers[SETUP_RETR] >> ARD) + 1);
+        state = ACK_WAIT;
+        listeningSince = clock().now() + SETTLE_NS;
+        clock().schedule(timer, clock().now() + ard);
+    } else {
+        delivered();
+    }
+}
+
+void Chip::delivered() {
+    if(!flushed) {
+        if(reuse) {
+            reuseSent = true;
+        } else {
+            txFifo.remove(firstEntry(-1));
+        }
+    }
+    state = STANDBY;
+    raise(1 << TX_DS);
+    update();
+}
+
+void Chip::expired() {
+    if(retransmits < (registers[SETUP_RETR] & 0x0f)) {
+        startTx(true);
+        return;
+    }
+
+    if((observeTx >> PLOS_CNT) < 0x0f) {
+        observeTx += 1 << PLOS_CNT;
+    }
+    stats.maxRetries++;
+    state = STANDBY;
+    raise(1 << MAX_RT);
+    update();
+}
+
+static uint32_t checksum(const Packet &packet) {
+    uint32_t hash = 2166136261u ^ packet.length;
+    for(uint8_t i = 0; i < packet.length; i++) {
+        hash = (hash ^ packet.payload[i]) * 16777619u;
+    }
+    return hash;
+}
+
+void Chip::hear(const Packet &packet) {
+    if(state == ACK_WAIT) {
+        if(packet.ack) {
+            hearAck(packet);
+        }
+        return;
+    }
+    if(state != RX || packet.ack
+            || packet.addressWidth != addressWidth() || packet.crc != crcBytes()) {
+        return;
+    }
+
+    uint8_t pipe;
+    uint8_t address[5];
+    for(pipe = 0; pipe < PIPE_COUNT; pipe++) {
+        pipeAddress(pipe, address);
+        if((registers[EN_RXADDR] & (1 << pipe))
+                && memcmp(address, packet.address, packet.addressWidth) == 0) {
+            break;
+        }
+    }
+    // The packet control field, or the length, doesn't parse as this
+    // pipe expects, so the CRC fails
+    if(pipe == PIPE_COUNT || dynamicPipe(pipe) != packet.dynamic
+            || (!packet.dynamic && packet.length != registers[RX_PW_P0 + pipe])) {
+        return;
+    }
+
+    bool autoAck = (registers[EN_AA] & (1 << pipe)) && !packet.noAck;
+    uint32_t crc = checksum(packet);
+    if(autoAck && lastValid && packet.pid == lastPid && crc == lastCrc) {
+        // Our ack was lost: ack it again, and drop it
+        stats.duplicates++;
+        ackPayload = false;
+    } else {
+        Entry *entry = rxFifo.push();
+        if(entry == NULL) {
+            // Not acked, so the PTX tries again
+            stats.overflows++;
+            return;
+        }
+        memcpy(entry->payload, packet.payload, packet.length);
+        entry->length = packet.length;
+        entry->pipe = pipe;
+        lastPid = packet.pid;
+        lastCrc = crc;
+        lastValid = true;
+        stats.received++;
+        raise(1 << RX_DR);
+
+        if(autoAck) {
+            int8_t index = -1;
+            if((registers[FEATURE] & (1 << EN_ACK_PAY)) && (registers[FEATURE] & (1 << EN_DPL))) {
+                index = firstEntry(pipe);
+            }
+            if(index >= 0) {
+                const Entry &payload = txFifo.entries[index];
+                compose(ack, packet.address, payload.payload, payload.length);
+                txFifo.remove(index);
+            } else {
+                compose(ack, packet.address, NULL, 0);
+            }
+            ack.ack = true;
+            ack.pid = packet.pid;
+            ack.dynamic = registers[FEATURE] & (1 << EN_DPL);
+            ackPayload = index >= 0;
+        }
+    }
+
+    if(autoAck) {
+        state = ACK_SETTLING;
+        clock().schedule(timer, clock().now() + SETTLE_NS);
+    }
+}
+
+void Chip::hearAck(const Packet &packet) {
+    if(packet.addressWidth != addressWidth() || packet.crc != crcBytes() || packet.pid != onAir.pid
+            || memcmp(packet.address, rxAddress[0], packet.addressWidth) != 0) {
+        return;
+    }
+    Entry *entry = NULL;
+    if(packet.length > 0) {
+        // Without these, or with nowhere to put it, the ack doesn't parse,
+        // or isn't taken, and the PTX tries again
+        if(!(registers[FEATURE] & (1 << EN_ACK_PAY)) || !(registers[FEATURE] & (1 << EN_DPL))
+                || (entry = rxFifo.push()) == NULL) {
+            return;
+        }
+        memcpy(entry->payload, packet.payload, packet.length);
+        entry->length = packet.length;
+        entry->pipe = 0;
+        stats.received++;
+    }
+
+    clock().cancel(timer);
+    stats.acked++;
+    if(entry != NULL) {
+        raise(1 << RX_DR);
+    }
+    delivered();
+}
+
+void Chip::fire(void *arg) {
+    Chip *chip = (Chip *)arg;
+    switch(chip->state) {
+    case RX_SETTLING:
+        chip->state = RX;
+        chip->listeningSince = chip->clock().now();
+        chip->rpd = false;
+        break;
+    case TX_SETTLING:
+        // The FIFO could have been flushed while the PLL settled
+        if(chip->canTransmit()) {
+            chip->startTx(false);
+        } else {
+            chip->state = STANDBY;
+            chip->update();
+        }
+        break;
+    case TX:
+        chip->sent();
+        break;
+    case ACK_WAIT:
+        chip->expired();
+        break;
+    case ACK_SETTLING:
+        chip->state = ACK_TX;
+        chip->stats.acksSent++;
+        chip->send(chip->ack);
+        break;
+    case ACK_TX:
+        chip->air.deliver(*chip, chip->ack, chip->onAirStart);
+        chip->state = STANDBY;
+        if(chip->ackPayload) {
+            chip->ackPayload = false;
+            chip->raise(1 << TX_DS);
+        }
+        chip->update();
+        break;
+    default:
+        break;
+    }
+}
+
+Io::Io(Chip *chip, uint32_t speed) : chip(chip), speed(speed) {
+}
+
+uint8_t Io::transaction(uint8_t cmd, const uint8_t *tx, uint8_t *rx, uint8_t len) {
+    uint64_t ns = (uint64_t)(len + 1) * 8 * 1000000000 / speed;
+    chip->spi.transactions++;
+    chip->spi.bytes += len + 1;
+    chip->spi.busyNs += ns;
+    chip->clock().advance(ns);
+    return chip->command(cmd, tx, rx, len);
+}
+
+void Io::ce(bool level) {
+    chip->ce(level);
+}
+
+}
+}
+
+#ifdef RF24_MODEL
+
+using rf24::model::Clock;
+
+void rf24DelayMicroseconds(uint32_t usec) {
+    Clock::shared().advance((uint64_t)usec * 1000);
+}
+
+uint32_t rf24Micros() {
+    return (uint32_t)(Clock::shared().now() / 1000);
+}
+
+uint32_t rf24Millis() {
+    return (uint32_t)(Clock::shared().now() / 1000000);
+}
+
+#endif // RF24_MODEL
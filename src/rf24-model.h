@@ -0,0 +1,433 @@
+
+/**
+ * @file rf24-model.h
+ * A register level model of the nRF24L01+, on a virtual clock, for
+ * running the driver on a host without a radio
+ */
+#ifndef _RF24_MODEL_H_
+#define _RF24_MODEL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace rf24 {
+namespace model {
+
+static const uint8_t PAYLOAD_SIZE = 32;
+static const uint8_t FIFO_DEPTH = 3;
+static const uint8_t PIPE_COUNT = 6;
+
+/** Power down to standby, with the crystal already running */
+static const uint64_t POWER_UP_NS = 1500000;
+/** Standby to RX or TX, and RX to TX and back for an ack */
+static const uint64_t SETTLE_NS = 130000;
+
+typedef void (*Handler)(void *arg);
+
+/**
+ * Something to call back at a virtual time. It belongs to whoever made
+ * it, and the Clock only links it in while it's scheduled.
+ */
+class Timer {
+public:
+    Timer(Handler handler, void *arg);
+
+    inline bool pending() const {
+        return scheduled;
+    }
+
+    inline uint64_t when() const {
+        return at;
+    }
+
+private:
+    friend class Clock;
+    const Handler handler;
+    void * const arg;
+    uint64_t at;
+    Timer *next;
+    bool scheduled;
+
+    Timer(const Timer &) = delete;
+    Timer &operator=(const Timer &) = delete;
+};
+
+/**
+ * Virtual time, in nanoseconds, which only moves when someone moves it:
+ * the driver, by waiting or by using the bus, or a test. Timers fire in
+ * order of time, and then of scheduling, as time passes them, so a run is
+ * the same every time, and as fast as the host can go.
+ */
+class Clock {
+public:
+    Clock();
+
+    inline uint64_t now() const {
+        return nowNs;
+    }
+
+    /**
+     * Fire @p timer at @p at, or now if that's already past. A pending
+     * timer is moved.
+     */
+    void schedule(Timer &timer, uint64_t at);
+
+    void cancel(Timer &timer);
+
+    /**
+     * Move time on to @p at, firing every timer due by then. Handlers can
+     * schedule and cancel timers, and move time on too, as a node's code
+     * does when it uses the bus: timers that come due meanwhile fire
+     * inside, as they would while that node's processor was busy.
+     */
+    void advanceTo(uint64_t at);
+
+    inline void advance(uint64_t ns) {
+        advanceTo(nowNs + ns);
+    }
+
+    /**
+     * Move time on to the next timer, and fire it.
+     * @return false if there wasn't one
+     */
+    bool step();
+
+    /**
+     * Back to time 0, with nothing scheduled.
+     */
+    void reset();
+
+    /**
+     * The clock the driver's delay(), millis() and micros() follow, when
+     * it's built with RF24_MODEL.
+     */
+    static Clock &shared();
+
+private:
+    uint64_t nowNs;
+    Timer *timers;
+
+    void fireNext();
+
+    Clock(const Clock &) = delete;
+    Clock &operator=(const Clock &) = delete;
+};
+
+/** The modem's bit rates, as RF_SETUP encodes them */
+enum Rate {
+    RATE_1MBPS,
+    RATE_2MBPS,
+    RATE_250KBPS
+};
+
+/**
+ * An Enhanced ShockBurst packet, as it goes over the air.
+ */
+struct Packet {
+    uint8_t address[5];
+    uint8_t addressWidth;
+    uint8_t payload[PAYLOAD_SIZE];
+    uint8_t length;
+    uint8_t pid;
+    bool noAck;
+    bool dynamic;     //!< carries its length, for a dynamic payload pipe
+    bool ack;
+    uint8_t crc;      //!< CRC bytes, 0, 1 or 2
+    uint8_t channel;
+    Rate rate;
+
+    /**
+     * How many bits go over the air: the preamble, address, packet
+     * control field, payload and CRC.
+     */
+    uint32_t bits() const;
+
+    uint64_t airTime() const;
+};
+
+class Chip;
+
+/** A carrier this strong, or stronger, sets RPD */
+static const int8_t RPD_DBM = -64;
+
+/**
+ * What the chips send over, many of them at once, as a discrete event
+ * simulation on the clock.
+ *
+ * Each chip sits somewhere on a plane, and what another receives from it
+ * falls off with distance, by a log-distance path loss from 40dB at 1m.
+ * A listening chip on the same channel and bit rate hears a packet that
+ * lasted the whole time it was listening, if it's above the sensitivity
+ * for that bit rate. It loses it, though, to another transmission on the
+ * channel that overlaps it, unless the packet is stronger by the capture
+ * margin. It also loses it to the loss and bit error rates, because a bit
+ * error always fails the CRC. At 2Mbps, a packet takes up two channels.
+ */
+class Air {
+public:
+    /** How many recent transmissions collisions are found among */
+    static const uint16_t HISTORY = 256;
+
+    Air(Clock &clock = Clock::shared());
+
+    inline Clock &clock() const {
+        return time;
+    }
+
+    struct {
+        double loss;                //!< the chance of losing any packet
+        double bitErrorRate;
+        double pathLossExponent;    //!< 2 in free space, 3 or so indoors
+        double captureDb;           //!< co-channel rejection
+    } conditions;
+
+    /**
+     * Put @p chip at @p x, @p y, in metres. They all start at 0, 0.
+     */
+    void place(Chip &chip, double x, double y);
+
+    /**
+     * What @p to receives of @p from, in dBm, given @p from's RF_SETUP.
+     */
+    double power(const Chip &from, const Chip &to) const;
+
+    /**
+     * Restart the random numbers for loss and bit errors.
+     */
+    void seed(uint32_t seed);
+
+    /**
+     * Each counts once for each listening chip that missed a packet.
+     */
+    struct {
+        uint32_t transmissions;
+        uint32_t weak;          //!< below the sensitivity
+        uint32_t collisions;
+        uint32_t lost;          //!< to the loss or bit error rates
+    } stats;
+
+private:
+    friend class Chip;
+
+    struct Transmission {
+        const Chip *from;
+        uint8_t channel;
+        Rate rate;
+        uint64_t start;
+        uint64_t end;
+    };
+
+    Clock &time;
+    Chip *chips;
+    Transmission history[HISTORY];
+    uint16_t next;
+    uint32_t randomState;
+
+    void attach(Chip *chip);
+    void detach(Chip *chip);
+    void transmit(const Chip &from, const Packet &packet);
+    void deliver(const Chip &from, const Packet &packet, uint64_t start);
+    bool collided(const Chip &from, const Chip &to, const Packet &packet, uint64_t start, double signal) const;
+    double uniform();
+
+    Air(const Air &) = delete;
+    Air &operator=(const Air &) = delete;
+};
+
+/**
+ * An nRF24L01+, from the SPI commands and CE down: the register file, the
+ * three deep TX and RX FIFOs, the power, standby, RX and TX states and
+ * their settling times, and Enhanced ShockBurst, with auto ack,
+ * retransmits timed by SETUP_RETR, PID duplicate detection, dynamic
+ * payloads, ack payloads and NO_ACK payloads.
+ *
+ * Registers can be written in any state, which the real chip only
+ * promises in standby and power down, because the driver relies on it.
+ * A PRX ignores acks, even ones to its address, and RPD goes high for a
+ * strong packet, rather than for 40us of any carrier.
+ */
+class Chip {
+public:
+    Chip(Air &air);
+    ~Chip();
+
+    /**
+     * Power on: the registers' reset values, empty FIFOs, powered down.
+     */
+    void reset();
+
+    /**
+     * Run an SPI command, as the bus would once CSN goes high.
+     * @return the status byte, as clocked out during the command byte
+     */
+    uint8_t command(uint8_t cmd, const uint8_t *tx, uint8_t *rx, uint8_t len);
+
+    void ce(bool level);
+
+    /**
+     * A register, as R_REGISTER would read it, without using the bus.
+     */
+    uint8_t peek(uint8_t reg) const;
+
+    /**
+     * Is IRQ asserted, that is low? It is while any of RX_DR, TX_DS and
+     * MAX_RT is set and not masked in CONFIG.
+     */
+    bool irq() const;
+
+    /**
+     * Call @p handler whenever IRQ goes low. It's called from the middle
+     * of the chip's, and the air's, work, so it mustn't move time, which
+     * rules out using the bus: it can only note the edge, or schedule a
+     * timer to handle it, as an interrupt would defer to a thread.
+     */
+    void onIrq(Handler handler, void *arg);
+
+    inline Clock &clock() const {
+        return air.clock();
+    }
+
+    struct {
+        uint32_t transactions;
+        uint32_t bytes;         //!< including the command bytes
+        uint64_t busyNs;        //!< the Io's, with CSN low
+    } spi;
+
+    struct {
+        uint32_t sent;          //!< packets sent, not counting retransmits
+        uint32_t retransmits;
+        uint32_t acked;
+        uint32_t maxRetries;
+        uint32_t received;      //!< payloads put in the RX FIFO
+        uint32_t duplicates;
+        uint32_t overflows;     //!< packets lost to a full RX FIFO
+        uint32_t acksSent;
+        uint64_t airNs;         //!< time spent sending, acks included
+    } stats;
+
+private:
+    friend class Air;
+
+    enum State {
+        POWER_DOWN,
+        STANDBY,
+        RX_SETTLING,
+        RX,
+        TX_SETTLING,
+        TX,
+        ACK_WAIT,       //!< PTX, listening for the ack
+        ACK_SETTLING,   //!< PRX, turning round to send an ack
+        ACK_TX
+    };
+
+    struct Entry {
+        uint8_t payload[PAYLOAD_SIZE];
+        uint8_t length;
+        bool noAck;
+        int8_t pipe;    //!< an ack payload's, or a received payload's; -1 otherwise
+        int8_t pid;     //!< once it has been sent, or -1
+    };
+
+    struct Fifo {
+        Entry entries[FIFO_DEPTH];
+        uint8_t count;
+
+        void clear();
+        void remove(uint8_t index);
+        Entry *push();
+    };
+
+    Air &air;
+    Chip *nextOnAir;
+    double x;
+    double y;
+    Timer timer;
+    Handler irqHandler;
+    void *irqArg;
+
+    uint8_t registers[0x20];
+    uint8_t rxAddress[2][5];
+    uint8_t txAddress[5];
+    uint8_t status;         //!< just the interrupt flags
+    uint8_t observeTx;
+    Fifo txFifo;
+    Fifo rxFifo;
+    bool reuse;
+    bool reuseSent;         //!< the reused payload has gone at least once
+    bool flushed;           //!< FLUSH_TX while a payload was on the air
+
+    State state;
+    bool ceHigh;
+    bool cePulsed;          //!< a rising edge that hasn't started a packet yet
+    uint64_t readyAt;       //!< when the oscillator is up after PWR_UP
+    uint64_t listeningSince;
+    bool rpd;
+
+    Packet onAir;           //!< being sent, or waited on for an ack
+    uint64_t onAirStart;
+    uint8_t pid;
+    uint8_t retransmits;
+    uint8_t lastPid;        //!< the last packet received, for duplicates
+    uint32_t lastCrc;
+    bool lastValid;
+    Packet ack;             //!< the last ack, which a duplicate gets again
+    bool ackPayload;        //!< the ack about to go took a payload from the FIFO
+
+    uint8_t statusByte() const;
+    uint8_t fifoStatus() const;
+    Rate rate() const;
+    int8_t powerDbm() const;
+    uint8_t crcBytes() const;
+    uint8_t addressWidth() const;
+    bool dynamicPipe(uint8_t pipe) const;
+    void pipeAddress(uint8_t pipe, uint8_t *address) const;
+    int8_t firstEntry(int8_t pipe) const;
+    void readRegister(uint8_t reg, uint8_t *rx, uint8_t len) const;
+    void writeRegister(uint8_t reg, const uint8_t *tx, uint8_t len);
+    void writeTx(const uint8_t *tx, uint8_t len, bool noAck, int8_t pipe);
+    void raise(uint8_t flags);
+    void notify(bool before);
+    void compose(Packet &packet, const uint8_t *address, const uint8_t *payload, uint8_t length) const;
+
+    void update();
+    bool canTransmit() const;
+    void startTx(bool retransmit);
+    void send(const Packet &packet);
+    void sent();
+    void delivered();
+    void expired();
+    void hear(const Packet &packet);
+    void hearAck(const Packet &packet);
+
+    static void fire(void *arg);
+
+    Chip(const Chip &) = delete;
+    Chip &operator=(const Chip &) = delete;
+};
+
+/**
+ * The RF24 IO for a Chip. Each transaction takes as long as it would on a
+ * bus at @p speed, with nothing in between, on the Air's clock.
+ */
+class Io {
+public:
+    Io(Chip *chip, uint32_t speed = 8000000);
+
+    Io(const Io &io) = default;
+
+    inline void begin() {
+    }
+
+    uint8_t transaction(uint8_t cmd, const uint8_t *tx, uint8_t *rx, uint8_t len);
+
+    void ce(bool level);
+
+private:
+    Chip *chip;
+    uint32_t speed;
+};
+
+}
+}
+
+#endif // _RF24_MODEL_H_
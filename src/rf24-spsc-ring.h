@@ -0,0 +1,164 @@
+
+/**
+ * @file rf24-spsc-ring.h
+ * A lock free ring for handing items from one thread to another.
+ */
+#ifndef _RF24_SPSC_RING_H_
+#define _RF24_SPSC_RING_H_
+
+#include <stddef.h>
+#include <atomic>
+
+namespace rf24 {
+
+/**
+ * A single producer, single consumer ring.
+ *
+ * Only the producer calls put() and the producer side of the wait
+ * protocol, and only the consumer calls get() and the consumer side.
+ * Each index is written by one side only, so neither side needs a lock,
+ * and only loads and stores are used, which are lock free even on
+ * Cortex-M0.
+ *
+ * The ring doesn't block. Instead, a side that wants to sleep because the
+ * ring is full (or empty) arms the ring, and the other side asks the ring
+ * whether it needs waking after every put() (or get()). So the two sides
+ * only need to involve the kernel when one of them actually goes to sleep.
+ *
+ * The storage has one more slot than the ring's capacity, so that a full
+ * ring can be told apart from an empty one.
+ */
+template<typename T>
+class SpscRing {
+private:
+    T * const slots;
+    const size_t size;
+    std::atomic<size_t> head; /**< The next slot to write, owned by the producer */
+    std::atomic<size_t> tail; /**< The next slot to read, owned by the consumer */
+    std::atomic<bool> producerWaiting;
+    std::atomic<bool> consumerWaiting;
+
+    inline size_t next(size_t index) const {
+        return (index + 1 == size) ? 0 : index + 1;
+    }
+
+public:
+    /**
+     * @param slots storage for the ring
+     * @param size the number of slots, one more than the capacity
+     */
+    SpscRing(T *slots, size_t size) : slots(slots), size(size) {
+        reset();
+    }
+
+    /**
+     * Empty the ring. Only call this when neither side is using it.
+     */
+    void reset() {
+        head.store(0);
+        tail.store(0);
+        producerWaiting.store(false);
+        consumerWaiting.store(false);
+    }
+
+    size_t capacity() const {
+        return size - 1;
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+    bool full() const {
+        return next(head.load(std::memory_order_acquire)) == tail.load(std::memory_order_acquire);
+    }
+
+    size_t count() const {
+        size_t h = head.load(std::memory_order_acquire);
+        size_t t = tail.load(std::memory_order_acquire);
+        return (h >= t) ? h - t : h + size - t;
+    }
+
+    /**
+     * Add an item. Producer only.
+     * @return false if the ring is full
+     */
+    bool put(const T &item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t n = next(h);
+        if(n == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        slots[h] = item;
+        head.store(n);
+        return true;
+    }
+
+    /**
+     * Remove the oldest item. Consumer only.
+     * @return false if the ring is empty
+     */
+    bool get(T &item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if(t == head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = slots[t];
+        tail.store(next(t));
+        return true;
+    }
+
+    /**
+     * Producer only: ask to be woken when the ring stops being full.
+     * @return true if the ring is still full, so the producer should sleep
+     * until the consumer wakes it, false if it should just try again.
+     */
+    bool armProducer() {
+        producerWaiting.store(true);
+        if(!full()) {
+            producerWaiting.store(false);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Consumer only: ask to be woken when the ring stops being empty.
+     * @return true if the ring is still empty, so the consumer should sleep
+     * until the producer wakes it, false if it should just try again.
+     */
+    bool armConsumer() {
+        consumerWaiting.store(true);
+        if(!empty()) {
+            consumerWaiting.store(false);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Consumer only, after get(): does the producer need waking?
+     */
+    bool wakeProducer() {
+        if(producerWaiting.load()) {
+            producerWaiting.store(false);
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * Producer only, after put(): does the consumer need waking?
+     */
+    bool wakeConsumer() {
+        if(consumerWaiting.load()) {
+            consumerWaiting.store(false);
+            return true;
+        }
+        return false;
+    }
+};
+
+}
+
+#endif // _RF24_SPSC_RING_H_
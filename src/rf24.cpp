@@ -18,5 +18,14 @@ const std::array<SettingValue, 4> RF24InternalSettings::INIT = {
 const SettingValue RF24InternalSettings::Power::UP;
 const SettingValue RF24InternalSettings::Power::DOWN;
 const SettingValue RF24InternalSettings::PrimaryRx::ENABLE;
+const SettingValue RF24InternalSettings::PrimaryRx::DISABLE;
 
 const SettingValue Power::MAX;
+
+constexpr DataRateOption DataRate::_1MBPS;
+constexpr DataRateOption DataRate::_250KBPS;
+constexpr DataRateOption DataRate::_2MBPS;
+
+constexpr BooleanSetting DynamicPayload::feature;
+constexpr BooleanSetting DynamicPayload::all;
+constexpr BooleanSetting AutoAck::all;
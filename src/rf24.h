@@ -42,10 +42,11 @@ struct FifoStatus {
   bool rxEmpty() { return status & _BV(RX_EMPTY); }
   bool rxFull() { return status & _BV(RX_FULL); }
   bool txEmpty() { return status & _BV(TX_EMPTY); }
-  bool txFull() { return status & _BV(TX_FULL); }
+  bool txFull() { return status & _BV(FIFO_FULL); }
 };
 
 class RF24InternalSettings {
+protected:
   class PrimaryRx {
   public:
      static constexpr Setting setting = { CONFIG, _BV(PRIM_RX) };
@@ -96,13 +97,20 @@ class RF24InternalSettings {
       return RX_ADDR_P0 + rf24_min(5, pipe);
     }
     static constexpr uint8_t payloadLengthRegister(uint8_t pipe) {
-      return RX_ADDR_P0 + rf24_min(5, pipe);
+      return RX_PW_P0 + rf24_min(5, pipe);
     }
   };
 };
 
 /**
  * Driver for nRF24L01(+) 2.4GHz Wireless Transceiver
+ *
+ * IO is the board's interface to the radio. It provides begin(), ce(level),
+ * and transaction(cmd, tx, rx, len), which selects the radio, sends the
+ * command byte and len data bytes (from tx, or 0xff if tx is NULL), keeps
+ * the data bytes that come back in rx if it isn't NULL, and returns the
+ * status byte. Every register and payload access is one transaction, so an
+ * IO can do each in a single transfer.
  */
 
 template<typename IO, uint8_t addressWidth>
@@ -113,6 +121,7 @@ private:
   uint8_t pipe0_reading_address[5]; /**< Last address set on pipe 0 for reading. */
   uint32_t txRxDelay; /**< Var for adjusting delays depending on datarate */
   bool ackPayloads;
+  uint8_t configCache; /**< Last value written to, or read from, CONFIG by set() */
 
   static constexpr uint8_t child_pipe_enable[] PROGMEM =
   {
@@ -128,7 +137,8 @@ public:
    */
   /**@{*/
 
-  RF24(IO io) : io(io) {}
+  RF24(IO io) : io(io), pipe0_reading_address(), txRxDelay(RF24_1MBPS_TX_RX_DELAY),
+      ackPayloads(false), configCache(0), failureDetected(false) {}
 
   typedef enum {
     ERROR = 0,
@@ -142,12 +152,14 @@ public:
    * This is done by reading back the register(s)
    */
   SetResult set(SettingValue value) {
-      uint8_t regvalue = read_register(value.setting.reg);
-      regvalue &= ~value.setting.mask;
-      uint8_t newvalue = regvalue | (value.value & value.setting.mask);
-      if(newvalue != regvalue) {
-          write_register(value.setting.reg, regvalue);
-          return (read_register(value.setting.reg) == regvalue) ? UPDATED : ERROR;
+      uint8_t oldvalue = read_register(value.setting.reg);
+      uint8_t newvalue = (oldvalue & ~value.setting.mask) | (value.value & value.setting.mask);
+      if(value.setting.reg == CONFIG) {
+          configCache = newvalue;
+      }
+      if(newvalue != oldvalue) {
+          write_register(value.setting.reg, newvalue);
+          return (read_register(value.setting.reg) == newvalue) ? UPDATED : ERROR;
       } else {
           return UNCHANGED;
       }
@@ -161,7 +173,7 @@ public:
    * UPDATED otherwise.
    * If ERROR is returned, which settings have been applied is undefined.
    */
-  template<unsigned int N>
+  template<size_t N>
   SetResult set(const std::array<SettingValue, N> &settings) {
     SetResult result = UNCHANGED;
     for(SettingValue setting: settings) {
@@ -288,6 +300,28 @@ public:
     set(Receive::pipe(0).enable());
   }
 
+  /**
+   * Switch between receiving and transmitting with one register write.
+   *
+   * startListening() and stopListening() read back and rewrite the power,
+   * the pipes and the FIFOs every time. This leaves all that alone, so
+   * it's only for a radio that has been set up already, with pipe 0 left
+   * open on the writing address so that acks can come back. In transmit
+   * mode CE stays high, so anything in the TX FIFO goes straight out.
+   *
+   * @param rx true to receive, false to transmit
+   */
+  void turnaround(bool rx) {
+    io.ce(LOW);
+    if(rx) {
+      configCache |= _BV(PRIM_RX);
+    } else {
+      configCache &= ~_BV(PRIM_RX);
+    }
+    write_register(CONFIG, configCache);
+    io.ce(HIGH);
+  }
+
 
   /**
    * Read the available payload
@@ -316,6 +350,15 @@ public:
     resetStatus();
   }
 
+  /**
+   * Read the available payload, leaving the interrupt flags alone, for
+   * callers that clear them with resetStatus(Status).
+   * @return the status before the read
+   */
+  Status readPayload(void* buf, uint8_t len) {
+    return { read_payload(buf, len) };
+  }
+
   /**
    * Be sure to call openWritingPipe() first to set the destination
    * of where to write to.
@@ -454,7 +497,7 @@ public:
    */
   void powerDown(void) {
     io.ce(LOW);
-    return set(Power::DOWN);
+    set(Power::DOWN);
   }
 
 
@@ -658,6 +701,15 @@ public:
       return write_register(NRF_STATUS, _BV(RX_DR) | _BV(TX_DS) | _BV(MAX_RT));
   }
 
+  /**
+   * Clear just the interrupt flags set in @p seen. Unlike resetStatus(),
+   * this can't clear a flag raised after the status was read, which would
+   * leave the IRQ line low with no edge to report it.
+   */
+  Status resetStatus(Status seen) {
+      return write_register(NRF_STATUS, seen.status & (_BV(RX_DR) | _BV(TX_DS) | _BV(MAX_RT)));
+  }
+
   /**
    * Get the fifo status.
    * You can find out here if the device is ready to accept more
@@ -786,7 +838,9 @@ public:
    * @endcode
    * @return true if signal => -64dBm, false if not
    */
-  bool testRPD(void) ;
+  bool testRPD(void) {
+    return read_register(RPD) & 1;
+  }
 
   /**
    * Test whether this is a real radio, or a mock shim for
@@ -866,12 +920,7 @@ public:
    */
   uint8_t getDynamicPayloadSize(void) {
     uint8_t result = 0;
-
-    io.beginTransaction();
-    io.transfer( R_RX_PL_WID );
-    result = io.transfer(0xff);
-    io.endTransaction();
-
+    io.transaction(R_RX_PL_WID, NULL, &result, 1);
     return result;
   }
 
@@ -965,12 +1014,7 @@ private:
    */
   uint8_t read_register(uint8_t reg) {
     uint8_t result;
-
-    io.beginTransaction();
-    io.transfer(R_REGISTER | (REGISTER_MASK & reg));
-    result = io.transfer(0xff);
-    io.endTransaction();
-
+    io.transaction(R_REGISTER | (REGISTER_MASK & reg), NULL, &result, 1);
     return result;
   }
 
@@ -982,20 +1026,11 @@ private:
    * @return Current value of status register
    */
   Status write_register(uint8_t reg, uint8_t value) {
-    io.beginTransaction();
-    uint8_t status = io.transfer(W_REGISTER | (REGISTER_MASK & reg));
-    io.transfer(value);
-    io.endTransaction();
-
-    return { status };
+    return { io.transaction(W_REGISTER | (REGISTER_MASK & reg), &value, NULL, 1) };
   }
 
   Status write_register(uint8_t reg, const uint8_t values[], uint8_t len) {
-    io.beginTransaction();
-    uint8_t status = io.transfer(W_REGISTER | (REGISTER_MASK & reg));
-    io.transfern(values, len);
-    io.endTransaction();
-    return { status };
+    return { io.transaction(W_REGISTER | (REGISTER_MASK & reg), values, NULL, len) };
   }
 
   /**
@@ -1008,16 +1043,9 @@ private:
    * @return Current value of status register
    */
   uint8_t write_payload(const void *buf, uint8_t len, const uint8_t writeType) {
-    uint8_t status;
     const uint8_t *current = reinterpret_cast<const uint8_t *>(buf);
     len = rf24_min(len, RF24_MAX_PAYLOAD);
-
-    io.beginTransaction();
-    status = io.transfer(writeType);
-    io.transfern(current, len);
-    io.endTransaction();
-
-    return status;
+    return io.transaction(writeType, current, NULL, len);
   }
 
   /**
@@ -1027,20 +1055,9 @@ private:
    * @return Current value of status register
    */
   uint8_t read_payload(void *buf, uint8_t len) {
-    uint8_t status;
     uint8_t *current = reinterpret_cast<uint8_t *>(buf);
-
     len = rf24_min(len, RF24_MAX_PAYLOAD);
-
-    io.beginTransaction();
-    status = io.transfer(R_RX_PAYLOAD);
-    while (len--) {
-      *current++ = io.transfer(0xFF);
-    }
-
-    io.endTransaction();
-
-    return status;
+    return io.transaction(R_RX_PAYLOAD, NULL, current, len);
   }
 
   /**
@@ -1066,13 +1083,7 @@ private:
    * Built in spi transfer function to simplify repeating code repeating code
    */
   Status command(uint8_t cmd) {
-    uint8_t status;
-
-    io.beginTransaction();
-    status = io.transfer( cmd );
-    io.endTransaction();
-
-    return { status };
+    return { io.transaction(cmd, NULL, NULL, 0) };
   }
   
   /**@}*/
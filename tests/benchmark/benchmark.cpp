@@ -0,0 +1,467 @@
+/*
+ * Throughput and latency of the driver, from one radio to another, across
+ * data rates, payload sizes, auto ack and retries.
+ *
+ * benchmark [-n packets] [-a] [-r ard:arc ...] [-l loss] [-s seed]
+ * benchmark-linux [-n packets] [-a] [-r ard:arc ...] spidev ce spidev ce
+ *
+ * benchmark runs against the chip model, on virtual time, so its numbers
+ * are the same every run, and can be compared before and after a change.
+ * benchmark-linux runs the same sweep on two real radios, the first
+ * sending to the second; ce is a GPIO chip and line, like
+ * /dev/gpiochip0:25, or a sysfs pin number.
+ *
+ * For each combination, it sends packets one at a time, waiting for each
+ * with txStandBy(), for the latency, then streams them with the TX FIFO
+ * kept full, for the goodput and the sender's SPI use. While the FIFO is
+ * full, the stream waits for an IRQ, as an application would, rather
+ * than polling the radio; benchmark-linux has no IRQ lines, so it sleeps
+ * a little between polls instead. The receiver is emptied after each. Payloads are dynamic, 1, 8, 16, 24 and 32 bytes, or
+ * 1 to 32 with -a. Each -r adds an ARD and ARC to try with auto ack on;
+ * there are three by default. On the model, -l is the chance of losing
+ * each packet, 5% by default, so that the retries matter.
+ *
+ * The output is CSV, one line per combination, under a header. Latencies
+ * are in microseconds, and left empty when no packet got through.
+ * Goodput is the payload bits received per second. SPI use is the
+ * sender's while streaming: transactions per packet, the percentage of
+ * the time its bus was busy, and the bus time of each startFastWrite()
+ * and status() call, counted through an AccountingIo. On real radios,
+ * the bus time is only as fine as micros().
+ *
+ * To run:
+ *  make run > results.csv
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "rf24.h"
+#include "rf24-accounting-io.h"
+
+#ifdef RF24_LINUX
+#include <time.h>
+#include "rf24-linux-io.h"
+#endif
+
+using rf24::AccountingIo;
+using rf24::SpiAccount;
+using rf24::SpiMarker;
+
+static const uint8_t address[6] = "1Node";
+
+static uint32_t packets = 200;
+#ifdef RF24_MODEL
+static double loss = 0.05;
+static uint32_t seed = 1;
+#endif
+
+#ifdef RF24_MODEL
+typedef RF24<AccountingIo<rf24::model::Io>, 5> Rf24;
+
+struct Link {
+    rf24::model::Air air;
+    rf24::model::Chip pingChip;
+    rf24::model::Chip pongChip;
+    SpiAccount pingAccount;
+    SpiAccount pongAccount;
+    Rf24 ping;
+    Rf24 pong;
+
+    Link() : pingChip(air), pongChip(air),
+          ping(AccountingIo<rf24::model::Io>(rf24::model::Io(&pingChip), &pingAccount)),
+          pong(AccountingIo<rf24::model::Io>(rf24::model::Io(&pongChip), &pongAccount)) {
+        rf24::model::Clock::shared().reset();
+        air.seed(seed);
+        air.conditions.loss = loss;
+    }
+
+    uint64_t now() const {
+        return rf24::model::Clock::shared().now();
+    }
+
+    void spi(uint32_t *transactions, uint64_t *busyNs) const {
+        *transactions = pingChip.spi.transactions;
+        *busyNs = pingChip.spi.busyNs;
+    }
+
+    // Move time on until either radio asserts IRQ: the sender's for a
+    // payload sent or given up on, the receiver's for one come in
+    bool wait() {
+        while(!pingChip.irq() && !pongChip.irq()) {
+            if(!rf24::model::Clock::shared().step()) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// A fresh pair on a fresh air for every run; the chips are too big for
+// the stack
+static Link *openLink() {
+    return new Link();
+}
+
+static void closeLink(Link *link) {
+    delete link;
+}
+#endif
+
+#ifdef RF24_LINUX
+typedef RF24<AccountingIo<Rf24LinuxIo>, 5> Rf24;
+
+// A GPIO is chip:line, or just a sysfs pin number
+static bool parseGpio(char *spec, const char **chip, unsigned *line, int *sysfs) {
+    char *colon = strrchr(spec, ':');
+    char *end;
+    if(colon == NULL) {
+        *chip = NULL;
+        *line = 0;
+        *sysfs = strtol(spec, &end, 0);
+        return *end == '\0' && *sysfs >= 0;
+    }
+    *colon = '\0';
+    *chip = spec;
+    *line = strtoul(colon + 1, &end, 0);
+    *sysfs = -1;
+    return *end == '\0';
+}
+
+// The same two radios for every run; begin() puts them back each time.
+// Their IOs count their own SPI use, which spidev can't tell us.
+struct Link {
+    Rf24LinuxSpi pingSpi;
+    Rf24LinuxGpio pingCe;
+    Rf24LinuxSpi pongSpi;
+    Rf24LinuxGpio pongCe;
+    SpiAccount pingAccount;
+    SpiAccount pongAccount;
+    Rf24 ping;
+    Rf24 pong;
+
+    Link(const char *pingDevice, const char *pingChip, unsigned pingLine, int pingSysfs,
+            const char *pongDevice, const char *pongChip, unsigned pongLine, int pongSysfs)
+        : pingSpi(pingDevice), pingCe(pingChip, pingLine, pingSysfs),
+          pongSpi(pongDevice), pongCe(pongChip, pongLine, pongSysfs),
+          ping(AccountingIo<Rf24LinuxIo>(Rf24LinuxIo(&pingSpi, &pingCe), &pingAccount)),
+          pong(AccountingIo<Rf24LinuxIo>(Rf24LinuxIo(&pongSpi, &pongCe), &pongAccount)) {
+    }
+
+    uint64_t now() const {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    void spi(uint32_t *transactions, uint64_t *busyNs) const {
+        *transactions = pingAccount.total().transactions;
+        *busyNs = (uint64_t)pingAccount.total().micros * 1000;
+    }
+
+    // Without the IRQ lines, give the radios the time a short payload
+    // takes before looking again
+    bool wait() {
+        struct timespec pause = { 0, 100000 };
+        nanosleep(&pause, NULL);
+        return true;
+    }
+};
+
+static Link *hardware;
+
+static Link *openLink() {
+    return hardware;
+}
+
+static void closeLink(Link *link) {
+    (void)link;
+}
+#endif
+
+struct Rate {
+    const char *name;
+    DataRateOption option;
+};
+
+static const Rate rates[] = {
+    { "250k", DataRate::_250KBPS },
+    { "1M", DataRate::_1MBPS },
+    { "2M", DataRate::_2MBPS }
+};
+
+static const uint8_t defaultLengths[] = { 1, 8, 16, 24, 32 };
+
+struct Retry {
+    uint8_t delay;
+    uint8_t count;
+};
+
+static Retry retries[16] = { { 0, 3 }, { 1, 15 }, { 5, 15 } };
+static uint8_t retryCount = 3;
+
+struct Config {
+    const Rate *rate;
+    uint8_t length;
+    bool ack;
+    Retry retry;
+};
+
+static bool setup(Link &link, const Config &config) {
+    Rf24 *radios[] = { &link.ping, &link.pong };
+    for(Rf24 *radio : radios) {
+        if(!radio->begin()) {
+            return false;
+        }
+        radio->set(config.rate->option);
+        radio->set(DynamicPayload::feature.enable());
+        radio->set(DynamicPayload::all.enable());
+        radio->set(config.ack ? AutoAck::all.enable() : AutoAck::all.disable());
+        radio->set(Retries::retries(config.retry.delay, config.retry.count));
+    }
+    link.ping.openWritingPipe(address);
+    link.pong.openReadingPipe(1, address);
+    link.pong.startListening();
+    link.ping.stopListening();
+    return true;
+}
+
+// Empty the receiver's FIFO
+static uint32_t drain(Rf24 &pong) {
+    uint32_t received = 0;
+    uint8_t payload[32];
+    while(!pong.fifoStatus().rxEmpty()) {
+        pong.readPayload(payload, pong.getDynamicPayloadSize());
+        received++;
+    }
+    pong.resetStatus();
+    return received;
+}
+
+static int compare(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// An empty field when there's nothing to take it from
+static void printPercentile(const uint64_t *sorted, uint32_t count, uint32_t percent) {
+    if(count == 0) {
+        printf(",");
+    } else {
+        printf(",%.1f", sorted[(count - 1) * percent / 100] / 1000.0);
+    }
+}
+
+// The mean bus time of one call, in microseconds
+static void printCallMicros(const SpiAccount &account, const char *name) {
+    const SpiAccount::Totals *totals = account.find(name);
+    if(totals == NULL || totals->calls == 0) {
+        printf(",");
+    } else {
+        printf(",%.2f", (double)totals->micros / totals->calls);
+    }
+}
+
+static void printHeader() {
+    printf("rate,payload,ack,ard_us,arc,packets,delivered,failed,"
+           "latency_p50_us,latency_p90_us,latency_p99_us,latency_max_us,"
+           "goodput_bps,spi_transactions_per_packet,spi_busy_percent,"
+           "write_us_per_call,status_us_per_call\n");
+}
+
+static bool run(Link &link, const Config &config, uint64_t *latencies) {
+    if(!setup(link, config)) {
+        return false;
+    }
+    uint8_t payload[32];
+    for(uint8_t i = 0; i < sizeof(payload); i++) {
+        payload[i] = i;
+    }
+
+    // One at a time. Without auto ack, txStandBy() only waits for the
+    // packet to go, so what was delivered is what the receiver got
+    uint32_t timed = 0, delivered = 0, failed = 0;
+    for(uint32_t i = 0; i < packets; i++) {
+        uint64_t start = link.now();
+        link.ping.startFastWrite(payload, config.length, false);
+        bool ok = link.ping.txStandBy();
+        uint64_t end = link.now();
+        if(ok) {
+            latencies[timed++] = end - start;
+        } else {
+            failed++;
+            link.ping.resetStatus();
+        }
+        delivered += drain(link.pong);
+    }
+    qsort(latencies, timed, sizeof(*latencies), compare);
+
+    // Streaming, with the TX FIFO kept full
+    uint32_t transactions = 0, transactionsBefore = 0;
+    uint64_t busyNs = 0, busyBefore = 0;
+    link.pingAccount.reset();
+    link.spi(&transactionsBefore, &busyBefore);
+    uint64_t start = link.now();
+    uint32_t queued = 0, received = 0;
+    SpiAccount &account = link.pingAccount;
+    while(queued < packets) {
+        Status status;
+        {
+            SpiMarker marker(account, "status");
+            status = link.ping.status();
+        }
+        if(status.maxRetries()) {
+            // As txStandBy() does: the payloads in the FIFO are lost
+            SpiMarker marker(account, "flush_tx");
+            link.ping.flush_tx();
+            link.ping.resetStatus(status);
+        } else if(!status.txFifoFull()) {
+            SpiMarker marker(account, "startFastWrite");
+            link.ping.startFastWrite(payload, config.length, false);
+            queued++;
+            continue;
+        } else {
+            // Nothing to do until a payload goes, so the flags that say so
+            // have to be clear to be raised again
+            if(status.dataSent()) {
+                SpiMarker marker(account, "resetStatus");
+                link.ping.resetStatus(status);
+            } else if(!link.wait()) {
+                break;
+            }
+        }
+        received += drain(link.pong);
+    }
+    if(!link.ping.txStandBy()) {
+        link.ping.resetStatus();
+    }
+    received += drain(link.pong);
+    uint64_t elapsed = link.now() - start;
+    link.spi(&transactions, &busyNs);
+
+    printf("%s,%u,%u,%u,%u,%u,%u,%u",
+            config.rate->name, config.length, config.ack,
+            config.ack ? 250 * (config.retry.delay + 1) : 0, config.ack ? config.retry.count : 0,
+            packets, delivered, failed);
+    const uint32_t percents[] = { 50, 90, 99, 100 };
+    for(uint32_t percent : percents) {
+        printPercentile(latencies, timed, percent);
+    }
+    printf(",%.0f,%.2f,%.2f",
+            elapsed > 0 ? received * config.length * 8 * 1e9 / elapsed : 0.0,
+            (double)(transactions - transactionsBefore) / packets,
+            elapsed > 0 ? (busyNs - busyBefore) * 100.0 / elapsed : 0.0);
+    printCallMicros(account, "startFastWrite");
+    printCallMicros(account, "status");
+    printf("\n");
+    fflush(stdout);
+    return true;
+}
+
+static bool runOn(const Config &config, uint64_t *latencies) {
+    Link *link = openLink();
+    bool ok = run(*link, config, latencies);
+    closeLink(link);
+    return ok;
+}
+
+static bool sweep(const uint8_t *lengths, uint8_t lengthCount) {
+    uint64_t *latencies = (uint64_t *)malloc(packets * sizeof(uint64_t));
+    if(latencies == NULL) {
+        return false;
+    }
+    printHeader();
+    bool ok = true;
+    for(const Rate &rate : rates) {
+        for(uint8_t l = 0; l < lengthCount && ok; l++) {
+            Config config = { &rate, lengths[l], false, { 0, 0 } };
+            ok = runOn(config, latencies);
+            config.ack = true;
+            for(uint8_t r = 0; r < retryCount && ok; r++) {
+                config.retry = retries[r];
+                ok = runOn(config, latencies);
+            }
+        }
+    }
+    free(latencies);
+    return ok;
+}
+
+static void usage() {
+#ifdef RF24_MODEL
+    fprintf(stderr, "usage: benchmark [-n packets] [-a] [-r ard:arc ...] [-l loss] [-s seed]\n");
+#else
+    fprintf(stderr, "usage: benchmark-linux [-n packets] [-a] [-r ard:arc ...] spidev ce spidev ce\n");
+#endif
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    uint8_t lengths[32];
+    uint8_t lengthCount = sizeof(defaultLengths);
+    memcpy(lengths, defaultLengths, sizeof(defaultLengths));
+    bool defaultRetries = true;
+
+    int option;
+    while((option = getopt(argc, argv, "n:ar:l:s:")) != -1) {
+        switch(option) {
+        case 'n':
+            packets = strtoul(optarg, NULL, 0);
+            if(packets == 0) {
+                usage();
+            }
+            break;
+        case 'a':
+            for(uint8_t i = 0; i < sizeof(lengths); i++) {
+                lengths[i] = i + 1;
+            }
+            lengthCount = sizeof(lengths);
+            break;
+        case 'r': {
+            unsigned delay, count;
+            if(defaultRetries) {
+                retryCount = 0;
+                defaultRetries = false;
+            }
+            if(retryCount == sizeof(retries) / sizeof(retries[0])
+                    || sscanf(optarg, "%u:%u", &delay, &count) != 2 || delay > 15 || count > 15) {
+                usage();
+            }
+            retries[retryCount].delay = delay;
+            retries[retryCount].count = count;
+            retryCount++;
+            break;
+        }
+#ifdef RF24_MODEL
+        case 'l': loss = atof(optarg); break;
+        case 's': seed = strtoul(optarg, NULL, 0); break;
+#endif
+        default: usage();
+        }
+    }
+
+#ifdef RF24_MODEL
+    if(argc != optind) {
+        usage();
+    }
+#else
+    const char *pingChip, *pongChip;
+    unsigned pingLine, pongLine;
+    int pingSysfs, pongSysfs;
+    if(argc - optind != 4
+            || !parseGpio(argv[optind + 1], &pingChip, &pingLine, &pingSysfs)
+            || !parseGpio(argv[optind + 3], &pongChip, &pongLine, &pongSysfs)) {
+        usage();
+    }
+    hardware = new Link(argv[optind], pingChip, pingLine, pingSysfs,
+            argv[optind + 2], pongChip, pongLine, pongSysfs);
+#endif
+
+    bool ok = sweep(lengths, lengthCount);
+    if(!ok) {
+        fprintf(stderr, "benchmark: no radio\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,657 @@
+/*
+ * Header compression and fragmentation, on their own, and then two whole
+ * stacks talking over a pair of radios on the chip model.
+ *
+ * To run:
+ *  make test
+ *  Look for "+OK PASS" or "+OK FAIL"
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "rf24.h"
+#include "rf24-lowpan.h"
+
+using namespace rf24::lowpan;
+
+static int failures = 0;
+
+#define CHECK(condition) do { \
+    if(!(condition)) { \
+        printf("%s:%d: %s\n", __FILE__, __LINE__, #condition); \
+        failures++; \
+    } \
+} while(0)
+
+static const uint8_t NEXT_HEADER_UDP = 17;
+static const uint8_t NEXT_HEADER_ICMPV6 = 58;
+
+static const uint8_t LINK_LOCAL_SHORT[16] = {
+    0xfe, 0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xfe, 0, 0x12, 0x34
+};
+static const uint8_t LINK_LOCAL_IID[16] = {
+    0xfe, 0x80, 0, 0, 0, 0, 0, 0, 0x02, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77
+};
+static const uint8_t GLOBAL[16] = {
+    0x20, 0x01, 0x0d, 0xb8, 0, 1, 0, 2, 0x02, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77
+};
+static const uint8_t UNSPECIFIED[16] = { 0 };
+static const uint8_t PREFIX_A[8] = { 0xfd, 0x00, 0xaa, 0xbb, 0, 0, 0, 1 };
+static const uint8_t PREFIX_B[8] = { 0xfd, 0x00, 0xcc, 0xdd, 0, 0, 0, 2 };
+
+// An address under @p prefix, with the short or the long interface id
+static void underPrefix(uint8_t *address, const uint8_t *prefix, bool shortIid) {
+    memcpy(address, prefix, 8);
+    memcpy(address + 8, (shortIid ? LINK_LOCAL_SHORT : LINK_LOCAL_IID) + 8, 8);
+}
+
+struct Header {
+    uint8_t trafficClass;
+    uint32_t flow;
+    uint8_t nextHeader;
+    uint8_t hopLimit;
+    const uint8_t *source;
+    const uint8_t *destination;
+};
+
+static const Header plain = {
+    0, 0, NEXT_HEADER_ICMPV6, 64, LINK_LOCAL_SHORT, LINK_LOCAL_SHORT
+};
+
+// An IPv6 packet with @p data after the header, and its length
+static uint16_t ipv6(uint8_t *packet, const Header &header, const uint8_t *data, uint16_t length) {
+    packet[0] = 0x60 | (header.trafficClass >> 4);
+    packet[1] = (header.trafficClass << 4) | ((header.flow >> 16) & 0x0f);
+    packet[2] = header.flow >> 8;
+    packet[3] = header.flow;
+    packet[4] = length >> 8;
+    packet[5] = length;
+    packet[6] = header.nextHeader;
+    packet[7] = header.hopLimit;
+    memcpy(packet + 8, header.source, 16);
+    memcpy(packet + 24, header.destination, 16);
+    memcpy(packet + 40, data, length);
+    return 40 + length;
+}
+
+// The same, as UDP between the ports, with a checksum to carry through
+static uint16_t udp(uint8_t *packet, Header header, uint16_t sourcePort, uint16_t destinationPort,
+        const uint8_t *data, uint16_t length) {
+    uint8_t datagram[MTU];
+    uint16_t total = 8 + length;
+    datagram[0] = sourcePort >> 8;
+    datagram[1] = sourcePort;
+    datagram[2] = destinationPort >> 8;
+    datagram[3] = destinationPort;
+    datagram[4] = total >> 8;
+    datagram[5] = total;
+    datagram[6] = 0xc3;
+    datagram[7] = 0x5a;
+    memcpy(datagram + 8, data, length);
+    header.nextHeader = NEXT_HEADER_UDP;
+    return ipv6(packet, header, datagram, total);
+}
+
+static const uint8_t hello[] = { 'h', 'e', 'l', 'l', 'o' };
+
+// Compress and decompress @p packet, and check it comes back the same, at
+// @p expected bytes compressed, unless that's 0
+static void roundTrip(const Compressor &compressor, const uint8_t *packet, uint16_t length,
+        uint16_t expected, int line) {
+    uint8_t datagram[DATAGRAM_MAX];
+    uint8_t back[MTU];
+    uint16_t compressed = compressor.compress(packet, length, datagram, sizeof(datagram));
+    uint16_t decompressed = compressor.decompress(datagram, compressed, back, sizeof(back));
+    if(compressed == 0 || (expected != 0 && compressed != expected)
+            || decompressed != length || memcmp(packet, back, length) != 0) {
+        printf("%s:%d: round trip of %u bytes: compressed to %u, expected %u, came back as %u\n",
+                __FILE__, line, length, compressed, expected, decompressed);
+        failures++;
+    }
+}
+
+#define ROUND_TRIP(compressor, packet, length, expected) \
+    roundTrip(compressor, packet, length, expected, __LINE__)
+
+// IPHC is 2 bytes, and the best case adds the two 16 bit interface ids and
+// the next header
+static const uint16_t BEST = 2 + 2 + 2 + 1 + sizeof(hello);
+
+static void testTrafficClass() {
+    Compressor compressor;
+    uint8_t packet[MTU];
+    Header header = plain;
+
+    // Everything elided, then ECN and DSCP, then ECN and the flow label,
+    // then all of it
+    const struct {
+        uint8_t trafficClass;
+        uint32_t flow;
+        uint8_t extra;
+    } cases[] = {
+        { 0, 0, 0 },
+        { 0xb9, 0, 1 },
+        { 0x02, 0x12345, 3 },
+        { 0xb9, 0xfedcb, 4 },
+        { 0x03, 0xfffff, 3 },
+    };
+    for(const auto &c : cases) {
+        header.trafficClass = c.trafficClass;
+        header.flow = c.flow;
+        uint16_t length = ipv6(packet, header, hello, sizeof(hello));
+        ROUND_TRIP(compressor, packet, length, BEST + c.extra);
+    }
+}
+
+static void testHopLimit() {
+    Compressor compressor;
+    uint8_t packet[MTU];
+    Header header = plain;
+    const uint8_t limits[] = { 1, 64, 255, 0, 17, 128, 254 };
+    for(uint8_t limit : limits) {
+        header.hopLimit = limit;
+        uint16_t length = ipv6(packet, header, hello, sizeof(hello));
+        bool elided = limit == 1 || limit == 64 || limit == 255;
+        ROUND_TRIP(compressor, packet, length, BEST + (elided ? 0 : 1));
+    }
+}
+
+static void testAddresses() {
+    Compressor compressor;
+    CHECK(compressor.context(0, PREFIX_A));
+    CHECK(compressor.context(5, PREFIX_B));
+    CHECK(!compressor.context(CONTEXT_COUNT, PREFIX_A));
+
+    uint8_t contextShort[16], contextIid[16], otherShort[16];
+    underPrefix(contextShort, PREFIX_A, true);
+    underPrefix(contextIid, PREFIX_A, false);
+    underPrefix(otherShort, PREFIX_B, true);
+    static const uint8_t ALL_NODES[16] = { 0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01 };
+    static const uint8_t MULTICAST_32[16] = { 0xff, 0x05, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01, 0x00, 0x03 };
+    static const uint8_t MULTICAST_48[16] = { 0xff, 0x0e, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x02, 0, 0x01, 0, 0xfb };
+    static const uint8_t MULTICAST_FULL[16] = { 0xff, 0x1e, 0, 0x40, 0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0x01 };
+
+    // Each address, and what it costs, as a source and as a destination.
+    // Context 0 costs nothing extra, but any other needs the CID byte
+    const struct {
+        const uint8_t *address;
+        uint8_t asSource;
+        uint8_t asDestination;
+    } cases[] = {
+        { LINK_LOCAL_SHORT, 2, 2 },
+        { LINK_LOCAL_IID, 8, 8 },
+        { GLOBAL, 16, 16 },
+        { contextShort, 2, 2 },
+        { contextIid, 8, 8 },
+        { otherShort, 3, 3 },
+        { UNSPECIFIED, 0, 16 },
+        { ALL_NODES, 16, 1 },
+        { MULTICAST_32, 16, 4 },
+        { MULTICAST_48, 16, 6 },
+        { MULTICAST_FULL, 16, 16 },
+    };
+
+    uint8_t packet[MTU];
+    Header header = plain;
+    for(const auto &c : cases) {
+        header.source = c.address;
+        header.destination = LINK_LOCAL_SHORT;
+        uint16_t length = ipv6(packet, header, hello, sizeof(hello));
+        ROUND_TRIP(compressor, packet, length, BEST - 2 + c.asSource);
+
+        header.source = LINK_LOCAL_SHORT;
+        header.destination = c.address;
+        length = ipv6(packet, header, hello, sizeof(hello));
+        ROUND_TRIP(compressor, packet, length, BEST - 2 + c.asDestination);
+    }
+
+    // Both under a context other than 0, which share the CID byte
+    header.source = otherShort;
+    header.destination = otherShort;
+    uint16_t length = ipv6(packet, header, hello, sizeof(hello));
+    ROUND_TRIP(compressor, packet, length, BEST + 1);
+
+    // A peer without the context can't rebuild the address
+    uint8_t datagram[DATAGRAM_MAX];
+    uint8_t back[MTU];
+    uint16_t compressed = compressor.compress(packet, length, datagram, sizeof(datagram));
+    Compressor stranger;
+    CHECK(stranger.decompress(datagram, compressed, back, sizeof(back)) == 0);
+    CHECK(stranger.context(5, PREFIX_B));
+    CHECK(stranger.decompress(datagram, compressed, back, sizeof(back)) == length);
+
+    // And once it's cleared, the address goes in full
+    CHECK(compressor.context(5, NULL));
+    ROUND_TRIP(compressor, packet, length, BEST - 4 + 16 + 16);
+}
+
+static void testUdp() {
+    Compressor compressor;
+    uint8_t packet[MTU];
+
+    // IPHC, the addresses, then the NHC byte and the checksum, and the
+    // ports, in 1, 3, 3 or 4 bytes
+    static const uint16_t UDP_BEST = 2 + 2 + 2 + 1 + 2 + sizeof(hello);
+    const struct {
+        uint16_t source;
+        uint16_t destination;
+        uint8_t ports;
+    } cases[] = {
+        { 0xf0b1, 0xf0bf, 1 },
+        { 5683, 0xf012, 3 },
+        { 0xf0ab, 5683, 3 },
+        { 0xf0b1, 5683, 3 },
+        { 5683, 5684, 4 },
+        { 0xf1b1, 0x0f0b, 4 },
+    };
+    for(const auto &c : cases) {
+        uint16_t length = udp(packet, plain, c.source, c.destination, hello, sizeof(hello));
+        ROUND_TRIP(compressor, packet, length, UDP_BEST + c.ports);
+    }
+
+    // An empty datagram, and one as big as an IPv6 packet here can be
+    uint16_t length = udp(packet, plain, 0xf0b1, 0xf0b2, NULL, 0);
+    ROUND_TRIP(compressor, packet, length, UDP_BEST - sizeof(hello) + 1);
+    static uint8_t big[MTU - 48];
+    for(uint16_t i = 0; i < sizeof(big); i++) {
+        big[i] = i * 7;
+    }
+    length = udp(packet, plain, 0xf0b1, 0xf0b2, big, sizeof(big));
+    CHECK(length == MTU);
+    ROUND_TRIP(compressor, packet, length, UDP_BEST - sizeof(hello) + 1 + sizeof(big));
+
+    // A header too short to be UDP goes as it is, behind the next header
+    Header header = plain;
+    header.nextHeader = NEXT_HEADER_UDP;
+    length = ipv6(packet, header, hello, sizeof(hello));
+    ROUND_TRIP(compressor, packet, length, BEST);
+}
+
+static void testOthers() {
+    Compressor compressor;
+    uint8_t packet[MTU];
+    uint8_t datagram[DATAGRAM_MAX];
+    uint8_t back[MTU];
+
+    // IPv4 goes as it is, behind its dispatch byte
+    static const uint8_t ipv4[] = {
+        0x45, 0, 0, 25, 0, 0, 0x40, 0, 64, 17, 0, 0, 10, 0, 0, 1, 10, 0, 0, 2, 'h', 'e', 'l', 'l', 'o'
+    };
+    CHECK(compressor.compress(ipv4, sizeof(ipv4), datagram, sizeof(datagram)) == sizeof(ipv4) + 1);
+    CHECK(datagram[0] == DISPATCH_IPV4);
+    ROUND_TRIP(compressor, ipv4, sizeof(ipv4), sizeof(ipv4) + 1);
+
+    // Not IP, or with the wrong length, isn't compressed
+    uint16_t length = ipv6(packet, plain, hello, sizeof(hello));
+    CHECK(compressor.compress(packet, length - 1, datagram, sizeof(datagram)) == 0);
+    packet[0] = 0x50;
+    CHECK(compressor.compress(packet, length, datagram, sizeof(datagram)) == 0);
+
+    // Nor into too little room, nor back out into too little
+    length = ipv6(packet, plain, hello, sizeof(hello));
+    CHECK(compressor.compress(packet, length, datagram, BEST - 1) == 0);
+    uint16_t compressed = compressor.compress(packet, length, datagram, sizeof(datagram));
+    CHECK(compressor.decompress(datagram, compressed, back, length - 1) == 0);
+
+    // A truncated datagram is malformed
+    CHECK(compressor.decompress(datagram, 3, back, sizeof(back)) == 0);
+    CHECK(compressor.decompress(datagram, 0, back, sizeof(back)) == 0);
+}
+
+// Cut @p datagram into @p payloads, up to @p most of them
+static uint8_t fragment(Fragmenter &fragmenter, const uint8_t *datagram, uint16_t length,
+        uint8_t payloads[][PAYLOAD_SIZE], uint8_t *lengths, uint8_t most) {
+    fragmenter.start(datagram, length);
+    uint8_t count = 0;
+    while(fragmenter.pending() && count < most) {
+        lengths[count] = fragmenter.next(payloads[count]);
+        count++;
+    }
+    return count;
+}
+
+static const uint8_t MOST_FRAGMENTS = 48;
+
+static void testFragments() {
+    static uint8_t datagram[DATAGRAM_MAX];
+    for(uint16_t i = 0; i < sizeof(datagram); i++) {
+        datagram[i] = i ^ (i >> 8);
+    }
+    uint8_t payloads[MOST_FRAGMENTS][PAYLOAD_SIZE];
+    uint8_t lengths[MOST_FRAGMENTS];
+    Fragmenter fragmenter;
+    Reassembler reassembler;
+
+    // Whole, then just too big for one payload, then first and next
+    // fragments, up to the biggest there can be
+    const struct {
+        uint16_t length;
+        uint8_t payloads;
+    } cases[] = {
+        { 1, 1 },
+        { PAYLOAD_SIZE - WHOLE_HEADER_SIZE, 1 },
+        { PAYLOAD_SIZE, 2 },
+        { 29 + 30, 2 },
+        { 29 + 30 + 1, 3 },
+        { DATAGRAM_MAX, 43 },
+    };
+    for(const auto &c : cases) {
+        uint8_t count = fragment(fragmenter, datagram, c.length, payloads, lengths, MOST_FRAGMENTS);
+        CHECK(count == c.payloads);
+        CHECK(!fragmenter.pending());
+        uint16_t sent = 0;
+        for(uint8_t i = 0; i < count; i++) {
+            CHECK(lengths[i] <= PAYLOAD_SIZE);
+            sent += lengths[i];
+        }
+        CHECK(sent == c.length + (count == 1 ? WHOLE_HEADER_SIZE
+                : FIRST_HEADER_SIZE + (count - 1) * NEXT_HEADER_SIZE));
+
+        const uint8_t *received = NULL;
+        for(uint8_t i = 0; i < count; i++) {
+            uint16_t length = reassembler.receive(0, payloads[i], lengths[i], 0, received);
+            CHECK(length == ((i + 1 == count) ? c.length : 0));
+        }
+        CHECK(received != NULL && memcmp(received, datagram, c.length) == 0);
+    }
+    CHECK(reassembler.stats.malformed == 0);
+    CHECK(reassembler.stats.dropped == 0);
+    CHECK(reassembler.stats.duplicate == 0);
+
+    // Nothing more to take once it's all gone, or after a cancel
+    CHECK(fragmenter.next(payloads[0]) == 0);
+    fragmenter.start(datagram, 100);
+    fragmenter.cancel();
+    CHECK(!fragmenter.pending());
+    CHECK(fragmenter.next(payloads[0]) == 0);
+}
+
+static void testDuplicates() {
+    static uint8_t datagram[200];
+    for(uint16_t i = 0; i < sizeof(datagram); i++) {
+        datagram[i] = i;
+    }
+    uint8_t payloads[MOST_FRAGMENTS][PAYLOAD_SIZE];
+    uint8_t lengths[MOST_FRAGMENTS];
+    Fragmenter fragmenter;
+    Reassembler reassembler;
+
+    // Every payload twice, as if every ack got lost: each datagram only
+    // comes out once, and the repeat of the last fragment, after it's
+    // done, is ignored without counting
+    const uint16_t sizes[] = { 10, sizeof(datagram), 20, sizeof(datagram) };
+    uint32_t duplicates = 0;
+    for(uint16_t size : sizes) {
+        uint8_t count = fragment(fragmenter, datagram, size, payloads, lengths, MOST_FRAGMENTS);
+        uint8_t completed = 0;
+        for(uint8_t i = 0; i < count; i++) {
+            for(uint8_t repeat = 0; repeat < 2; repeat++) {
+                const uint8_t *received = NULL;
+                uint16_t length = reassembler.receive(2, payloads[i], lengths[i], 0, received);
+                if(length != 0) {
+                    CHECK(length == size && memcmp(received, datagram, size) == 0);
+                    completed++;
+                }
+            }
+        }
+        CHECK(completed == 1);
+        duplicates += (count == 1) ? 1 : count - 1;
+    }
+    CHECK(reassembler.stats.duplicate == duplicates);
+    CHECK(reassembler.stats.dropped == 0);
+
+    // A fragment repeated out of turn breaks the datagram
+    uint8_t count = fragment(fragmenter, datagram, sizeof(datagram), payloads, lengths, MOST_FRAGMENTS);
+    const uint8_t *received = NULL;
+    CHECK(reassembler.receive(2, payloads[0], lengths[0], 0, received) == 0);
+    CHECK(reassembler.receive(2, payloads[1], lengths[1], 0, received) == 0);
+    CHECK(reassembler.receive(2, payloads[2], lengths[2], 0, received) == 0);
+    CHECK(reassembler.receive(2, payloads[1], lengths[1], 0, received) == 0);
+    CHECK(reassembler.stats.dropped == 1);
+    for(uint8_t i = 3; i < count; i++) {
+        CHECK(reassembler.receive(2, payloads[i], lengths[i], 0, received) == 0);
+    }
+}
+
+static void testTimeout() {
+    static uint8_t datagram[100];
+    for(uint16_t i = 0; i < sizeof(datagram); i++) {
+        datagram[i] = 255 - i;
+    }
+    uint8_t payloads[MOST_FRAGMENTS][PAYLOAD_SIZE];
+    uint8_t lengths[MOST_FRAGMENTS];
+    Fragmenter fragmenter;
+    Reassembler reassembler;
+    const uint8_t *received = NULL;
+
+    // Just in time, and then just too late
+    uint8_t count = fragment(fragmenter, datagram, sizeof(datagram), payloads, lengths, MOST_FRAGMENTS);
+    CHECK(count == 4);
+    uint32_t now = 1000;
+    for(uint8_t i = 0; i < count; i++) {
+        uint16_t length = reassembler.receive(0, payloads[i], lengths[i], now, received);
+        CHECK(length == ((i + 1 == count) ? sizeof(datagram) : 0));
+        now += Reassembler::TIMEOUT_MS / (count - 1);
+    }
+    CHECK(reassembler.stats.dropped == 0);
+
+    count = fragment(fragmenter, datagram, sizeof(datagram), payloads, lengths, MOST_FRAGMENTS);
+    now = 5000;
+    for(uint8_t i = 0; i < count; i++) {
+        CHECK(reassembler.receive(0, payloads[i], lengths[i], now, received) == 0);
+        if(i == 1) {
+            now += Reassembler::TIMEOUT_MS + 1;
+        }
+    }
+    CHECK(reassembler.stats.dropped == 1);
+
+    // The clock wrapping round doesn't look like a timeout
+    count = fragment(fragmenter, datagram, sizeof(datagram), payloads, lengths, MOST_FRAGMENTS);
+    now = 0xffffffff - 10;
+    for(uint8_t i = 0; i < count; i++) {
+        uint16_t length = reassembler.receive(0, payloads[i], lengths[i], now, received);
+        CHECK(length == ((i + 1 == count) ? sizeof(datagram) : 0));
+        now += 10;
+    }
+
+    // A datagram that starts before the last one finishes replaces it, and
+    // the rest of the last one is ignored
+    uint8_t first[MOST_FRAGMENTS][PAYLOAD_SIZE];
+    uint8_t firstLengths[MOST_FRAGMENTS];
+    uint8_t firstCount = fragment(fragmenter, datagram, sizeof(datagram), first, firstLengths, MOST_FRAGMENTS);
+    CHECK(reassembler.receive(0, first[0], firstLengths[0], now, received) == 0);
+    CHECK(reassembler.receive(0, first[1], firstLengths[1], now, received) == 0);
+    count = fragment(fragmenter, datagram, 50, payloads, lengths, MOST_FRAGMENTS);
+    CHECK(reassembler.receive(0, payloads[0], lengths[0], now, received) == 0);
+    CHECK(reassembler.stats.dropped == 2);
+    for(uint8_t i = 2; i < firstCount; i++) {
+        CHECK(reassembler.receive(0, first[i], firstLengths[i], now, received) == 0);
+    }
+    CHECK(reassembler.receive(0, payloads[1], lengths[1], now, received) == 50);
+
+    // Links don't get in each other's way
+    uint8_t other[MOST_FRAGMENTS][PAYLOAD_SIZE];
+    uint8_t otherLengths[MOST_FRAGMENTS];
+    Fragmenter otherFragmenter;
+    count = fragment(fragmenter, datagram, sizeof(datagram), payloads, lengths, MOST_FRAGMENTS);
+    uint8_t otherCount = fragment(otherFragmenter, datagram + 10, 80, other, otherLengths, MOST_FRAGMENTS);
+    CHECK(count == 4 && otherCount == 3);
+    for(uint8_t i = 0; i < count; i++) {
+        uint16_t length = reassembler.receive(1, payloads[i], lengths[i], now, received);
+        CHECK(length == ((i + 1 == count) ? sizeof(datagram) : 0));
+        if(i < otherCount) {
+            length = reassembler.receive(4, other[i], otherLengths[i], now, received);
+            CHECK(length == ((i + 1 == otherCount) ? 80 : 0));
+            if(length != 0) {
+                CHECK(memcmp(received, datagram + 10, 80) == 0);
+            }
+        }
+    }
+
+    // Nonsense is counted, and nothing else
+    uint32_t malformed = reassembler.stats.malformed;
+    static const uint8_t junk[] = { FRAME_FIRST | 3, 0xff, 0xff, 1 };
+    static const uint8_t unknown[] = { 0x40, 1, 2 };
+    CHECK(reassembler.receive(0, junk, sizeof(junk), now, received) == 0);
+    CHECK(reassembler.receive(0, unknown, sizeof(unknown), now, received) == 0);
+    CHECK(reassembler.receive(0, junk, 1, now, received) == 0);
+    CHECK(reassembler.receive(Reassembler::LINK_COUNT, payloads[0], lengths[0], now, received) == 0);
+    CHECK(reassembler.stats.malformed == malformed + 4);
+}
+
+/*
+ * End to end: two nodes, each with a whole stack, over a lossy air. Each
+ * packet goes one way, and comes back, compressed and fragmented both
+ * times, so each node's stack both sends and receives.
+ */
+
+typedef RF24<rf24::model::Io, 5> Rf24;
+
+static const uint8_t addresses[][6] = { "1Node", "2Node" };
+
+struct Node {
+    rf24::model::Chip chip;
+    Rf24 radio;
+    Compressor compressor;
+    Fragmenter fragmenter;
+    Reassembler reassembler;
+    uint8_t datagram[DATAGRAM_MAX];
+
+    Node(rf24::model::Air &air) : chip(air), radio(rf24::model::Io(&chip)) {
+        CHECK(compressor.context(1, PREFIX_A));
+    }
+
+    void begin(const uint8_t *writing, const uint8_t *reading) {
+        CHECK(radio.begin());
+        radio.set(DynamicPayload::feature.enable());
+        radio.set(DynamicPayload::all.enable());
+        radio.set(DataRate::_2MBPS);
+        radio.set(Retries::retries(1, 15));
+        radio.openWritingPipe(writing);
+        radio.openReadingPipe(1, reading);
+    }
+
+    uint32_t nowMs() const {
+        return rf24::model::Clock::shared().now() / 1000000;
+    }
+
+    // Send @p packet to @p to, one payload at a time, and give back what
+    // @p to makes of it, or 0
+    uint16_t send(Node &to, const uint8_t *packet, uint16_t length, uint8_t *back) {
+        radio.stopListening();
+        to.radio.startListening();
+
+        uint16_t compressed = compressor.compress(packet, length, datagram, sizeof(datagram));
+        CHECK(compressed != 0);
+        fragmenter.start(datagram, compressed);
+        uint16_t received = 0;
+        while(fragmenter.pending()) {
+            uint8_t payload[PAYLOAD_SIZE];
+            uint8_t size = fragmenter.next(payload);
+            radio.startFastWrite(payload, size, false);
+            if(!radio.txStandBy()) {
+                radio.resetStatus();
+                fragmenter.cancel();
+            }
+            received = to.collect(back);
+        }
+        return received;
+    }
+
+    // Take in whatever has arrived
+    uint16_t collect(uint8_t *packet) {
+        uint16_t result = 0;
+        Status status = radio.status();
+        while(status.rxPipeNo() != RX_P_NO_EMPTY) {
+            uint8_t pipe = status.rxPipeNo();
+            uint8_t payload[PAYLOAD_SIZE];
+            uint8_t size = radio.getDynamicPayloadSize();
+            radio.readPayload(payload, size);
+            const uint8_t *whole = NULL;
+            uint16_t length = reassembler.receive(pipe, payload, size, nowMs(), whole);
+            if(length != 0) {
+                result = compressor.decompress(whole, length, packet, MTU);
+                CHECK(result != 0);
+            }
+            status = radio.status();
+        }
+        radio.resetStatus();
+        return result;
+    }
+};
+
+struct Network {
+    rf24::model::Air air;
+    Node a;
+    Node b;
+
+    Network() : a(air), b(air) {
+        rf24::model::Clock::shared().reset();
+        air.seed(7);
+        air.conditions.loss = 0.1;
+        air.place(b.chip, 5, 0);
+        a.begin(addresses[0], addresses[1]);
+        b.begin(addresses[1], addresses[0]);
+    }
+};
+
+static void testEndToEnd() {
+    // The chips are too big for the stack
+    Network *network = new Network();
+    uint8_t sensor[16];
+    underPrefix(sensor, PREFIX_A, true);
+
+    static uint8_t data[MTU];
+    for(uint16_t i = 0; i < sizeof(data); i++) {
+        data[i] = i * 13;
+    }
+    uint8_t packet[MTU];
+    uint8_t there[MTU];
+    uint8_t back[MTU];
+
+    const uint16_t sizes[] = { 0, 1, 10, 20, 40, 100, 500, MTU - 48 };
+    uint32_t delivered = 0, sent = 0;
+    for(uint8_t round = 0; round < 3; round++) {
+        for(uint16_t size : sizes) {
+            Header header = plain;
+            header.source = sensor;
+            header.destination = GLOBAL;
+            header.hopLimit = 64 - round;
+            uint16_t length = udp(packet, header, 0xf0b0 + round, 5683, data + round, size);
+            sent++;
+            uint16_t got = network->a.send(network->b, packet, length, there);
+            CHECK(got == length && memcmp(there, packet, length) == 0);
+            if(got != length) {
+                continue;
+            }
+            got = network->b.send(network->a, there, length, back);
+            CHECK(got == length && memcmp(back, packet, length) == 0);
+            if(got == length) {
+                delivered++;
+            }
+        }
+    }
+    CHECK(delivered == sent);
+    // The loss was there to be recovered from
+    CHECK(network->air.stats.lost > 0);
+    CHECK(network->a.reassembler.stats.dropped == 0);
+    CHECK(network->b.reassembler.stats.dropped == 0);
+    CHECK(network->a.reassembler.stats.malformed == 0);
+    CHECK(network->b.reassembler.stats.malformed == 0);
+    delete network;
+}
+
+int main() {
+    testTrafficClass();
+    testHopLimit();
+    testAddresses();
+    testUdp();
+    testOthers();
+    testFragments();
+    testDuplicates();
+    testTimeout();
+    testEndToEnd();
+
+    printf(failures == 0 ? "+OK PASS\n" : "+OK FAIL\n");
+    return failures == 0 ? 0 : 1;
+}
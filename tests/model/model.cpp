@@ -0,0 +1,498 @@
+/*
+ * The driver against the chip model: pairs of radios, and a star of them,
+ * on one virtual air.
+ *
+ * To run:
+ *  make test
+ *  Look for "+OK PASS" or "+OK FAIL"
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include "rf24.h"
+
+using namespace rf24::model;
+
+typedef RF24<Io, 5> Rf24;
+
+static const uint8_t addresses[][6] = { "1Node", "2Node" };
+
+static int failures = 0;
+
+#define CHECK(condition) do { \
+    if(!(condition)) { \
+        printf("%s:%d: %s\n", __FILE__, __LINE__, #condition); \
+        failures++; \
+    } \
+} while(0)
+
+// A fresh pair: ping sends to pong, which listens on pipe 1
+struct Pair {
+    Air air;
+    Chip pingChip;
+    Chip pongChip;
+    Rf24 ping;
+    Rf24 pong;
+
+    Pair() : pingChip(air), pongChip(air), ping(Io(&pingChip)), pong(Io(&pongChip)) {
+        Clock::shared().reset();
+        CHECK(ping.begin());
+        CHECK(pong.begin());
+        ping.openWritingPipe(addresses[0]);
+        pong.openReadingPipe(1, addresses[0]);
+    }
+
+    void dynamic() {
+        ping.set(DynamicPayload::feature.enable());
+        ping.set(DynamicPayload::all.enable());
+        pong.set(DynamicPayload::feature.enable());
+        pong.set(DynamicPayload::all.enable());
+    }
+
+    // Send one payload, and wait for it to be acked, or not
+    bool send(const void *buf, uint8_t len) {
+        ping.startFastWrite(buf, len, false);
+        return ping.txStandBy();
+    }
+};
+
+static void testBegin() {
+    Pair pair;
+    CHECK(pair.pingChip.peek(RF_CH) == 76);
+    CHECK(pair.pingChip.peek(CONFIG) == 0x0f);
+    CHECK(pair.pingChip.peek(RX_PW_P1) == 0);
+    CHECK(pair.pongChip.peek(RX_PW_P1) == 32);
+    CHECK(pair.pongChip.peek(EN_RXADDR) == 0x03);
+    // begin() waits 5ms, twice for the power up
+    CHECK(Clock::shared().now() > 10000000);
+}
+
+static void testStatic() {
+    Pair pair;
+    pair.pong.startListening();
+    pair.ping.stopListening();
+
+    uint8_t sent[32];
+    for(uint8_t i = 0; i < sizeof(sent); i++) {
+        sent[i] = i;
+    }
+    CHECK(pair.send(sent, sizeof(sent)));
+    CHECK(pair.pingChip.stats.acked == 1);
+    CHECK(pair.pong.status().rxPipeNo() == 1);
+
+    uint8_t received[32];
+    pair.pong.read(received, sizeof(received));
+    CHECK(memcmp(sent, received, sizeof(sent)) == 0);
+    CHECK(pair.pong.fifoStatus().rxEmpty());
+
+    // A static pipe only takes its own length
+    CHECK(!pair.send(sent, 8));
+    CHECK(pair.pingChip.stats.maxRetries == 1);
+    CHECK(pair.pongChip.stats.received == 1);
+}
+
+static void testDynamicAndAckPayloads() {
+    Pair pair;
+    pair.dynamic();
+    pair.ping.enableAckPayload();
+    pair.pong.enableAckPayload();
+    pair.ping.set(Retries::retries(5, 15));
+    pair.pong.startListening();
+    pair.pong.writeAckPayload(1, "ack", 3);
+    pair.ping.stopListening();
+
+    CHECK(pair.send("hello", 5));
+    CHECK(pair.pong.getDynamicPayloadSize() == 5);
+    char buffer[32];
+    pair.pong.read(buffer, 5);
+    CHECK(memcmp(buffer, "hello", 5) == 0);
+
+    // The ack payload comes back on pipe 0
+    CHECK(pair.ping.status().rxPipeNo() == 0);
+    CHECK(pair.ping.getDynamicPayloadSize() == 3);
+    pair.ping.read(buffer, 3);
+    CHECK(memcmp(buffer, "ack", 3) == 0);
+    CHECK(pair.pong.fifoStatus().txEmpty());
+
+    // The FIFOs hold three, and the last one out wins the IRQ
+    pair.ping.startFastWrite("a", 1, false, false);
+    pair.ping.startFastWrite("bb", 2, false, false);
+    pair.ping.startFastWrite("ccc", 3, false);
+    CHECK(pair.ping.fifoStatus().txFull());
+    CHECK(pair.ping.status().txFifoFull());
+    CHECK(pair.ping.txStandBy());
+    CHECK(pair.pong.fifoStatus().rxFull());
+    for(uint8_t i = 1; i <= 3; i++) {
+        CHECK(pair.pong.getDynamicPayloadSize() == i);
+        pair.pong.read(buffer, i);
+        CHECK(buffer[0] == 'a' + i - 1);
+    }
+}
+
+static void testRetries() {
+    Pair pair;
+    pair.ping.set(Retries::retries(0, 3));
+    pair.ping.stopListening();
+
+    // Nobody listening: the first go and three retries, 250us apart
+    uint64_t start = Clock::shared().now();
+    uint8_t payload[32] = { 0 };
+    CHECK(!pair.send(payload, sizeof(payload)));
+    CHECK(pair.pingChip.stats.sent == 1);
+    CHECK(pair.pingChip.stats.retransmits == 3);
+    CHECK((pair.pingChip.peek(OBSERVE_TX) & 0x0f) == 3);
+    CHECK((pair.pingChip.peek(OBSERVE_TX) >> 4) == 1);
+    uint64_t elapsed = Clock::shared().now() - start;
+    CHECK(elapsed > 130000 + 4 * 250000);
+    CHECK(elapsed < 130000 + 4 * 250000 + 4 * 350000);
+}
+
+static void testDuplicates() {
+    Pair pair;
+    pair.dynamic();
+    pair.ping.enableAckPayload();
+    pair.pong.enableAckPayload();
+    // 250us is too short for an ack with 32 bytes, so every retry the
+    // pong is back in time to hear is a duplicate, which is acked again
+    // but not received again
+    pair.ping.set(Retries::retries(0, 15));
+    pair.pong.startListening();
+    uint8_t payload[32] = { 0 };
+    pair.pong.writeAckPayload(1, payload, sizeof(payload));
+    pair.ping.stopListening();
+
+    CHECK(!pair.send("x", 1));
+    CHECK(pair.pongChip.stats.received == 1);
+    CHECK(pair.pongChip.stats.duplicates > 0);
+    CHECK(pair.pongChip.stats.acksSent == 1 + pair.pongChip.stats.duplicates);
+
+    // With time for it, the ack arrives
+    pair.ping.set(Retries::retries(2, 2));
+    pair.ping.resetStatus();
+    pair.pong.writeAckPayload(1, payload, sizeof(payload));
+    CHECK(pair.send("y", 1));
+    CHECK(pair.pongChip.stats.received == 2);
+}
+
+static void testNoAck() {
+    Pair pair;
+    pair.pong.set(AutoAck::all.disable());
+    pair.ping.set(AutoAck::all.disable());
+    pair.pong.startListening();
+    pair.ping.stopListening();
+
+    uint8_t payload[32] = { 0 };
+    CHECK(pair.send(payload, sizeof(payload)));
+    CHECK(pair.pingChip.stats.acked == 0);
+    CHECK(pair.pongChip.stats.received == 1);
+    CHECK(pair.pongChip.stats.acksSent == 0);
+}
+
+static void testRxFull() {
+    Pair pair;
+    pair.ping.set(Retries::retries(0, 1));
+    pair.pong.startListening();
+    pair.ping.stopListening();
+
+    uint8_t payload[32] = { 0 };
+    for(uint8_t i = 0; i < 3; i++) {
+        payload[0] = i;
+        CHECK(pair.send(payload, sizeof(payload)));
+    }
+    // A full RX FIFO doesn't ack
+    payload[0] = 3;
+    CHECK(!pair.send(payload, sizeof(payload)));
+    CHECK(pair.pongChip.stats.overflows == 2);
+}
+
+static void testTurnaround() {
+    Pair pair;
+    pair.dynamic();
+    pair.pong.openWritingPipe(addresses[1]);
+    pair.pong.openReadingPipe(0, addresses[1]);
+    pair.ping.openReadingPipe(0, addresses[0]);
+    pair.ping.openReadingPipe(1, addresses[1]);
+    pair.pong.startListening();
+    pair.ping.startListening();
+
+    pair.ping.turnaround(false);
+    pair.ping.startFastWrite("ping", 4, false);
+    CHECK(pair.ping.txStandBy());
+    pair.ping.turnaround(true);
+
+    pair.pong.turnaround(false);
+    pair.pong.startFastWrite("pong", 4, false);
+    CHECK(pair.pong.txStandBy());
+    pair.pong.turnaround(true);
+
+    char buffer[4];
+    CHECK(pair.ping.status().rxPipeNo() == 1);
+    pair.ping.read(buffer, 4);
+    CHECK(memcmp(buffer, "pong", 4) == 0);
+    CHECK(pair.pong.status().rxPipeNo() == 1);
+    pair.pong.read(buffer, 4);
+    CHECK(memcmp(buffer, "ping", 4) == 0);
+}
+
+static void testRange() {
+    Pair pair;
+    pair.ping.set(Retries::retries(1, 3));
+    pair.pong.startListening();
+    pair.ping.stopListening();
+    uint8_t payload[32] = { 0 };
+
+    // Near enough to set RPD
+    pair.air.place(pair.pongChip, 10, 0);
+    CHECK(pair.send(payload, sizeof(payload)));
+    CHECK(pair.pong.testRPD());
+
+    // Heard, but not strongly: -40dB at 1m, and 20dB a decade
+    pair.air.place(pair.pongChip, 30, 0);
+    pair.pong.stopListening();
+    pair.pong.startListening();
+    CHECK(pair.send(payload, sizeof(payload)));
+    CHECK(!pair.pong.testRPD());
+
+    // Too far for 1Mbps, which needs -85dBm, but not for 250kbps
+    pair.air.place(pair.pongChip, 300, 0);
+    CHECK(!pair.send(payload, sizeof(payload)));
+    CHECK(pair.air.stats.weak > 0);
+    pair.ping.flush_tx();
+    pair.ping.resetStatus();
+    pair.ping.set(DataRate::_250KBPS);
+    pair.pong.set(DataRate::_250KBPS);
+    CHECK(pair.send(payload, sizeof(payload)));
+    CHECK(pair.pongChip.stats.received == 3);
+}
+
+static void testLoss() {
+    Pair pair;
+    pair.ping.set(Retries::retries(1, 15));
+    pair.pong.startListening();
+    pair.ping.stopListening();
+    uint8_t payload[32] = { 0 };
+
+    pair.air.conditions.loss = 1;
+    CHECK(!pair.send(payload, sizeof(payload)));
+    pair.ping.flush_tx();
+    pair.ping.resetStatus();
+
+    // Retries get through a lossy channel, and through bit errors, at a
+    // cost in time
+    pair.air.conditions.loss = 0.2;
+    pair.air.conditions.bitErrorRate = 0.0005;
+    for(uint8_t i = 0; i < 30; i++) {
+        payload[0] = i;
+        CHECK(pair.send(payload, sizeof(payload)));
+        pair.pong.read(payload, sizeof(payload));
+        CHECK(payload[0] == i);
+    }
+    CHECK(pair.pingChip.stats.retransmits > 10);
+    CHECK(pair.pongChip.stats.received == 30);
+}
+
+static void testCollision() {
+    Pair pair;
+    Chip otherChip(pair.air);
+    Io otherIo(&otherChip);
+    Rf24 other(otherIo);
+    CHECK(other.begin());
+    other.openWritingPipe(addresses[0]);
+    pair.ping.set(AutoAck::all.disable());
+    pair.pong.set(AutoAck::all.disable());
+    other.set(AutoAck::all.disable());
+    pair.pong.startListening();
+    pair.ping.stopListening();
+    other.stopListening();
+    uint8_t payload[32] = { 0 };
+
+    // The two overlap, and are as strong as each other, so both are lost
+    pair.air.place(pair.pongChip, 5, 0);
+    pair.air.place(otherChip, 10, 0);
+    pair.ping.startFastWrite(payload, sizeof(payload), false);
+    other.startFastWrite(payload, sizeof(payload), false);
+    CHECK(pair.ping.txStandBy());
+    CHECK(other.txStandBy());
+    CHECK(pair.air.stats.collisions == 2);
+    CHECK(pair.pongChip.stats.received == 0);
+
+    // Far enough off, the other is drowned out, and ping's is captured
+    pair.air.place(otherChip, 100, 0);
+    payload[0] = 1;
+    pair.ping.startFastWrite(payload, sizeof(payload), false);
+    other.startFastWrite(payload, sizeof(payload), false);
+    CHECK(pair.ping.txStandBy());
+    CHECK(other.txStandBy());
+    CHECK(pair.air.stats.collisions == 3);
+    CHECK(pair.pongChip.stats.received == 1);
+
+    // On another channel, there's no collision at all
+    other.set(Channel::channel(90));
+    pair.ping.startFastWrite(payload, sizeof(payload), false);
+    other.startFastWrite(payload, sizeof(payload), false);
+    CHECK(pair.ping.txStandBy());
+    CHECK(other.txStandBy());
+    CHECK(pair.air.stats.collisions == 3);
+}
+
+/*
+ * A star: sensors around a hub, each sending a reading every PERIOD, all
+ * driven by the IRQ, as they would be on boards.
+ */
+static const uint8_t SENSORS = 12;
+static const uint64_t PERIOD_NS = 20000000;
+static const uint64_t RUN_NS = 4000000000ULL;
+
+struct Sensor {
+    Chip chip;
+    Rf24 radio;
+    Timer tick;
+    Timer service;
+    uint8_t id;
+    uint32_t sent;
+    uint32_t acked;
+    uint32_t failed;
+
+    Sensor(Air &air, uint8_t id)
+        : chip(air), radio(Io(&chip)), tick(onTick, this), service(onService, this),
+          id(id), sent(0), acked(0), failed(0) {
+        chip.onIrq(onIrq, this);
+    }
+
+    static void onTick(void *arg) {
+        Sensor *sensor = (Sensor *)arg;
+        uint8_t reading[8] = { sensor->id };
+        memcpy(&reading[4], &sensor->sent, sizeof(sensor->sent));
+        sensor->sent++;
+        sensor->radio.startFastWrite(reading, sizeof(reading), false);
+        Clock &clock = Clock::shared();
+        clock.schedule(sensor->tick, clock.now() + PERIOD_NS + sensor->id * PERIOD_NS / 20000);
+    }
+
+    static void onIrq(void *arg) {
+        Sensor *sensor = (Sensor *)arg;
+        Clock::shared().schedule(sensor->service, Clock::shared().now());
+    }
+
+    static void onService(void *arg) {
+        Sensor *sensor = (Sensor *)arg;
+        Status status = sensor->radio.status();
+        if(status.dataSent()) {
+            sensor->acked++;
+        }
+        if(status.maxRetries()) {
+            sensor->failed++;
+            sensor->radio.flush_tx();
+        }
+        sensor->radio.resetStatus(status);
+    }
+};
+
+struct Hub {
+    Chip chip;
+    Rf24 radio;
+    Timer service;
+    uint32_t received[SENSORS];
+    uint32_t next[SENSORS];     //!< the reading each sensor sends next
+    uint32_t repeats;
+
+    Hub(Air &air) : chip(air), radio(Io(&chip)), service(onService, this), received(), next(), repeats(0) {
+        chip.onIrq(onIrq, this);
+    }
+
+    static void onIrq(void *arg) {
+        Hub *hub = (Hub *)arg;
+        Clock::shared().schedule(hub->service, Clock::shared().now());
+    }
+
+    static void onService(void *arg) {
+        Hub *hub = (Hub *)arg;
+        Status status = hub->radio.status();
+        hub->radio.resetStatus(status);
+        while(!hub->radio.fifoStatus().rxEmpty()) {
+            uint8_t reading[8];
+            hub->radio.readPayload(reading, sizeof(reading));
+            uint32_t sequence;
+            memcpy(&sequence, &reading[4], sizeof(sequence));
+            if(reading[0] >= SENSORS) {
+                continue;
+            }
+            // PID duplicate detection only compares with the last packet,
+            // so a retransmit after another sensor's packet gets through
+            if(sequence < hub->next[reading[0]]) {
+                hub->repeats++;
+            } else {
+                hub->received[reading[0]]++;
+                hub->next[reading[0]] = sequence + 1;
+            }
+        }
+    }
+};
+
+static void testStar() {
+    Clock &clock = Clock::shared();
+    clock.reset();
+    Air air;
+    air.seed(1);
+    air.conditions.pathLossExponent = 3;
+
+    Hub hub(air);
+    CHECK(hub.radio.begin());
+    hub.radio.set(DynamicPayload::feature.enable());
+    hub.radio.set(DynamicPayload::all.enable());
+    hub.radio.openReadingPipe(1, addresses[0]);
+    hub.radio.startListening();
+
+    Sensor *sensors[SENSORS];
+    for(uint8_t i = 0; i < SENSORS; i++) {
+        Sensor *sensor = sensors[i] = new Sensor(air, i);
+        double angle = 2 * 3.14159 * i / SENSORS;
+        air.place(sensor->chip, (5 + i) * cos(angle), (5 + i) * sin(angle));
+        CHECK(sensor->radio.begin());
+        sensor->radio.set(DynamicPayload::feature.enable());
+        sensor->radio.set(DynamicPayload::all.enable());
+        // Different delays, so two that collide don't keep colliding
+        sensor->radio.set(Retries::retries(1 + i % 4, 15));
+        sensor->radio.openWritingPipe(addresses[0]);
+        sensor->radio.stopListening();
+    }
+    // Evenly spread at first, but their crystals differ by 50ppm each, so
+    // they drift through each other
+    uint64_t start = clock.now();
+    for(uint8_t i = 0; i < SENSORS; i++) {
+        clock.schedule(sensors[i]->tick, start + PERIOD_NS * i / SENSORS);
+    }
+
+    clock.advance(RUN_NS);
+
+    uint32_t sent = 0, failed = 0, received = 0;
+    for(uint8_t i = 0; i < SENSORS; i++) {
+        sent += sensors[i]->sent;
+        failed += sensors[i]->failed;
+        received += hub.received[i];
+        CHECK(hub.received[i] > 0);
+        delete sensors[i];
+    }
+    CHECK(sent >= SENSORS * (RUN_NS / PERIOD_NS) - SENSORS);
+    CHECK(air.stats.collisions > 0);
+    CHECK(received <= sent && received >= sent * 9 / 10);
+    CHECK(failed < sent / 10);
+}
+
+int main() {
+    testBegin();
+    testStatic();
+    testDynamicAndAckPayloads();
+    testRetries();
+    testDuplicates();
+    testNoAck();
+    testRxFull();
+    testTurnaround();
+    testRange();
+    testLoss();
+    testCollision();
+    testStar();
+
+    printf(failures == 0 ? "+OK PASS\n" : "+OK FAIL\n");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,144 @@
+/*
+ * How many SPI transactions, and bytes, each driver call takes, against
+ * the chip model, checked against a budget for each. A call that takes
+ * more than its budget fails; one that takes less should have its budget
+ * lowered, to keep it there.
+ *
+ * To run:
+ *  make test
+ *  Look for "+OK PASS" or "+OK FAIL"; -v prints every call's cost
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "rf24.h"
+#include "rf24-accounting-io.h"
+
+using namespace rf24::model;
+using rf24::AccountingIo;
+using rf24::SpiAccount;
+using rf24::SpiMarker;
+
+typedef RF24<AccountingIo<Io>, 5> Rf24;
+
+static const uint8_t addresses[][6] = { "1Node", "2Node" };
+
+struct Budget {
+    const char *name;
+    uint32_t transactions;
+    uint32_t bytes;
+};
+
+// The most any one call can take. set() reads the register, and if the
+// value changes, writes it and reads it back
+static const Budget budgets[] = {
+    { "begin", 23, 44 },
+    { "set", 3, 6 },
+    { "openWritingPipe", 3, 14 },
+    { "openReadingPipe", 3, 10 },
+    { "startListening", 9, 17 },
+    { "stopListening", 7, 13 },
+    { "turnaround", 1, 2 },
+    { "startFastWrite", 1, 33 },
+    { "writeAckPayload", 1, 4 },
+    { "status", 1, 1 },
+    { "resetStatus", 1, 2 },
+    { "fifoStatus", 1, 2 },
+    { "getDynamicPayloadSize", 1, 2 },
+    { "readPayload", 1, 33 },
+    { "read", 2, 6 },
+    { "flush_tx", 1, 1 },
+    { "powerDown", 3, 6 },
+    { "powerUp", 3, 6 },
+};
+
+#define MARK(name, call) do { \
+    SpiMarker marker(account, name); \
+    call; \
+} while(0)
+
+int main(int argc, char **argv) {
+    bool verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+
+    Air air;
+    Chip pingChip(air);
+    Chip pongChip(air);
+    SpiAccount account;
+    Rf24 ping(AccountingIo<Io>(Io(&pingChip), &account));
+    Rf24 pong(AccountingIo<Io>(Io(&pongChip), &account));
+    Clock::shared().reset();
+
+    // Everything a ping pair with ack payloads does
+    MARK("begin", ping.begin());
+    MARK("begin", pong.begin());
+    Rf24 *radios[] = { &ping, &pong };
+    for(Rf24 *radio : radios) {
+        MARK("set", radio->set(DynamicPayload::feature.enable()));
+        MARK("set", radio->set(DynamicPayload::all.enable()));
+        MARK("set", radio->set(DataRate::_2MBPS));
+        radio->enableAckPayload();
+    }
+    MARK("openWritingPipe", ping.openWritingPipe(addresses[0]));
+    MARK("openReadingPipe", ping.openReadingPipe(1, addresses[1]));
+    MARK("openWritingPipe", pong.openWritingPipe(addresses[1]));
+    MARK("openReadingPipe", pong.openReadingPipe(1, addresses[0]));
+    MARK("startListening", pong.startListening());
+    MARK("stopListening", ping.stopListening());
+
+    uint8_t payload[32] = { 0 };
+    for(uint8_t i = 0; i < 10; i++) {
+        MARK("writeAckPayload", pong.writeAckPayload(1, "ack", 3));
+        MARK("startFastWrite", ping.startFastWrite(payload, sizeof(payload), false));
+        // txStandBy() polls, so what it costs depends on the timing
+        ping.txStandBy();
+
+        Status status;
+        MARK("status", status = pong.status());
+        MARK("resetStatus", pong.resetStatus(status));
+        bool empty;
+        MARK("fifoStatus", empty = pong.fifoStatus().rxEmpty());
+        if(!empty) {
+            uint8_t length;
+            MARK("getDynamicPayloadSize", length = pong.getDynamicPayloadSize());
+            MARK("readPayload", pong.readPayload(payload, length));
+        }
+        MARK("getDynamicPayloadSize", ping.getDynamicPayloadSize());
+        MARK("read", ping.read(payload, 3));
+    }
+
+    // Back and forth
+    MARK("turnaround", ping.turnaround(true));
+    MARK("turnaround", ping.turnaround(false));
+    MARK("startListening", ping.startListening());
+    MARK("stopListening", ping.stopListening());
+    MARK("flush_tx", ping.flush_tx());
+    MARK("powerDown", ping.powerDown());
+    MARK("powerUp", ping.powerUp());
+
+    int failures = 0;
+    for(const Budget &budget : budgets) {
+        const SpiAccount::Totals *totals = account.find(budget.name);
+        if(totals == NULL || totals->calls == 0) {
+            printf("%s: never called\n", budget.name);
+            failures++;
+            continue;
+        }
+        uint32_t transactions = totals->mostTransactions;
+        uint32_t bytes = totals->mostBytes;
+        bool over = transactions > budget.transactions || bytes > budget.bytes;
+        if(verbose || over) {
+            printf("%s: up to %u transactions, %u bytes, over %u calls; budget %u, %u\n",
+                    budget.name, transactions, bytes, totals->calls, budget.transactions, budget.bytes);
+        }
+        if(over) {
+            failures++;
+        }
+    }
+    if(verbose) {
+        printf("total: %u transactions, %u bytes, %u us\n",
+                account.total().transactions, account.total().bytes, account.total().micros);
+    }
+
+    printf(failures == 0 ? "+OK PASS\n" : "+OK FAIL\n");
+    return failures == 0 ? 0 : 1;
+}
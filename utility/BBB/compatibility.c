@@ -18,12 +18,37 @@ void __msleep(int milisec)
 	nanosleep(&req, (struct timespec *)NULL);	
 }
 
-void __usleep(int milisec)
+/**
+ * Sleeping wakes up late by tens of microseconds, which is most of a
+ * radio turnaround, so short delays spin on the monotonic clock instead.
+ */
+#define BUSY_WAIT_LIMIT_US 200
+
+void __usleep(int microsec)
 {
+	if(microsec < BUSY_WAIT_LIMIT_US) {
+		struct timespec start, now;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		do {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+		} while((now.tv_sec - start.tv_sec) * 1000000L + (now.tv_nsec - start.tv_nsec) / 1000L < microsec);
+		return;
+	}
+
 	struct timespec req = {0};
-	req.tv_sec = 0;
-	req.tv_nsec = milisec * 1000L;
-	nanosleep(&req, (struct timespec *)NULL);	
+	req.tv_sec = microsec / 1000000;
+	req.tv_nsec = (microsec % 1000000) * 1000L;
+	clock_nanosleep(CLOCK_MONOTONIC, 0, &req, (struct timespec *)NULL);
+}
+
+/**
+ * This function is added in order to simulate arduino micros() function
+ */
+unsigned long __micros()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long)now.tv_sec * 1000000UL + now.tv_nsec / 1000;
 }
 
 /**
@@ -17,7 +17,8 @@ extern "C" {
 #include <sys/time.h>
 
 void __msleep(int milisec);
-void __usleep(int milisec);
+void __usleep(int microsec);
+unsigned long __micros();
 void __start_timer();
 long __millis();
 
@@ -10,6 +10,35 @@
  */
 
 #include "gpio.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * The value files, kept open after the first access, so that a write is a
+ * single write() rather than an fopen, an fprintf and an fclose.
+ */
+static const int MAX_PORT = 256;
+static int valueFds[MAX_PORT];
+static bool valueFdsReady = false;
+
+static int valueFd(int port)
+{
+	if(!valueFdsReady) {
+		for(int i = 0; i < MAX_PORT; ++i) {
+			valueFds[i] = -1;
+		}
+		valueFdsReady = true;
+	}
+	if(port < 0 || port >= MAX_PORT) {
+		return -1;
+	}
+	if(valueFds[port] < 0) {
+		char file[128];
+		sprintf(file, "/sys/class/gpio/gpio%d/value", port);
+		valueFds[port] = ::open(file, O_RDWR);
+	}
+	return valueFds[port];
+}
 
 GPIO::GPIO() {
 }
@@ -34,6 +63,11 @@ void GPIO::open(int port, int DDR)
 
 void GPIO::close(int port)
 {
+	if(valueFdsReady && port >= 0 && port < MAX_PORT && valueFds[port] >= 0) {
+		::close(valueFds[port]);
+		valueFds[port] = -1;
+	}
+
 	FILE *f;
 	f = fopen("/sys/class/gpio/unexport", "w");
 	fprintf(f, "%d\n", port);
@@ -42,27 +76,16 @@ void GPIO::close(int port)
 
 int GPIO::read(int port)
 {
-	FILE *f;
-	
-	char file[128];
-	sprintf(file, "/sys/class/gpio/gpio%d/value", port);
-	f = fopen(file, "r");
-
-	int i;
-	fscanf(f, "%d", &i);
-	fclose(f);
-	return i;
-
+	char c;
+	int fd = valueFd(port);
+	// sysfs only gives the value again from the start of the file
+	if(fd < 0 || pread(fd, &c, 1, 0) != 1) {
+		return -1;
+	}
+	return c == '1';
 }
-void GPIO::write(int port, int value){
-	FILE *f;
 
-	char file[128];
-	sprintf(file, "/sys/class/gpio/gpio%d/value", port);
-	f = fopen(file, "w");
-	
-	if (value == 0)	fprintf(f, "0\n");
-	else		fprintf(f, "1\n");
-	
-	fclose(f);
+bool GPIO::write(int port, int value){
+	int fd = valueFd(port);
+	return fd >= 0 && ::write(fd, value == 0 ? "0" : "1", 1) == 1;
 }
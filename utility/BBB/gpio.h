@@ -57,15 +57,16 @@ public:
 	/**
 	 * Similar to Arduino digitalRead(pin);
      * @param port
-     * @param value
+     * @return the level, or -1 if it couldn't be read
      */
 	static int read(int port);
 	/**
 	* Similar to Arduino digitalWrite(pin,state);
 	* @param port
 	* @param value
+	* @return false if the level couldn't be set
 	*/	
-	static void write(int port,int value);	
+	static bool write(int port,int value);	
 	
 	virtual ~GPIO();
 	
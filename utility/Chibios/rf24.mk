@@ -1,2 +1,3 @@
 RF24INC = $(RF24)/src
-RF24SRC = $(RF24)/src/rf24-chibios-io.cpp $(RF24)/src/rf24.cpp
+RF24SRC = $(RF24)/src/rf24-chibios-io.cpp $(RF24)/src/rf24-chibios-timing.cpp $(RF24)/src/rf24.cpp
+RF24SERIALSRC = $(RF24)/src/rf24-chibios-serial.cpp $(RF24)/src/rf24-chibios-bridge.cpp $(RF24)/src/rf24-chibios-mux.cpp
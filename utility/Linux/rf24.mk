@@ -0,0 +1,7 @@
+RF24INC = $(RF24)/src
+RF24SRC = $(RF24)/src/rf24-linux-io.cpp $(RF24)/src/rf24-linux-gpio.cpp $(RF24)/src/rf24-linux-timing.cpp \
+          $(RF24)/src/rf24-linux-loop.cpp $(RF24)/src/rf24-linux-radio.cpp $(RF24)/src/rf24-linux-client.cpp \
+          $(RF24)/src/rf24-linux-rt.cpp $(RF24)/src/rf24-linux-tun.cpp $(RF24)/src/rf24-lowpan.cpp \
+          $(RF24)/src/rf24.cpp
+RF24DEFS = -DRF24_LINUX
+RF24LIBS = -lpthread
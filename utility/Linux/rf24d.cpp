@@ -0,0 +1,603 @@
+/*
+ * rf24d: owns the radios, so that several processes can share them.
+ *
+ * Each client connects to the control socket and attaches, and gets a
+ * shared memory region with a ring each way, and an eventfd each way for
+ * wakeups. Payloads then go through the rings, and the socket is only
+ * used for configuration. See rf24-linux-shm.h for the protocol, and
+ * Rf24dClient for the client side.
+ *
+ * rf24d [-s socket] [-p priority] [-c cpu] [-l] -r spidev,ce,irq [-r ...]
+ *
+ * where ce and irq are each a GPIO chip and line, like
+ * /dev/gpiochip0:25, or a sysfs pin number. The radios run on their own
+ * thread, with SCHED_FIFO at the priority given by -p, pinned to the CPU
+ * given by -c, and with all memory locked with -l. SIGUSR1 prints how
+ * late the radios have been serviced after their IRQ edges.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+
+#include "rf24-linux-io.h"
+#include "rf24-linux-loop.h"
+#include "rf24-linux-radio.h"
+#include "rf24-linux-rt.h"
+#include "rf24-linux-shm.h"
+
+static const int MAX_CLIENTS = 16;
+
+typedef RF24<Rf24LinuxIo, Rf24LinuxRadio::ADDRESS_WIDTH> Rf24;
+
+struct Daemon;
+
+struct Radio {
+    Rf24LinuxSpi spi;
+    Rf24LinuxGpio ce;
+    Rf24LinuxIrq irq;
+    Rf24LinuxRadio driver;
+    Daemon *daemon;
+    uint8_t index;
+    // Where the writing pipe is, if anywhere yet
+    uint8_t writing[Rf24LinuxRadio::ADDRESS_WIDTH];
+    bool addressed;
+    // A payload for another address is waiting for the FIFO to empty
+    bool draining;
+
+    Radio(const char *device, const char *cePin, unsigned ceLine, int ceSysfs,
+            const char *irqPin, unsigned irqLine, int irqSysfs)
+        : spi(device), ce(cePin, ceLine, ceSysfs), irq(irqPin, irqLine, irqSysfs),
+          driver(Rf24LinuxIo(&spi, &ce), &irq), daemon(NULL), index(0),
+          writing(), addressed(false), draining(false) {
+    }
+};
+
+struct Client {
+    Daemon *daemon;
+    int control;
+    int daemonEvent;
+    int clientEvent;
+    Rf24dRegion *region;
+    // Our ends of the rings, which the client can't touch
+    uint32_t receiveHead;
+    uint32_t transmitTail;
+    uint8_t subscriptions[RF24D_MAX_RADIOS];
+    Rf24LinuxWatch controlWatch;
+    Rf24LinuxWatch eventWatch;
+};
+
+struct Daemon {
+    Rf24LinuxLoop loop;
+    int listener;
+    Rf24LinuxWatch listenerWatch;
+    Radio *radios[RF24D_MAX_RADIOS];
+    uint8_t radioCount;
+    Client clients[MAX_CLIENTS];
+    // Where the transmit round robin starts next time
+    int nextClient;
+    Rf24RtThread thread;
+    Rf24LatencyHistogram latency;
+};
+
+static Daemon rf24d;
+
+static void pump(Daemon *d);
+static void closeClient(Client *client);
+
+static void wakeClient(Client *client) {
+    uint64_t one = 1;
+    // EAGAIN: the counter is full, so a wakeup is pending anyway
+    if(write(client->clientEvent, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        // It would sleep through everything from here on
+        perror("rf24d: wake client");
+        closeClient(client);
+    }
+}
+
+/*
+ * Radios
+ */
+
+// A GPIO is chip:line, or just a sysfs pin number
+static bool parseGpio(char *spec, const char **chip, unsigned *line, int *sysfs) {
+    char *colon = strrchr(spec, ':');
+    char *end;
+    if(colon == NULL) {
+        *chip = NULL;
+        *line = 0;
+        *sysfs = strtol(spec, &end, 0);
+        return *end == '\0' && *sysfs >= 0;
+    }
+    *colon = '\0';
+    *chip = spec;
+    *line = strtoul(colon + 1, &end, 0);
+    *sysfs = -1;
+    return *end == '\0';
+}
+
+static Radio *parseRadio(char *spec) {
+    char *device = strtok(spec, ",");
+    char *ceSpec = strtok(NULL, ",");
+    char *irqSpec = strtok(NULL, ",");
+    const char *cePin, *irqPin;
+    unsigned ceLine, irqLine;
+    int ceSysfs, irqSysfs;
+    if(device == NULL || ceSpec == NULL || irqSpec == NULL
+            || !parseGpio(ceSpec, &cePin, &ceLine, &ceSysfs)
+            || !parseGpio(irqSpec, &irqPin, &irqLine, &irqSysfs)) {
+        return NULL;
+    }
+    return new Radio(device, cePin, ceLine, ceSysfs, irqPin, irqLine, irqSysfs);
+}
+
+static void radioReceive(void *arg, uint8_t pipe, const uint8_t *payload, uint8_t length) {
+    Radio *radio = (Radio *)arg;
+    Daemon *d = radio->daemon;
+    Rf24dPacket packet;
+    packet.radio = radio->index;
+    packet.pipe = pipe;
+    packet.length = length;
+    packet.flags = 0;
+    memcpy(packet.data, payload, length);
+
+    for(int i = 0; i < MAX_CLIENTS; i++) {
+        Client *client = &d->clients[i];
+        if(client->region == NULL || !(client->subscriptions[radio->index] & (1 << pipe))) {
+            continue;
+        }
+        // A client that doesn't keep up loses payloads; it can't hold up the
+        // radio, or the other clients
+        if(!client->region->receive.put(packet, client->receiveHead)) {
+            if(errno == EPROTO) {
+                closeClient(client);
+            } else {
+                client->region->receiveDropped++;
+            }
+            continue;
+        }
+        if(client->region->receive.wakeConsumer()) {
+            wakeClient(client);
+        }
+    }
+}
+
+static void radioSent(void *arg, bool delivered) {
+    (void)delivered;
+    Radio *radio = (Radio *)arg;
+    pump(radio->daemon);
+}
+
+static bool startRadio(Radio *radio) {
+    Rf24 &r = radio->driver.radio;
+    if(!radio->spi.begin() || !radio->ce.begin()) {
+        return false;
+    }
+    if(!r.begin()) {
+        errno = ENODEV;
+        return false;
+    }
+    r.set(AutoAck::all.enable());
+    r.set(Retries::retries(5, 15));
+    // Payloads are whatever length the clients make them
+    r.enableAckPayload();
+    r.set(DynamicPayload::all.enable());
+    r.startListening();
+
+    radio->driver.onReceive(radioReceive, radio);
+    radio->driver.onSent(radioSent, radio);
+    radio->driver.halfDuplex(true);
+    radio->driver.measure(&rf24d.latency);
+    return radio->driver.start(rf24d.loop);
+}
+
+// The writing pipe's address applies to whatever the FIFO sends next, so
+// it only moves once the FIFO is empty, and nothing else goes in while a
+// payload waits for that, or it could wait for ever.
+static bool transmit(Radio *radio, const Rf24dPacket &packet) {
+    Rf24 &r = radio->driver.radio;
+    bool moving = !radio->addressed || memcmp(radio->writing, packet.address, sizeof(radio->writing)) != 0;
+    if(moving || radio->draining) {
+        if(!r.fifoStatus().txEmpty()) {
+            radio->draining = radio->draining || moving;
+            return false;
+        }
+        radio->draining = false;
+    }
+    if(moving) {
+        r.openWritingPipe(packet.address);
+        // And leave pipe 0 open on it through turnarounds, for the acks
+        r.openReadingPipe(0, packet.address);
+        memcpy(radio->writing, packet.address, sizeof(radio->writing));
+        radio->addressed = true;
+    }
+    return radio->driver.send(packet.data, packet.length, packet.flags & RF24D_PACKET_MULTICAST);
+}
+
+/*
+ * Moving payloads from the clients' rings to the radios
+ */
+
+// Take payloads round robin until every ring is empty, or is waiting for
+// a radio with a full FIFO. A client's payloads go out in order, so one
+// for a busy radio holds up the ones behind it. A client that breaks the
+// ring is cut off.
+static void pump(Daemon *d) {
+    bool progress = true;
+    while(progress) {
+        progress = false;
+        for(int n = 0; n < MAX_CLIENTS; n++) {
+            Client *client = &d->clients[(d->nextClient + n) % MAX_CLIENTS];
+            if(client->region == NULL) {
+                continue;
+            }
+            Rf24dRing &ring = client->region->transmit;
+            const Rf24dPacket *front = ring.front(client->transmitTail);
+            if(front == NULL) {
+                if(errno == EPROTO) {
+                    closeClient(client);
+                } else if(!ring.armConsumer(client->transmitTail)) {
+                    // It filled up in the meantime, so don't go to sleep
+                    progress = true;
+                }
+                continue;
+            }
+            // Checked and sent from our own copy, which the client can't change
+            Rf24dPacket packet = *front;
+            if(packet.radio >= d->radioCount || packet.length == 0 || packet.length > RF24D_PAYLOAD_SIZE) {
+                client->region->transmitRejected++;
+            } else if(!transmit(d->radios[packet.radio], packet)) {
+                continue;
+            }
+            ring.pop(client->transmitTail);
+            if(ring.wakeProducer()) {
+                wakeClient(client);
+            }
+            progress = true;
+        }
+        d->nextClient = (d->nextClient + 1) % MAX_CLIENTS;
+    }
+}
+
+/*
+ * Clients
+ */
+
+static void closeClient(Client *client) {
+    if(client->control < 0) {
+        return;
+    }
+    Daemon *d = client->daemon;
+    d->loop.remove(client->control);
+    d->loop.remove(client->daemonEvent);
+    close(client->control);
+    close(client->daemonEvent);
+    close(client->clientEvent);
+    if(client->region != NULL) {
+        munmap(client->region, sizeof(Rf24dRegion));
+        client->region = NULL;
+    }
+    client->control = -1;
+}
+
+static int memfd(const char *name) {
+    return syscall(SYS_memfd_create, name, 1 /* MFD_CLOEXEC */);
+}
+
+// The region and the eventfds, sent as the reply to RF24D_ATTACH
+static int attach(Client *client, int fds[3]) {
+    int region = memfd("rf24d");
+    if(region < 0) {
+        return errno;
+    }
+    if(ftruncate(region, sizeof(Rf24dRegion)) < 0) {
+        int error = errno;
+        close(region);
+        return error;
+    }
+    void *shared = mmap(NULL, sizeof(Rf24dRegion), PROT_READ | PROT_WRITE, MAP_SHARED, region, 0);
+    if(shared == MAP_FAILED) {
+        int error = errno;
+        close(region);
+        return error;
+    }
+
+    client->region = (Rf24dRegion *)shared;
+    client->region->magic = RF24D_MAGIC;
+    client->region->version = RF24D_VERSION;
+    client->region->transmit.reset();
+    client->region->receive.reset();
+    client->region->receiveDropped.store(0);
+    client->region->transmitRejected.store(0);
+    client->receiveHead = 0;
+    client->transmitTail = 0;
+    // Until the client puts something in, there's nothing to do
+    client->region->transmit.armConsumer(client->transmitTail);
+
+    fds[0] = region;
+    fds[1] = client->daemonEvent;
+    fds[2] = client->clientEvent;
+    return 0;
+}
+
+static int configure(Daemon *d, Client *client, const Rf24dRequest &request, Rf24dReply &reply) {
+    if(request.radio >= d->radioCount) {
+        return ENODEV;
+    }
+    Radio *radio = d->radios[request.radio];
+    Rf24 &r = radio->driver.radio;
+
+    switch(request.command) {
+    case RF24D_SUBSCRIBE:
+        client->subscriptions[request.radio] = request.value;
+        return 0;
+    case RF24D_OPEN_READING:
+        // Pipe 0 belongs to the writing pipe
+        if(request.pipe < 1 || request.pipe > 5) {
+            return EINVAL;
+        }
+        r.openReadingPipe(request.pipe, request.address);
+        return 0;
+    case RF24D_CHANNEL:
+        return r.set(Channel::channel(request.value)) == Rf24::ERROR ? EIO : 0;
+    case RF24D_STATS:
+        reply.stats.irq = radio->driver.stats.irq;
+        reply.stats.rx = radio->driver.stats.rx;
+        reply.stats.tx = radio->driver.stats.tx;
+        reply.stats.tx_ds = radio->driver.stats.tx_ds;
+        reply.stats.max_rt = radio->driver.stats.max_rt;
+        return 0;
+    default:
+        return EINVAL;
+    }
+}
+
+static void controlEvent(void *arg, uint32_t events) {
+    Client *client = (Client *)arg;
+    Daemon *d = client->daemon;
+    Rf24dRequest request;
+    ssize_t length = recv(client->control, &request, sizeof(request), MSG_DONTWAIT);
+    if(length == 0 || (events & (EPOLLHUP | EPOLLERR))) {
+        closeClient(client);
+        return;
+    }
+    if(length < 0) {
+        return;
+    }
+
+    Rf24dReply reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.radios = d->radioCount;
+    if(length != sizeof(request)) {
+        reply.error = EPROTO;
+        send(client->control, &reply, sizeof(reply), MSG_NOSIGNAL);
+        return;
+    }
+
+    if(request.command != RF24D_ATTACH) {
+        reply.error = configure(d, client, request, reply);
+        send(client->control, &reply, sizeof(reply), MSG_NOSIGNAL);
+        return;
+    }
+
+    int fds[3];
+    if(client->region != NULL) {
+        reply.error = EALREADY;
+    } else {
+        reply.error = attach(client, fds);
+    }
+    struct iovec iov = { &reply, sizeof(reply) };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    char control[CMSG_SPACE(sizeof(fds))];
+    if(reply.error == 0) {
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    }
+    sendmsg(client->control, &message, MSG_NOSIGNAL);
+    if(reply.error == 0) {
+        // The client has its own copy now
+        close(fds[0]);
+    }
+}
+
+static void clientEvent(void *arg, uint32_t events) {
+    (void)events;
+    Client *client = (Client *)arg;
+    uint64_t count;
+    // EAGAIN: an earlier event already took the wakeup
+    if(read(client->daemonEvent, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        // Left readable, it would have the loop spin
+        perror("rf24d: client event");
+        closeClient(client);
+        return;
+    }
+    if(client->region != NULL) {
+        pump(client->daemon);
+    }
+}
+
+static void acceptEvent(void *arg, uint32_t events) {
+    (void)events;
+    Daemon *d = (Daemon *)arg;
+    int control = accept4(d->listener, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if(control < 0) {
+        return;
+    }
+
+    Client *client = NULL;
+    for(int i = 0; i < MAX_CLIENTS; i++) {
+        if(d->clients[i].control < 0) {
+            client = &d->clients[i];
+            break;
+        }
+    }
+    if(client == NULL) {
+        close(control);
+        return;
+    }
+
+    client->control = control;
+    client->daemonEvent = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    client->clientEvent = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    client->region = NULL;
+    memset(client->subscriptions, 0, sizeof(client->subscriptions));
+    if(client->daemonEvent < 0 || client->clientEvent < 0
+            || !d->loop.add(control, EPOLLIN, &client->controlWatch)
+            || !d->loop.add(client->daemonEvent, EPOLLIN, &client->eventWatch)) {
+        perror("rf24d: client");
+        d->loop.remove(control);
+        close(control);
+        if(client->daemonEvent >= 0) close(client->daemonEvent);
+        if(client->clientEvent >= 0) close(client->clientEvent);
+        client->control = -1;
+    }
+}
+
+static bool listenOn(Daemon *d, const char *path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(address.sun_path)) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    strcpy(address.sun_path, path);
+    unlink(path);
+
+    d->listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    return d->listener >= 0
+            && bind(d->listener, (struct sockaddr *)&address, sizeof(address)) == 0
+            && listen(d->listener, MAX_CLIENTS) == 0
+            && d->loop.add(d->listener, EPOLLIN, &d->listenerWatch);
+}
+
+static void usage() {
+    fprintf(stderr, "usage: rf24d [-s socket] [-p priority] [-c cpu] [-l] -r spidev,ce,irq [-r spidev,ce,irq ...]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *path = RF24D_SOCKET;
+    Daemon *d = &rf24d;
+    Rf24RtConfig rt = RF24_RT_DEFAULT;
+
+    int option;
+    while((option = getopt(argc, argv, "s:r:p:c:l")) != -1) {
+        switch(option) {
+        case 's':
+            path = optarg;
+            break;
+        case 'p':
+            rt.priority = atoi(optarg);
+            break;
+        case 'c':
+            rt.cpu = atoi(optarg);
+            break;
+        case 'l':
+            rt.lockMemory = true;
+            break;
+        case 'r':
+            if(d->radioCount == RF24D_MAX_RADIOS) {
+                fprintf(stderr, "rf24d: at most %d radios\n", RF24D_MAX_RADIOS);
+                return 2;
+            }
+            d->radios[d->radioCount] = parseRadio(optarg);
+            if(d->radios[d->radioCount] == NULL) {
+                usage();
+            }
+            d->radios[d->radioCount]->daemon = d;
+            d->radios[d->radioCount]->index = d->radioCount;
+            d->radioCount++;
+            break;
+        default:
+            usage();
+        }
+    }
+    if(d->radioCount == 0) {
+        usage();
+    }
+
+    for(int i = 0; i < MAX_CLIENTS; i++) {
+        Client *client = &d->clients[i];
+        client->daemon = d;
+        client->control = -1;
+        client->region = NULL;
+        client->controlWatch.handler = controlEvent;
+        client->controlWatch.arg = client;
+        client->eventWatch.handler = clientEvent;
+        client->eventWatch.arg = client;
+    }
+    d->listenerWatch.handler = acceptEvent;
+    d->listenerWatch.arg = d;
+
+    if(!d->loop.begin()) {
+        perror("rf24d: epoll");
+        return 1;
+    }
+    for(uint8_t i = 0; i < d->radioCount; i++) {
+        if(!startRadio(d->radios[i])) {
+            fprintf(stderr, "rf24d: radio %d: %s\n", i, strerror(errno));
+            return 1;
+        }
+    }
+    if(!listenOn(d, path)) {
+        perror("rf24d: socket");
+        return 1;
+    }
+
+    // Signals come to this thread, which only waits for them, so the radio
+    // thread is never interrupted, and the report is printed outside it
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if(!d->thread.start(d->loop, rt)) {
+        perror("rf24d: radio thread");
+        return 1;
+    }
+
+    int received;
+    while(sigwait(&signals, &received) == 0 && received == SIGUSR1) {
+        d->latency.report(stderr, true);
+    }
+
+    bool ok = d->thread.stop();
+    if(!ok) {
+        perror("rf24d: epoll_wait");
+    }
+    d->latency.report(stderr);
+
+    for(int i = 0; i < MAX_CLIENTS; i++) {
+        closeClient(&d->clients[i]);
+    }
+    close(d->listener);
+    unlink(path);
+    for(uint8_t i = 0; i < d->radioCount; i++) {
+        d->radios[i]->driver.stop();
+        d->radios[i]->driver.radio.powerDown();
+        delete d->radios[i];
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,164 @@
+/*
+ * rf24tun: a network interface over a radio.
+ *
+ * rf24tun [-n name] [-c channel] [-x id=prefix ...] -w address -a address
+ *         spidev ce irq
+ *
+ * Packets sent to the interface go to the writing address, and packets
+ * received on the reading address, on pipe 1, come out of it. Two ends
+ * swap their addresses, which are 5 characters each, as in the examples.
+ * Each -x gives a /64 prefix, like 2001:db8:1:2::, that header
+ * compression can elide, under context id 0 to 15; both ends need the
+ * same ones. ce and irq are each a GPIO chip and line, like
+ * /dev/gpiochip0:25, or a sysfs pin number.
+ *
+ * Once it's up, address and route it as any other interface, e.g.
+ *     ip addr add fe80::ff:fe00:1/64 dev rf24tun0
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "rf24-linux-io.h"
+#include "rf24-linux-loop.h"
+#include "rf24-linux-radio.h"
+#include "rf24-linux-tun.h"
+
+typedef RF24<Rf24LinuxIo, Rf24LinuxRadio::ADDRESS_WIDTH> Rf24;
+
+static Rf24LinuxLoop loop;
+
+// A GPIO is chip:line, or just a sysfs pin number
+static bool parseGpio(char *spec, const char **chip, unsigned *line, int *sysfs) {
+    char *colon = strrchr(spec, ':');
+    char *end;
+    if(colon == NULL) {
+        *chip = NULL;
+        *line = 0;
+        *sysfs = strtol(spec, &end, 0);
+        return *end == '\0' && *sysfs >= 0;
+    }
+    *colon = '\0';
+    *chip = spec;
+    *line = strtoul(colon + 1, &end, 0);
+    *sysfs = -1;
+    return *end == '\0';
+}
+
+static bool parseContext(Rf24LinuxTun &tun, char *spec) {
+    char *equals = strchr(spec, '=');
+    uint8_t address[16];
+    if(equals == NULL) {
+        return false;
+    }
+    *equals = '\0';
+    return inet_pton(AF_INET6, equals + 1, address) == 1
+            && tun.compressor.context(atoi(spec), address);
+}
+
+static void usage() {
+    fprintf(stderr, "usage: rf24tun [-n name] [-c channel] [-x id=prefix ...] -w address -a address spidev ce irq\n");
+    exit(2);
+}
+
+static void stop(int signal) {
+    (void)signal;
+    loop.stop();
+}
+
+int main(int argc, char **argv) {
+    const char *name = "rf24tun%d";
+    const char *writeAddress = NULL;
+    const char *readAddress = NULL;
+    int channel = 76;
+    char *contexts[16];
+    int contextCount = 0;
+
+    int option;
+    while((option = getopt(argc, argv, "n:c:x:w:a:")) != -1) {
+        switch(option) {
+        case 'n': name = optarg; break;
+        case 'c': channel = atoi(optarg); break;
+        case 'w': writeAddress = optarg; break;
+        case 'a': readAddress = optarg; break;
+        case 'x':
+            if(contextCount == 16) {
+                usage();
+            }
+            contexts[contextCount++] = optarg;
+            break;
+        default: usage();
+        }
+    }
+    const char *cePin, *irqPin;
+    unsigned ceLine, irqLine;
+    int ceSysfs, irqSysfs;
+    if(argc - optind != 3 || writeAddress == NULL || readAddress == NULL
+            || strlen(writeAddress) != Rf24LinuxRadio::ADDRESS_WIDTH
+            || strlen(readAddress) != Rf24LinuxRadio::ADDRESS_WIDTH
+            || !parseGpio(argv[optind + 1], &cePin, &ceLine, &ceSysfs)
+            || !parseGpio(argv[optind + 2], &irqPin, &irqLine, &irqSysfs)) {
+        usage();
+    }
+
+    Rf24LinuxSpi spi(argv[optind]);
+    Rf24LinuxGpio ce(cePin, ceLine, ceSysfs);
+    Rf24LinuxIrq irq(irqPin, irqLine, irqSysfs);
+    Rf24LinuxRadio radio(Rf24LinuxIo(&spi, &ce), &irq);
+    Rf24LinuxTun tun(radio, name);
+    for(int i = 0; i < contextCount; i++) {
+        if(!parseContext(tun, contexts[i])) {
+            usage();
+        }
+    }
+
+    if(!loop.begin()) {
+        perror("rf24tun: epoll");
+        return 1;
+    }
+
+    Rf24 &r = radio.radio;
+    if(!r.begin()) {
+        fprintf(stderr, "rf24tun: no radio\n");
+        return 1;
+    }
+    r.set(AutoAck::all.enable());
+    r.set(Retries::retries(5, 15));
+    r.enableAckPayload();
+    r.set(DynamicPayload::all.enable());
+    r.set(Channel::channel(channel));
+    r.openWritingPipe((const uint8_t *)writeAddress);
+    // Pipe 0 stays on the writing address, for the acks
+    r.openReadingPipe(0, (const uint8_t *)writeAddress);
+    r.openReadingPipe(1, (const uint8_t *)readAddress);
+    r.startListening();
+    radio.halfDuplex(true);
+
+    if(!radio.start(loop)) {
+        perror("rf24tun: radio");
+        return 1;
+    }
+    if(!tun.begin(loop)) {
+        perror("rf24tun: tun");
+        return 1;
+    }
+    printf("%s\n", tun.name());
+    fflush(stdout);
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    bool ok = loop.run();
+
+    tun.end();
+    radio.stop();
+    r.powerDown();
+    fprintf(stderr, "rf24tun: tx %u packets, %u dropped, %u failed; rx %u packets, %u dropped\n",
+            tun.stats.tx_packets, tun.stats.tx_dropped, tun.stats.tx_failed,
+            tun.stats.rx_packets, tun.stats.rx_dropped);
+    return ok ? 0 : 1;
+}